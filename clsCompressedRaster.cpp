@@ -0,0 +1,183 @@
+#ifndef CLS_COMPRESSED_RASTER
+
+#include "clsCompressedRaster.h"
+
+template<typename T, typename MaskT>
+clsCompressedRaster<T, MaskT>::clsCompressedRaster(clsRasterData<T, MaskT> *raster, int blockSize /* = 4096 */,
+                                                   int cacheBlocks /* = 16 */, int level /* = 1 */) :
+    m_mask(NULL), m_coreFileName(""), m_nCells(-1), m_nLyrs(-1), m_is2DRaster(false),
+    m_noDataValue((T) NODATA_VALUE), m_blockSize(blockSize < 1 ? 4096 : blockSize), m_nBlocks(0),
+    m_level(level), m_compressedSize(0), m_cacheBlocks(cacheBlocks < 1 ? 1 : cacheBlocks) {
+    if (raster == NULL || raster->getCellNumber() <= 0) {
+        cout << "The raster to be compressed is empty!" << endl;
+        return;
+    }
+    m_mask = raster->getMask();
+    m_coreFileName = raster->getCoreName();
+    m_is2DRaster = raster->is2DRaster();
+    m_nLyrs = m_is2DRaster ? raster->getLayers() : 1;
+    m_noDataValue = (T) raster->getNoDataValue();
+    m_headers = raster->getRasterHeader();
+    m_srs = raster->getSRSString();
+    int nCells = raster->getCellNumber();
+    m_nBlocks = (nCells + m_blockSize - 1) / m_blockSize;
+    T *data = raster->getRasterDataPointer();
+    T **data2D = raster->get2DRasterDataPointer();
+    if ((m_is2DRaster && data2D == NULL) || (!m_is2DRaster && data == NULL)) {
+        cout << "The raster " + m_coreFileName + " has no data to be compressed!" << endl;
+        return;
+    }
+    int nKeys = m_nLyrs * m_nBlocks;
+    m_blocks.resize(nKeys);
+    m_blockRaw.assign(nKeys, 0);
+#pragma omp parallel
+    {
+        vector<T> values(m_blockSize);
+#pragma omp for
+        for (int key = 0; key < nKeys; key++) {
+            int lyr = key / m_nBlocks;
+            int start = (key % m_nBlocks) * m_blockSize;
+            int count = min(m_blockSize, nCells - start);
+            for (int i = 0; i < count; i++) {
+                values[i] = m_is2DRaster ? data2D[start + i][lyr] : data[start + i];
+            }
+            this->_compress_block(&values[0], count, key);
+        }
+    }
+    for (int key = 0; key < nKeys; key++) m_compressedSize += m_blocks[key].size();
+    m_nCells = nCells;
+}
+
+template<typename T, typename MaskT>
+clsCompressedRaster<T, MaskT>::~clsCompressedRaster(void) {
+    StatusMessage(("Release compressed raster: " + m_coreFileName).c_str());
+    this->releaseCache();
+}
+
+template<typename T, typename MaskT>
+void clsCompressedRaster<T, MaskT>::_compress_block(const T *values, int count, int key) {
+    size_t nBytes = (size_t) count * sizeof(T);
+    vector<unsigned char> &block = m_blocks[key];
+    if (!clsShuffleCodec::compress(values, nBytes, sizeof(T), m_level, block)) {
+        /// store the values directly if not compressible
+        block.assign((const unsigned char *) values, (const unsigned char *) values + nBytes);
+        m_blockRaw[key] = 1;
+    }
+    vector<unsigned char>(block).swap(block);
+}
+
+template<typename T, typename MaskT>
+bool clsCompressedRaster<T, MaskT>::_decompress_block(int key, T *values) const {
+    int start = (key % m_nBlocks) * m_blockSize;
+    int count = min(m_blockSize, m_nCells - start);
+    size_t nBytes = (size_t) count * sizeof(T);
+    const vector<unsigned char> &block = m_blocks[key];
+    if (m_blockRaw[key]) {
+        memcpy(values, &block[0], nBytes);
+    } else if (!clsShuffleCodec::decompress(&block[0], block.size(), sizeof(T), values, nBytes)) {
+        cout << "Decompress block " << key << " of " + m_coreFileName + " failed!" << endl;
+        return false;
+    }
+    return true;
+}
+
+template<typename T, typename MaskT>
+const T *clsCompressedRaster<T, MaskT>::_get_cached_block(int key) {
+    typename map<int, typename list<pair<int, vector<T> > >::iterator>::iterator it = m_cacheIndex.find(key);
+    if (it != m_cacheIndex.end()) {
+        /// move to the front as the most recently used
+        m_cache.splice(m_cache.begin(), m_cache, it->second);
+        return &(it->second->second[0]);
+    }
+    /// reuse the buffer of the least recently used block if the cache is full
+    vector<T> values;
+    if (m_cache.size() >= m_cacheBlocks) {
+        values.swap(m_cache.back().second);
+        m_cacheIndex.erase(m_cache.back().first);
+        m_cache.pop_back();
+    }
+    values.resize(m_blockSize);
+    if (!this->_decompress_block(key, &values[0])) return NULL;
+    m_cache.push_front(make_pair(key, vector<T>()));
+    m_cache.front().second.swap(values);
+    m_cacheIndex[key] = m_cache.begin();
+    return &(m_cache.front().second[0]);
+}
+
+template<typename T, typename MaskT>
+T clsCompressedRaster<T, MaskT>::getValue(int validCellIndex, int lyr /* = 1 */) {
+    if (m_nCells < 0 || validCellIndex < 0 || validCellIndex >= m_nCells || lyr < 1 || lyr > m_nLyrs) {
+        return m_noDataValue;
+    }
+    int key = (lyr - 1) * m_nBlocks + validCellIndex / m_blockSize;
+    lock_guard<mutex> lock(m_cacheMutex);
+    const T *values = this->_get_cached_block(key);
+    if (values == NULL) return m_noDataValue;
+    return values[validCellIndex % m_blockSize];
+}
+
+template<typename T, typename MaskT>
+int clsCompressedRaster<T, MaskT>::readBlock(int lyr, int blockIndex, T *values) const {
+    if (m_nCells < 0 || lyr < 1 || lyr > m_nLyrs || blockIndex < 0 || blockIndex >= m_nBlocks || values == NULL) {
+        return -1;
+    }
+    int key = (lyr - 1) * m_nBlocks + blockIndex;
+    if (!this->_decompress_block(key, values)) return -1;
+    return min(m_blockSize, m_nCells - blockIndex * m_blockSize);
+}
+
+template<typename T, typename MaskT>
+bool clsCompressedRaster<T, MaskT>::readLayer(int lyr, T *values) const {
+    if (m_nCells < 0 || lyr < 1 || lyr > m_nLyrs || values == NULL) return false;
+    bool succeed = true;
+#pragma omp parallel for
+    for (int b = 0; b < m_nBlocks; b++) {
+        if (this->readBlock(lyr, b, values + (size_t) b * m_blockSize) < 0) succeed = false;
+    }
+    return succeed;
+}
+
+template<typename T, typename MaskT>
+clsRasterData<T, MaskT> *clsCompressedRaster<T, MaskT>::toRasterData(void) const {
+    if (m_nCells < 0) return NULL;
+    if (m_mask == NULL || m_mask->getCellNumber() != m_nCells) {
+        cout << "The compressed raster " + m_coreFileName + " should share the index of a mask!" << endl;
+        return NULL;
+    }
+    clsRasterData<MaskT> *mask = m_mask;
+    T *layer = NULL;
+    Initialize1DArray(m_nCells, layer, m_noDataValue);
+    clsRasterData<T, MaskT> *raster = NULL;
+    if (!m_is2DRaster) {
+        if (this->readLayer(1, layer)) raster = new clsRasterData<T, MaskT>(mask, layer);
+    } else {
+        T **values = NULL;
+        Initialize2DArray(m_nCells, m_nLyrs, values, m_noDataValue);
+        bool succeed = true;
+        for (int lyr = 1; lyr <= m_nLyrs && succeed; lyr++) {
+            succeed = this->readLayer(lyr, layer);
+#pragma omp parallel for
+            for (int i = 0; i < m_nCells; i++) values[i][lyr - 1] = layer[i];
+        }
+        if (succeed) raster = new clsRasterData<T, MaskT>(mask, values, m_nLyrs);
+        Release2DArray(m_nCells, values);
+    }
+    Release1DArray(layer);
+    if (raster != NULL) {
+        /// the constructor takes the header of mask, including its NODATA
+        raster->setNoDataValue(m_noDataValue);
+        raster->copyHeader(m_headers);
+        raster->setSRS(m_srs);
+        raster->setCoreName(m_coreFileName);
+    }
+    return raster;
+}
+
+template<typename T, typename MaskT>
+void clsCompressedRaster<T, MaskT>::releaseCache(void) {
+    lock_guard<mutex> lock(m_cacheMutex);
+    m_cache.clear();
+    m_cacheIndex.clear();
+}
+
+#endif /* CLS_COMPRESSED_RASTER */
@@ -0,0 +1,167 @@
+/*!
+ * \brief Define block-compressed in-memory storage of clsRasterData
+ *
+ *        Each layer of the valid cells is split into fixed-size blocks, which are byte-shuffled
+ *        and compressed by zlib (CPLZLibDeflate of GDAL). Multi-layer parameter stacks, e.g.,
+ *        soil layers and monthly climate, are much smaller than the uncompressed 2D array.
+ *        1. Random access by getValue() with a small LRU cache of decompressed blocks
+ *        2. Sequential access by decompressing each block into the caller's buffer
+ */
+#ifndef CLS_COMPRESSED_RASTER
+#define CLS_COMPRESSED_RASTER
+
+#include <list>
+#include <mutex>
+
+#include "clsRasterData.h"
+#include "clsShuffleCodec.h"
+
+/*!
+ * \class clsCompressedRaster
+ * \ingroup data
+ * \brief Read-only block-compressed copy of the valid cells of all layers
+ * Usage:
+ *     clsRasterData<float, int> *stack = new clsRasterData<float, int>(filenames, true, &mask, true);
+ *     clsCompressedRaster<float, int> compressed(stack);
+ *     delete stack;  // the compressed copy is independent of the source raster
+ *     float v = compressed.getValue(i, 3);
+ *     clsRasterData<float, int> *restored = compressed.toRasterData();  // decompress all
+ */
+template<typename T, typename MaskT = T>
+class clsCompressedRaster {
+public:
+    /*!
+     * \brief Constructor, compress the valid cells of all layers
+     * \param[in] raster Source raster, 1D or 2D
+     * \param[in] blockSize Cell number of each block
+     * \param[in] cacheBlocks Maximum number of decompressed blocks cached for getValue()
+     * \param[in] level zlib compression level, 1 (the default) is the fastest
+     */
+    explicit clsCompressedRaster(clsRasterData<T, MaskT> *raster, int blockSize = 4096, int cacheBlocks = 16,
+                                 int level = 1);
+
+    //! Destructor
+    ~clsCompressedRaster(void);
+
+    //! Is the compressed raster ready for use?
+    bool isInitialized(void) const { return m_nCells > 0; }
+
+    //! Get the valid cell number of each layer
+    int getCellNumber(void) const { return m_nCells; }
+
+    //! Get the layer number
+    int getLayers(void) const { return m_nLyrs; }
+
+    //! Get the cell number of each block
+    int getBlockSize(void) const { return m_blockSize; }
+
+    //! Get the block number of each layer
+    int getBlockNumber(void) const { return m_nBlocks; }
+
+    //! Get NoDATA value
+    T getNoDataValue(void) const { return m_noDataValue; }
+
+    //! Get the total size of the compressed blocks in bytes
+    size_t getCompressedSize(void) const { return m_compressedSize; }
+
+    //! Get the size of the uncompressed data in bytes
+    size_t getUncompressedSize(void) const { return (size_t) m_nCells * m_nLyrs * sizeof(T); }
+
+    /*!
+     * \brief Get value of the valid cell, the block is decompressed and cached on demand
+     * \param[in] validCellIndex Index of the valid cell, i.e., the same as \a clsRasterData::getValue(int, int)
+     * \param[in] lyr Layer number, from 1
+     * \return NoDATA if out of range.
+     */
+    T getValue(int validCellIndex, int lyr = 1);
+
+    /*!
+     * \brief Decompress a block into the caller's buffer without caching, e.g., to iterate a layer
+     * Blocks can be read in parallel.
+     * \param[in] lyr Layer number, from 1
+     * \param[in] blockIndex Block index of the layer, from 0
+     * \param[out] values Buffer with at least \a getBlockSize() elements
+     * \return Cell number of the block, -1 if failed.
+     */
+    int readBlock(int lyr, int blockIndex, T *values) const;
+
+    /*!
+     * \brief Decompress a layer into the caller's buffer
+     * \param[in] lyr Layer number, from 1
+     * \param[out] values Buffer with at least \a getCellNumber() elements
+     * \return false if failed.
+     */
+    bool readLayer(int lyr, T *values) const;
+
+    /*!
+     * \brief Decompress all layers into a new raster which shares the mask of the source raster
+     * The header, NODATA value, and spatial reference are the same as the source raster.
+     * \return NULL if the source raster has no mask, the caller should release the returned raster.
+     */
+    clsRasterData<T, MaskT> *toRasterData(void) const;
+
+    //! Release the cached decompressed blocks
+    void releaseCache(void);
+
+private:
+    //! Disable copy
+    clsCompressedRaster(const clsCompressedRaster &);
+    clsCompressedRaster &operator=(const clsCompressedRaster &);
+
+    /*!
+     * \brief Shuffle and compress a block, \sa clsShuffleCodec
+     * \param[in] values Cell values of the block
+     * \param[in] count Cell number of the block
+     * \param[in] key Block key, i.e., (lyr - 1) * m_nBlocks + blockIndex
+     */
+    void _compress_block(const T *values, int count, int key);
+
+    /*!
+     * \brief Decompress and unshuffle a block
+     * \return false if the block is corrupted.
+     */
+    bool _decompress_block(int key, T *values) const;
+
+    //! Get the decompressed block from the LRU cache, the caller should hold \a m_cacheMutex
+    const T *_get_cached_block(int key);
+
+private:
+    ///< Mask of the source raster
+    clsRasterData<MaskT> *m_mask;
+    ///< Core file name of the source raster
+    string m_coreFileName;
+    ///< Valid cell number of each layer
+    int m_nCells;
+    ///< Layer number
+    int m_nLyrs;
+    ///< Is the source raster 2D?
+    bool m_is2DRaster;
+    ///< NoDATA value
+    T m_noDataValue;
+    ///< Header of the source raster
+    map<string, double> m_headers;
+    ///< Spatial reference of the source raster
+    string m_srs;
+    ///< Cell number of each block
+    int m_blockSize;
+    ///< Block number of each layer
+    int m_nBlocks;
+    ///< Compression level
+    int m_level;
+    ///< Compressed blocks of all layers, i.e., [nLyrs * nBlocks]
+    vector<vector<unsigned char> > m_blocks;
+    ///< Is the block stored uncompressed, e.g., if not compressible?
+    vector<char> m_blockRaw;
+    ///< Total size of the compressed blocks
+    size_t m_compressedSize;
+    ///< Maximum number of cached blocks
+    size_t m_cacheBlocks;
+    ///< Decompressed blocks, the most recently used first
+    list<pair<int, vector<T> > > m_cache;
+    ///< Position of each cached block in \a m_cache
+    map<int, typename list<pair<int, vector<T> > >::iterator> m_cacheIndex;
+    ///< Serialize the access of the cache
+    mutex m_cacheMutex;
+};
+
+#endif /* CLS_COMPRESSED_RASTER */
@@ -0,0 +1,352 @@
+#ifndef CLS_FLOW_ROUTING
+
+#include "clsFlowRouting.h"
+#include <queue>
+#include <functional>
+#include <atomic>
+#include <cmath>
+#include <limits>
+
+#ifndef PI
+#define PI 3.14159265358979323846
+#endif /* PI */
+#ifndef SQ2
+#define SQ2 1.4142135623730951
+#endif /* SQ2 */
+
+template<typename T, typename MaskT>
+clsFlowRouting<T, MaskT>::clsFlowRouting(clsRasterData<T, MaskT> *dem) : m_dem(dem), m_mask(NULL),
+                                                                         m_nCells(-1), m_nRows(-1), m_nCols(-1),
+                                                                         m_cellSize(NODATA_VALUE),
+                                                                         m_neighbors(NULL) {
+    if (m_dem == NULL || m_dem->is2DRaster()) {
+        cout << "Flow routing requires a 1D DEM raster!" << endl;
+        return;
+    }
+    m_mask = m_dem->getMask();
+    if (m_mask == NULL || m_mask->getCellNumber() != m_dem->getCellNumber()) {
+        cout << "The DEM must be read with a mask layer and share the mask index!" << endl;
+        return;
+    }
+    m_nCells = m_dem->getCellNumber();
+    m_nRows = m_dem->getRows();
+    m_nCols = m_dem->getCols();
+    m_cellSize = m_dem->getCellWidth();
+    m_neighbors = m_mask->getNeighborIndex();
+    if (m_neighbors == NULL) m_nCells = -1;
+}
+
+template<typename T, typename MaskT>
+clsFlowRouting<T, MaskT>::~clsFlowRouting(void) {
+    m_neighbors = NULL;  // owned by the mask
+}
+
+template<typename T, typename MaskT>
+T *clsFlowRouting<T, MaskT>::_get_elevation(clsRasterData<T, MaskT> *dem) {
+    if (dem == NULL) dem = m_dem;
+    if (dem->getCellNumber() != m_nCells) {
+        cout << "The DEM does not share the mask index of the flow routing!" << endl;
+        return NULL;
+    }
+    return dem->getRasterDataPointer();
+}
+
+template<typename T, typename MaskT>
+clsRasterData<T, MaskT> *clsFlowRouting<T, MaskT>::FillDepressions(double epsilon /* = 1.e-5 */) {
+    if (!this->isInitialized()) return NULL;
+    T *elev = this->_get_elevation(NULL);
+    T noDataValue = m_dem->getNoDataValue();
+    T *filled = NULL;
+    Initialize1DArray(m_nCells, filled, elev);
+    bool *closed = NULL;
+    Initialize1DArray(m_nCells, closed, false);
+    /// min-heap of (elevation, cell index)
+    typedef pair<double, int> ElevCell;
+    priority_queue<ElevCell, vector<ElevCell>, greater<ElevCell> > open;
+    /// 1. seed by the cells on the edge of valid region, NODATA cells are closed
+    for (int i = 0; i < m_nCells; i++) {
+        if (FloatEqual(filled[i], noDataValue)) {
+            closed[i] = true;
+            continue;
+        }
+        for (int k = 0; k < 8; k++) {
+            int n = m_neighbors[i * 8 + k];
+            if (n < 0 || FloatEqual(elev[n], noDataValue)) {
+                open.push(ElevCell((double) filled[i], i));
+                closed[i] = true;
+                break;
+            }
+        }
+    }
+    /// 2. flood inward from the lowest cell
+    while (!open.empty()) {
+        int c = open.top().second;
+        open.pop();
+        for (int k = 0; k < 8; k++) {
+            int n = m_neighbors[c * 8 + k];
+            if (n < 0 || closed[n]) continue;
+            closed[n] = true;
+            T minz = _raise_elevation(filled[c], epsilon);
+            if (filled[n] < minz) filled[n] = minz;
+            open.push(ElevCell((double) filled[n], n));
+        }
+    }
+    Release1DArray(closed);
+    clsRasterData<T, MaskT> *filledDEM = new clsRasterData<T, MaskT>(m_mask, filled);
+    Release1DArray(filled);
+    return filledDEM;
+}
+
+template<typename T, typename MaskT>
+T clsFlowRouting<T, MaskT>::_raise_elevation(T z, double epsilon) {
+    T raised = (T) ((double) z + epsilon);
+    if (epsilon <= 0. || raised > z) return raised;
+    /// the increment is below the resolution of T at this elevation, e.g., 1.e-5 of float above 128
+    if (numeric_limits<T>::is_integer) return z + 1;
+    return nextafter(z, numeric_limits<T>::max());
+}
+
+template<typename T, typename MaskT>
+clsRasterData<int, MaskT> *clsFlowRouting<T, MaskT>::FlowDirectionD8(clsRasterData<T, MaskT> *dem /* = NULL */) {
+    if (!this->isInitialized()) return NULL;
+    T *elev = this->_get_elevation(dem);
+    if (elev == NULL) return NULL;
+    T noDataValue = dem == NULL ? m_dem->getNoDataValue() : dem->getNoDataValue();
+    int *dir = NULL;
+    Initialize1DArray(m_nCells, dir, FLOWDIR_NODATA);
+#pragma omp parallel for
+    for (int i = 0; i < m_nCells; i++) {
+        if (FloatEqual(elev[i], noDataValue)) continue;
+        double maxSlope = 0.;
+        int outlet = -1;
+        int steepest = -1;
+        for (int k = 0; k < 8; k++) {
+            int n = m_neighbors[i * 8 + k];
+            if (n < 0 || FloatEqual(elev[n], noDataValue)) {
+                if (outlet < 0) outlet = k;
+                continue;
+            }
+            double dist = k % 2 == 0 ? m_cellSize : m_cellSize * SQ2;
+            double slope = ((double) elev[i] - (double) elev[n]) / dist;
+            if (slope > maxSlope) {
+                maxSlope = slope;
+                steepest = k;
+            }
+        }
+        if (steepest < 0) steepest = outlet;
+        dir[i] = steepest < 0 ? FLOWDIR_UNDEFINED : 1 << steepest;
+    }
+    clsRasterData<int, MaskT> *d8 = new clsRasterData<int, MaskT>(m_mask, dir);
+    Release1DArray(dir);
+    return d8;
+}
+
+template<typename T, typename MaskT>
+clsRasterData<float, MaskT> *clsFlowRouting<T, MaskT>::FlowDirectionDinf(clsRasterData<T, MaskT> *dem /* = NULL */) {
+    if (!this->isInitialized()) return NULL;
+    T *elev = this->_get_elevation(dem);
+    if (elev == NULL) return NULL;
+    T noDataValue = dem == NULL ? m_dem->getNoDataValue() : dem->getNoDataValue();
+    /// Facets defined by Tarboton (1997), counterclockwise from east. The neighbor index
+    /// of e1 (cardinal) and e2 (diagonal) follows the clockwise order of D8_DELTA_ROW/COL.
+    const int e1[8] = {0, 6, 6, 4, 4, 2, 2, 0};
+    const int e2[8] = {7, 7, 5, 5, 3, 3, 1, 1};
+    const double ac[8] = {0., 1., 1., 2., 2., 3., 3., 4.};
+    const double af[8] = {1., -1., 1., -1., 1., -1., 1., -1.};
+    const double diagDist = m_cellSize * SQ2;
+    float *angle = NULL;
+    Initialize1DArray(m_nCells, angle, NODATA_VALUE);
+#pragma omp parallel for
+    for (int i = 0; i < m_nCells; i++) {
+        if (FloatEqual(elev[i], noDataValue)) continue;
+        double e0 = elev[i];
+        double maxSlope = 0.;
+        double maxAngle = FLOWANGLE_UNDEFINED;
+        for (int f = 0; f < 8; f++) {
+            int n1 = m_neighbors[i * 8 + e1[f]];
+            int n2 = m_neighbors[i * 8 + e2[f]];
+            if (n1 < 0 || n2 < 0 || FloatEqual(elev[n1], noDataValue) || FloatEqual(elev[n2], noDataValue)) {
+                continue;
+            }
+            double s1 = (e0 - elev[n1]) / m_cellSize;
+            double s2 = ((double) elev[n1] - (double) elev[n2]) / m_cellSize;
+            double r = atan2(s2, s1);
+            double s = sqrt(s1 * s1 + s2 * s2);
+            if (r < 0.) {
+                r = 0.;
+                s = s1;
+            } else if (r > PI * 0.25) {
+                r = PI * 0.25;
+                s = (e0 - elev[n2]) / diagDist;
+            }
+            if (s > maxSlope) {
+                maxSlope = s;
+                maxAngle = af[f] * r + ac[f] * PI * 0.5;
+            }
+        }
+        if (maxAngle >= 2. * PI) maxAngle -= 2. * PI;
+        if (maxAngle < 0.) maxAngle = FLOWANGLE_UNDEFINED;
+        angle[i] = (float) maxAngle;
+    }
+    clsRasterData<float, MaskT> *dinf = new clsRasterData<float, MaskT>(m_mask, angle);
+    Release1DArray(angle);
+    return dinf;
+}
+
+template<typename T, typename MaskT>
+float *clsFlowRouting<T, MaskT>::_accumulate(const int *receivers, const float *fractions,
+                                             clsRasterData<float, MaskT> *weight) {
+    float *w = NULL;
+    if (weight != NULL) {
+        if (weight->getCellNumber() != m_nCells) {
+            cout << "The weight does not share the mask index of the flow routing!" << endl;
+            return NULL;
+        }
+        w = weight->getRasterDataPointer();
+    }
+    /// 1. count the donors of each cell
+    atomic<int> *donors = new atomic<int>[m_nCells];
+#pragma omp parallel for
+    for (int i = 0; i < m_nCells; i++) {
+        donors[i].store(0, memory_order_relaxed);
+    }
+#pragma omp parallel for
+    for (int i = 0; i < m_nCells; i++) {
+        for (int r = 0; r < 2; r++) {
+            int down = receivers[i * 2 + r];
+            if (down >= 0) donors[down].fetch_add(1, memory_order_relaxed);
+        }
+    }
+    vector<int> sources;
+    for (int i = 0; i < m_nCells; i++) {
+        if (donors[i].load(memory_order_relaxed) == 0) sources.push_back(i);
+    }
+    /// 2. walk downstream from each source, the thread which releases the last dependency of a cell
+    ///    pulls the final values of its donors and continues the walk.
+    float *acc = NULL;
+    Initialize1DArray(m_nCells, acc, 0.f);
+    int nSources = (int) sources.size();
+#pragma omp parallel for schedule(dynamic, 256)
+    for (int s = 0; s < nSources; s++) {
+        /// a cell may release both of its receivers, so keep a small stack
+        vector<int> ready(1, sources[s]);
+        while (!ready.empty()) {
+            int c = ready.back();
+            ready.pop_back();
+            double sum = w == NULL ? 1. : (FloatEqual(w[c], (float) NODATA_VALUE) ? 0. : w[c]);
+            for (int k = 0; k < 8; k++) {
+                int n = m_neighbors[c * 8 + k];
+                if (n < 0) continue;
+                for (int r = 0; r < 2; r++) {
+                    if (receivers[n * 2 + r] == c) sum += acc[n] * fractions[n * 2 + r];
+                }
+            }
+            acc[c] = (float) sum;
+            for (int r = 0; r < 2; r++) {
+                int down = receivers[c * 2 + r];
+                if (down < 0) continue;
+                if (donors[down].fetch_sub(1, memory_order_acq_rel) == 1) ready.push_back(down);
+            }
+        }
+    }
+    delete[] donors;
+    return acc;
+}
+
+template<typename T, typename MaskT>
+clsRasterData<float, MaskT> *clsFlowRouting<T, MaskT>::FlowAccumulation(clsRasterData<int, MaskT> *d8,
+                                                                        clsRasterData<float, MaskT> *weight
+                                                                        /* = NULL */) {
+    if (!this->isInitialized() || d8 == NULL) return NULL;
+    if (d8->getCellNumber() != m_nCells) {
+        cout << "The flow direction does not share the mask index of the flow routing!" << endl;
+        return NULL;
+    }
+    int *dir = d8->getRasterDataPointer();
+    int *receivers = NULL;
+    float *fractions = NULL;
+    Initialize1DArray(m_nCells * 2, receivers, -1);
+    Initialize1DArray(m_nCells * 2, fractions, 0.f);
+#pragma omp parallel for
+    for (int i = 0; i < m_nCells; i++) {
+        if (dir[i] <= FLOWDIR_UNDEFINED) continue;
+        for (int k = 0; k < 8; k++) {
+            if (dir[i] != 1 << k) continue;
+            receivers[i * 2] = m_neighbors[i * 8 + k];
+            fractions[i * 2] = 1.f;
+            break;
+        }
+    }
+    float *acc = this->_accumulate(receivers, fractions, weight);
+    Release1DArray(receivers);
+    Release1DArray(fractions);
+    if (acc == NULL) return NULL;
+    /// NODATA of the direction is also NODATA of the accumulation
+#pragma omp parallel for
+    for (int i = 0; i < m_nCells; i++) {
+        if (dir[i] == FLOWDIR_NODATA) acc[i] = NODATA_VALUE;
+    }
+    clsRasterData<float, MaskT> *accum = new clsRasterData<float, MaskT>(m_mask, acc);
+    Release1DArray(acc);
+    return accum;
+}
+
+template<typename T, typename MaskT>
+clsRasterData<float, MaskT> *clsFlowRouting<T, MaskT>::FlowAccumulationDinf(clsRasterData<float, MaskT> *dinf,
+                                                                            clsRasterData<float, MaskT> *weight
+                                                                            /* = NULL */,
+                                                                            clsRasterData<T, MaskT> *dem
+                                                                            /* = NULL */) {
+    if (!this->isInitialized() || dinf == NULL) return NULL;
+    if (dinf->getCellNumber() != m_nCells) {
+        cout << "The flow direction does not share the mask index of the flow routing!" << endl;
+        return NULL;
+    }
+    T *elev = dem == NULL ? NULL : this->_get_elevation(dem);
+    if (dem != NULL && elev == NULL) return NULL;
+    float *angle = dinf->getRasterDataPointer();
+    int *receivers = NULL;
+    float *fractions = NULL;
+    Initialize1DArray(m_nCells * 2, receivers, -1);
+    Initialize1DArray(m_nCells * 2, fractions, 0.f);
+    const double facet = PI * 0.25;
+    /// the fraction below the resolution of the float angle is treated as 0
+    const double minFraction = 1.e-5;
+#pragma omp parallel for
+    for (int i = 0; i < m_nCells; i++) {
+        if (angle[i] < 0.f) continue;
+        /// counterclockwise facet number, and the corresponding clockwise neighbor index
+        int k = (int) (angle[i] / facet) % 8;
+        double alpha = angle[i] - k * facet;
+        if (alpha < 0.) alpha = 0.;
+        if (alpha > facet) alpha = facet;
+        int neighbor[2] = {m_neighbors[i * 8 + (8 - k) % 8], m_neighbors[i * 8 + (8 - (k + 1) % 8) % 8]};
+        double fraction[2] = {(facet - alpha) / facet, alpha / facet};
+        /// the neighbor without flow may be higher, which would make a cycle of donors,
+        /// so only the lower neighbors with flow are receivers
+        int count = 0;
+        for (int r = 0; r < 2; r++) {
+            if (neighbor[r] < 0 || fraction[r] <= minFraction) continue;
+            if (elev != NULL && (double) elev[neighbor[r]] >= (double) elev[i]) continue;
+            receivers[i * 2 + count] = neighbor[r];
+            fractions[i * 2 + count] = (float) fraction[r];
+            count++;
+        }
+        /// the whole flow goes to the only receiver
+        if (count == 1) fractions[i * 2] = 1.f;
+    }
+    float *acc = this->_accumulate(receivers, fractions, weight);
+    Release1DArray(receivers);
+    Release1DArray(fractions);
+    if (acc == NULL) return NULL;
+    /// NODATA of the direction is also NODATA of the accumulation
+#pragma omp parallel for
+    for (int i = 0; i < m_nCells; i++) {
+        if (FloatEqual(angle[i], (float) NODATA_VALUE)) acc[i] = NODATA_VALUE;
+    }
+    clsRasterData<float, MaskT> *accum = new clsRasterData<float, MaskT>(m_mask, acc);
+    Release1DArray(acc);
+    return accum;
+}
+
+#endif /* CLS_FLOW_ROUTING */
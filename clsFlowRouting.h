@@ -0,0 +1,139 @@
+/*!
+ * \brief Define flow routing class to derive hydrologic layers from DEM
+ *
+ *        1. Depression filling by priority-flood (Barnes et al., 2014)
+ *        2. D8 and D-infinity (Tarboton, 1997) flow direction
+ *        3. Parallel flow accumulation by dependency counting
+ *        All algorithms work on the valid cells of clsRasterData, and the derived
+ *        layers share the same mask index with the input DEM.
+ */
+#ifndef CLS_FLOW_ROUTING
+#define CLS_FLOW_ROUTING
+
+#include "clsRasterData.h"
+
+/*!
+ * D8 flow direction codes, the same as ArcGIS, i.e.,
+ *     32  64 128
+ *     16   x   1
+ *      8   4   2
+ * The neighbor index k (0 ~ 7) of \a D8_DELTA_ROW and \a D8_DELTA_COL corresponds to the code (1 << k).
+ */
+#define FLOWDIR_NODATA          -9999
+#define FLOWDIR_UNDEFINED       0
+/*!
+ * D-infinity flow angle of the valid cells without flow, e.g., pits and flats
+ */
+#define FLOWANGLE_UNDEFINED     -1.
+
+/*!
+ * \class clsFlowRouting
+ * \ingroup data
+ * \brief Flow routing on valid cells of a DEM raster
+ * The DEM should be read with a mask layer, and the cell number of DEM should be the
+ * same as the mask, e.g., `clsRasterData<float, int> dem(demfile, true, &mask, true);`.
+ * Then all derived layers are constructed by the mask and the 1D data array,
+ * e.g., `clsRasterData<int, int>(&mask, values)`.
+ */
+template<typename T, typename MaskT = T>
+class clsFlowRouting {
+public:
+    /*!
+     * \brief Constructor by DEM data
+     * \param[in] dem \a clsRasterData<T, MaskT>, DEM which shares the mask index
+     */
+    explicit clsFlowRouting(clsRasterData<T, MaskT> *dem);
+
+    //! Destructor
+    ~clsFlowRouting(void);
+
+    //! Is the flow routing ready for use?
+    bool isInitialized(void) const { return m_nCells > 0; }
+
+    /*!
+     * \brief Fill depressions by the priority-flood algorithm
+     * \param[in] epsilon Minimal elevation increment to avoid flats, 0 means plain filling.
+     *                    If it is below the resolution of T at the elevation, the next representable value is used.
+     * \return Filled DEM, which should be released by the caller.
+     */
+    clsRasterData<T, MaskT> *FillDepressions(double epsilon = 1.e-5);
+
+    /*!
+     * \brief Calculate D8 flow direction according to the steepest descent
+     * Cells on the boundary without lower neighbor flow out of the valid region,
+     * pits and flats are assigned by \a FLOWDIR_UNDEFINED.
+     * \param[in] dem Optional, e.g., the filled DEM. The default is the input DEM.
+     * \return D8 flow direction, which should be released by the caller.
+     */
+    clsRasterData<int, MaskT> *FlowDirectionD8(clsRasterData<T, MaskT> *dem = NULL);
+
+    /*!
+     * \brief Calculate D-infinity flow direction, i.e., flow angle in radians
+     * Angle is counterclockwise from east in [0, 2 * PI), no flow (e.g., pits and flats) is
+     * \a FLOWANGLE_UNDEFINED, and NODATA of DEM is \a NODATA_VALUE.
+     * \param[in] dem Optional, e.g., the filled DEM. The default is the input DEM.
+     * \return D-infinity flow angle, which should be released by the caller.
+     */
+    clsRasterData<float, MaskT> *FlowDirectionDinf(clsRasterData<T, MaskT> *dem = NULL);
+
+    /*!
+     * \brief Calculate flow accumulation by D8 flow direction
+     * The accumulation includes the weight (or one cell) of the current cell.
+     * \param[in] d8 D8 flow direction
+     * \param[in] weight Optional weight of each cell, the default is 1.
+     * \return Flow accumulation, which should be released by the caller.
+     */
+    clsRasterData<float, MaskT> *FlowAccumulation(clsRasterData<int, MaskT> *d8,
+                                                  clsRasterData<float, MaskT> *weight = NULL);
+
+    /*!
+     * \brief Calculate flow accumulation by D-infinity flow direction
+     * Flow is proportioned between the two neighbors of the facet, the neighbor without flow
+     * (i.e., the flow angle is along the other one) is not a receiver.
+     * \param[in] dinf D-infinity flow angle
+     * \param[in] weight Optional weight of each cell, the default is 1.
+     * \param[in] dem Optional, the DEM from which \a dinf is derived, the neighbors not lower than
+     *                the cell are not receivers either.
+     * \sa FlowAccumulation
+     */
+    clsRasterData<float, MaskT> *FlowAccumulationDinf(clsRasterData<float, MaskT> *dinf,
+                                                      clsRasterData<float, MaskT> *weight = NULL,
+                                                      clsRasterData<T, MaskT> *dem = NULL);
+
+private:
+    /*!
+     * \brief Get the elevation of valid cells, NODATA cells are excluded
+     */
+    T *_get_elevation(clsRasterData<T, MaskT> *dem);
+
+    /*!
+     * \brief Raise the elevation by epsilon, at least to the next representable value if epsilon > 0
+     */
+    static T _raise_elevation(T z, double epsilon);
+
+    /*!
+     * \brief Accumulate by the receivers and fractions of each cell in parallel
+     * \param[in] receivers Downstream cell indexes, i.e., cell i flows to receivers[2 * i] and receivers[2 * i + 1]
+     * \param[in] fractions Fractions of the flow to the receivers
+     * \param[in] weight Optional weight of each cell
+     */
+    float *_accumulate(const int *receivers, const float *fractions, clsRasterData<float, MaskT> *weight);
+
+private:
+    ///< DEM data
+    clsRasterData<T, MaskT> *m_dem;
+    ///< Mask which defines the valid cells
+    clsRasterData<MaskT> *m_mask;
+    ///< Valid cell number
+    int m_nCells;
+    ///< Row number
+    int m_nRows;
+    ///< Column number
+    int m_nCols;
+    ///< Cell size
+    double m_cellSize;
+    ///< Neighbor index of each valid cell shared by the mask, \sa clsRasterData::getNeighborIndex()
+    const int *m_neighbors;
+};
+
+#endif /* CLS_FLOW_ROUTING */
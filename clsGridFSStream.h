@@ -0,0 +1,350 @@
+/*!
+ * \brief Define the GridFS storage backend of raster blobs
+ *
+ *        The data is written and read piece by piece through the mongo-c-driver GridFS file API,
+ *        so that the whole file is never buffered in memory, e.g., by MongoGridFS::getStreamData().
+ *        The blob metadata is stored as the metadata document of the GridFS file.
+ */
+#ifndef CLS_GRIDFS_STREAM
+#define CLS_GRIDFS_STREAM
+
+#ifdef USE_MONGODB
+
+#include <string>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <stdint.h>
+
+#include "MongoUtil.h"
+#include "clsRasterBlobStore.h"
+
+using namespace std;
+
+/*!
+ * Chunk size of the GridFS file in bytes, i.e., the default chunk size (255 KB) of GridFS
+ */
+#define GRIDFS_CHUNK_BYTES      261120
+
+/*!
+ * \class clsGridFSWriter
+ * \ingroup data
+ * \brief Write GridFS file piece by piece, the existing file with the same name is replaced when committed
+ * The file is written under a temporary name and renamed when committed, so the existing file is intact
+ * until then, and the written chunks are removed if the file is not committed.
+ */
+class clsGridFSWriter : public clsBlobOutput {
+public:
+    /*!
+     * \brief Constructor, create the GridFS file
+     * \param[in] gfs \a MongoGridFS
+     * \param[in] filename GridFS file name
+     * \param[in] chunkSize Chunk size of the file in bytes
+     */
+    clsGridFSWriter(MongoGridFS *gfs, const string &filename, uint32_t chunkSize = GRIDFS_CHUNK_BYTES);
+
+    //! Destructor, the file and its written chunks are removed if not committed
+    ~clsGridFSWriter(void);
+
+    //! Is the file created successfully?
+    bool isOpen(void) const { return m_file != NULL; }
+
+    //! Append data to the file
+    bool write(const void *data, size_t length);
+
+    //! Save the file with the metadata, rename it, and remove the replaced files
+    bool commit(const BlobMetadata &metadata);
+
+private:
+    //! Disable copy
+    clsGridFSWriter(const clsGridFSWriter &);
+    clsGridFSWriter &operator=(const clsGridFSWriter &);
+
+    //! Remove the file being written and its chunks
+    void _discard(void);
+
+    //! Remove the other files with the same name, i.e., the replaced ones
+    void _remove_replaced(void);
+
+private:
+    ///< GridFS
+    MongoGridFS *m_gfs;
+    ///< GridFS file being written
+    mongoc_gridfs_file_t *m_file;
+    ///< File name
+    string m_filename;
+    ///< Temporary file name until committed
+    string m_tmpfilename;
+};
+
+/*!
+ * \class clsGridFSReader
+ * \ingroup data
+ * \brief Read GridFS file piece by piece
+ */
+class clsGridFSReader : public clsBlobInput {
+public:
+    /*!
+     * \brief Constructor, open the GridFS file
+     * \param[in] gfs \a MongoGridFS
+     * \param[in] filename GridFS file name
+     */
+    clsGridFSReader(MongoGridFS *gfs, const string &filename);
+
+    //! Destructor
+    ~clsGridFSReader(void);
+
+    //! Is the file opened successfully?
+    bool isOpen(void) const { return m_file != NULL; }
+
+    //! Length of the file in bytes
+    size_t length(void) const { return m_length; }
+
+    //! Metadata of the file, the numeric and string values only
+    const BlobMetadata &metadata(void) const { return m_metadata; }
+
+    //! Identity of the file, i.e., <file id>:<md5>:<upload date>:<length>
+    string identity(void) const;
+
+    //! Read the next piece of the file
+    size_t read(void *data, size_t length);
+
+private:
+    //! Disable copy
+    clsGridFSReader(const clsGridFSReader &);
+    clsGridFSReader &operator=(const clsGridFSReader &);
+
+private:
+    ///< GridFS file being read
+    mongoc_gridfs_file_t *m_file;
+    ///< Length of the file in bytes
+    size_t m_length;
+    ///< Metadata of the file
+    BlobMetadata m_metadata;
+};
+
+/*!
+ * \class clsGridFSBlobStore
+ * \ingroup data
+ * \brief Raster blob store of GridFS, each blob is a GridFS file
+ */
+class clsGridFSBlobStore : public clsRasterBlobStore {
+public:
+    //! Constructor, \a gfs is not owned
+    explicit clsGridFSBlobStore(MongoGridFS *gfs) : m_gfs(gfs), m_pool(NULL), m_client(NULL) {}
+
+    /*!
+     * \brief Constructor by client pool, which can be cloned for concurrent reads, e.g., the tiles of raster
+     * A client is popped from the pool, and pushed back on destruction, \sa BatchReadFromMongoDB().
+     * \param[in] pool Client pool of MongoDB, \a mongoc_client_pool_t
+     * \param[in] dbName Database name
+     * \param[in] gfsName GridFS name, i.e., the prefix of the collections
+     * \param[in] tryPop Do not wait if no client is available in the pool, then the store is not opened
+     */
+    clsGridFSBlobStore(mongoc_client_pool_t *pool, const string &dbName, const string &gfsName, bool tryPop = false);
+
+    //! Destructor, the GridFS and client popped from the pool are released
+    ~clsGridFSBlobStore(void);
+
+    //! Is the GridFS available?
+    bool isOpen(void) const { return m_gfs != NULL; }
+
+    clsBlobOutput *openWrite(const string &name) {
+        if (m_gfs == NULL) return NULL;
+        clsGridFSWriter *output = new clsGridFSWriter(m_gfs, name);
+        if (output->isOpen()) return output;
+        delete output;
+        return NULL;
+    }
+
+    clsBlobInput *openRead(const string &name) {
+        if (m_gfs == NULL) return NULL;
+        clsGridFSReader *input = new clsGridFSReader(m_gfs, name);
+        if (input->isOpen()) return input;
+        delete input;
+        return NULL;
+    }
+
+    bool remove(const string &name) { return m_gfs != NULL && m_gfs->removeFile(name); }
+
+    //! Pop another client from the pool, NULL if the store is not constructed by pool or the pool is exhausted
+    clsRasterBlobStore *clone(void);
+
+private:
+    //! Disable copy
+    clsGridFSBlobStore(const clsGridFSBlobStore &);
+    clsGridFSBlobStore &operator=(const clsGridFSBlobStore &);
+
+private:
+    ///< GridFS, owned if the store is constructed by pool
+    MongoGridFS *m_gfs;
+    ///< Client pool, NULL if \a m_gfs is not owned
+    mongoc_client_pool_t *m_pool;
+    ///< Client popped from the pool
+    mongoc_client_t *m_client;
+    ///< Database name
+    string m_dbName;
+    ///< GridFS name
+    string m_gfsName;
+};
+
+/// Since clsGridFSWriter and clsGridFSReader are not class templates, the following definitions are inline.
+
+inline clsGridFSWriter::clsGridFSWriter(MongoGridFS *gfs, const string &filename,
+                                        uint32_t chunkSize /* = GRIDFS_CHUNK_BYTES */) :
+    m_gfs(gfs), m_file(NULL), m_filename(filename), m_tmpfilename(filename + ".tmp." + GetBlobWriteId()) {
+    mongoc_gridfs_file_opt_t opt;
+    memset(&opt, 0, sizeof(opt));
+    opt.filename = m_tmpfilename.c_str();
+    opt.chunk_size = chunkSize;
+    m_file = mongoc_gridfs_create_file(gfs->getGridFS(), &opt);
+    if (m_file == NULL) cout << "Create GridFS file " + filename + " failed." << endl;
+}
+
+inline clsGridFSWriter::~clsGridFSWriter(void) {
+    this->_discard();
+}
+
+inline void clsGridFSWriter::_discard(void) {
+    if (m_file == NULL) return;
+    /// the chunks are flushed while writing, which are removed by the file id
+    bson_error_t err;
+    mongoc_gridfs_file_remove(m_file, &err);
+    mongoc_gridfs_file_destroy(m_file);
+    m_file = NULL;
+}
+
+inline void clsGridFSWriter::_remove_replaced(void) {
+    const bson_value_t *newId = mongoc_gridfs_file_get_id(m_file);
+    bson_t *filter = bson_new();
+    BSON_APPEND_UTF8(filter, "filename", m_filename.c_str());
+    mongoc_gridfs_file_list_t *list = mongoc_gridfs_find_with_opts(m_gfs->getGridFS(), filter, NULL);
+    bson_destroy(filter);
+    if (list == NULL) return;
+    bson_error_t err;
+    mongoc_gridfs_file_t *file = NULL;
+    while ((file = mongoc_gridfs_file_list_next(list)) != NULL) {
+        const bson_value_t *id = mongoc_gridfs_file_get_id(file);
+        if (newId == NULL || id == NULL || id->value_type != BSON_TYPE_OID ||
+            !bson_oid_equal(&id->value.v_oid, &newId->value.v_oid)) {
+            mongoc_gridfs_file_remove(file, &err);
+        }
+        mongoc_gridfs_file_destroy(file);
+    }
+    mongoc_gridfs_file_list_destroy(list);
+}
+
+inline bool clsGridFSWriter::write(const void *data, size_t length) {
+    if (m_file == NULL) return false;
+    mongoc_iovec_t iov;
+    iov.iov_base = (char *) data;
+    iov.iov_len = length;
+    ssize_t written = mongoc_gridfs_file_writev(m_file, &iov, 1, 0);
+    return written >= 0 && (size_t) written == length;
+}
+
+inline bool clsGridFSWriter::commit(const BlobMetadata &metadata) {
+    if (m_file == NULL) return false;
+    bson_t *bmeta = bson_new();
+    for (map<string, double>::const_iterator it = metadata.numbers.begin(); it != metadata.numbers.end(); it++) {
+        BSON_APPEND_DOUBLE(bmeta, it->first.c_str(), it->second);
+    }
+    for (map<string, string>::const_iterator it = metadata.strings.begin(); it != metadata.strings.end(); it++) {
+        BSON_APPEND_UTF8(bmeta, it->first.c_str(), it->second.c_str());
+    }
+    mongoc_gridfs_file_set_metadata(m_file, bmeta);
+    bson_destroy(bmeta);
+    /// 1. Save the file under the temporary name, then rename it, so that the readers never see
+    ///    a partially written file, and the existing file is intact if failed.
+    bool succeed = mongoc_gridfs_file_save(m_file);
+    if (succeed) {
+        mongoc_gridfs_file_set_filename(m_file, m_filename.c_str());
+        succeed = mongoc_gridfs_file_save(m_file);
+    }
+    if (!succeed) {
+        cout << "Save GridFS file " + m_filename + " failed." << endl;
+        this->_discard();
+        return false;
+    }
+    /// 2. Remove the replaced files, the readers see either the existing or the new one meanwhile.
+    this->_remove_replaced();
+    mongoc_gridfs_file_destroy(m_file);
+    m_file = NULL;
+    return true;
+}
+
+inline clsGridFSReader::clsGridFSReader(MongoGridFS *gfs, const string &filename) :
+    m_file(NULL), m_length(0) {
+    m_file = gfs->getFile(filename);
+    if (m_file == NULL) return;
+    m_length = (size_t) mongoc_gridfs_file_get_length(m_file);
+    const bson_t *bmeta = mongoc_gridfs_file_get_metadata(m_file);
+    bson_iter_t iter;
+    if (bmeta == NULL || !bson_iter_init(&iter, bmeta)) return;
+    while (bson_iter_next(&iter)) {
+        if (BSON_ITER_HOLDS_UTF8(&iter)) {
+            m_metadata.setString(bson_iter_key(&iter), bson_iter_utf8(&iter, NULL));
+        } else if (BSON_ITER_HOLDS_NUMBER(&iter)) {
+            m_metadata.setNumber(bson_iter_key(&iter), bson_iter_as_double(&iter));
+        }
+    }
+}
+
+inline clsGridFSReader::~clsGridFSReader(void) {
+    if (m_file != NULL) mongoc_gridfs_file_destroy(m_file);
+}
+
+inline string clsGridFSReader::identity(void) const {
+    if (m_file == NULL) return "";
+    /// the file id is changed whenever the file is replaced, and md5 and upload date guard against reused id
+    const bson_value_t *id = mongoc_gridfs_file_get_id(m_file);
+    if (id == NULL || id->value_type != BSON_TYPE_OID) return "";
+    char oid[25];
+    bson_oid_to_string(&id->value.v_oid, oid);
+    const char *md5 = mongoc_gridfs_file_get_md5(m_file);
+    stringstream oss;
+    oss << oid << ":" << (md5 == NULL ? "" : md5) << ":" << mongoc_gridfs_file_get_upload_date(m_file) << ":" << m_length;
+    return oss.str();
+}
+
+inline size_t clsGridFSReader::read(void *data, size_t length) {
+    if (m_file == NULL || length == 0) return 0;
+    mongoc_iovec_t iov;
+    iov.iov_base = (char *) data;
+    iov.iov_len = length;
+    ssize_t got = mongoc_gridfs_file_readv(m_file, &iov, 1, length, 0);
+    return got < 0 ? 0 : (size_t) got;
+}
+
+inline clsGridFSBlobStore::clsGridFSBlobStore(mongoc_client_pool_t *pool, const string &dbName,
+                                              const string &gfsName, bool tryPop /* = false */) :
+    m_gfs(NULL), m_pool(pool), m_client(NULL), m_dbName(dbName), m_gfsName(gfsName) {
+    if (m_pool == NULL) return;
+    m_client = tryPop ? mongoc_client_pool_try_pop(m_pool) : mongoc_client_pool_pop(m_pool);
+    if (m_client == NULL) return;
+    bson_error_t err;
+    mongoc_gridfs_t *gridfs = mongoc_client_get_gridfs(m_client, dbName.c_str(), gfsName.c_str(), &err);
+    if (gridfs == NULL) {
+        cout << "Get GridFS " + dbName + "." + gfsName + " failed." << endl;
+        return;
+    }
+    m_gfs = new MongoGridFS(gridfs);
+}
+
+inline clsGridFSBlobStore::~clsGridFSBlobStore(void) {
+    if (m_pool == NULL) return;
+    if (m_gfs != NULL) delete m_gfs;
+    if (m_client != NULL) mongoc_client_pool_push(m_pool, m_client);
+}
+
+inline clsRasterBlobStore *clsGridFSBlobStore::clone(void) {
+    if (m_pool == NULL) return NULL;
+    clsGridFSBlobStore *store = new clsGridFSBlobStore(m_pool, m_dbName, m_gfsName, true);
+    if (store->isOpen()) return store;
+    delete store;
+    return NULL;
+}
+
+#endif /* USE_MONGODB */
+
+#endif /* CLS_GRIDFS_STREAM */
@@ -0,0 +1,307 @@
+/*!
+ * \brief Define the local directory storage backend of raster blobs
+ *
+ *        Each blob is a file in the directory with the same semantics as GridFS, i.e.,
+ *        it is replaced as a whole when committed, and readers never see a partially written blob.
+ *        So that the serialization, compression, and tiling of rasters can be used and tested without MongoDB.
+ */
+#ifndef CLS_LOCAL_BLOB_STORE
+#define CLS_LOCAL_BLOB_STORE
+
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+
+#ifdef windows
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif /* windows */
+
+#include "clsRasterBlobStore.h"
+
+using namespace std;
+
+/*!
+ * Magic string at the end of the local blob file
+ */
+#define LOCAL_BLOB_MAGIC        "RSBLOB01"
+/*!
+ * Extension of the local blob file
+ */
+#define LOCAL_BLOB_EXTENSION    ".blob"
+
+/*!
+ * \class clsLocalBlobWriter
+ * \ingroup data
+ * \brief Write local blob file, which is written to a temporary file and renamed when committed
+ * The file is laid out as the data, the metadata, uint64 size of the metadata, and \a LOCAL_BLOB_MAGIC.
+ * The metadata is uint32 number of items, and each item is uint8 kind ('N' or 'S'), uint32 key length,
+ * the key, and double value or uint32 string length and the string.
+ */
+class clsLocalBlobWriter : public clsBlobOutput {
+public:
+    //! Constructor, create the temporary file
+    explicit clsLocalBlobWriter(const string &filename);
+
+    //! Destructor, the temporary file is removed if not committed
+    ~clsLocalBlobWriter(void);
+
+    //! Is the file created successfully?
+    bool isOpen(void) const { return m_file.is_open(); }
+
+    //! Append data to the file
+    bool write(const void *data, size_t length);
+
+    //! Append the metadata and rename the temporary file
+    bool commit(const BlobMetadata &metadata);
+
+private:
+    //! Disable copy
+    clsLocalBlobWriter(const clsLocalBlobWriter &);
+    clsLocalBlobWriter &operator=(const clsLocalBlobWriter &);
+
+    //! Append key of metadata item
+    void _write_key(char kind, const string &key);
+
+private:
+    ///< File name of the blob
+    string m_filename;
+    ///< Temporary file name
+    string m_tmpfilename;
+    ///< Temporary file being written
+    ofstream m_file;
+};
+
+/*!
+ * \class clsLocalBlobReader
+ * \ingroup data
+ * \brief Read local blob file piece by piece
+ */
+class clsLocalBlobReader : public clsBlobInput {
+public:
+    //! Constructor, open the file and read the metadata
+    explicit clsLocalBlobReader(const string &filename);
+
+    //! Is the file opened successfully?
+    bool isOpen(void) const { return m_file.is_open(); }
+
+    //! Length of the data in bytes
+    size_t length(void) const { return m_length; }
+
+    //! Metadata of the blob
+    const BlobMetadata &metadata(void) const { return m_metadata; }
+
+    //! Read the next piece of the data
+    size_t read(void *data, size_t length);
+
+private:
+    //! Disable copy
+    clsLocalBlobReader(const clsLocalBlobReader &);
+    clsLocalBlobReader &operator=(const clsLocalBlobReader &);
+
+    //! Parse the metadata, return false if it is corrupted
+    bool _parse_metadata(const vector<char> &buffer);
+
+private:
+    ///< File being read
+    ifstream m_file;
+    ///< Length of the data in bytes
+    size_t m_length;
+    ///< Bytes read
+    size_t m_position;
+    ///< Metadata of the blob
+    BlobMetadata m_metadata;
+};
+
+/*!
+ * \class clsLocalBlobStore
+ * \ingroup data
+ * \brief Raster blob store of local directory, each blob is a file named <name>.blob
+ */
+class clsLocalBlobStore : public clsRasterBlobStore {
+public:
+    //! Constructor, the directory should exist and be writable
+    explicit clsLocalBlobStore(const string &directory) : m_directory(directory) {
+        if (!m_directory.empty() && m_directory[m_directory.size() - 1] != '/' &&
+            m_directory[m_directory.size() - 1] != '\\') {
+            m_directory += "/";
+        }
+    }
+
+    //! Get the directory
+    string getDirectory(void) const { return m_directory; }
+
+    //! File name of a blob
+    string getFileName(const string &name) const { return m_directory + name + LOCAL_BLOB_EXTENSION; }
+
+    clsBlobOutput *openWrite(const string &name) {
+        clsLocalBlobWriter *output = new clsLocalBlobWriter(this->getFileName(name));
+        if (output->isOpen()) return output;
+        cout << "Create local blob " + this->getFileName(name) + " failed." << endl;
+        delete output;
+        return NULL;
+    }
+
+    clsBlobInput *openRead(const string &name) {
+        clsLocalBlobReader *input = new clsLocalBlobReader(this->getFileName(name));
+        if (input->isOpen()) return input;
+        delete input;
+        return NULL;
+    }
+
+    bool remove(const string &name) { return std::remove(this->getFileName(name).c_str()) == 0; }
+
+    //! The files can be read concurrently, so the clone shares the directory
+    clsRasterBlobStore *clone(void) { return new clsLocalBlobStore(m_directory); }
+
+private:
+    ///< Directory of the blob files, ends with the separator
+    string m_directory;
+};
+
+/// Since clsLocalBlobWriter and clsLocalBlobReader are not class templates, the following definitions are inline.
+
+inline clsLocalBlobWriter::clsLocalBlobWriter(const string &filename) : m_filename(filename), m_tmpfilename("") {
+    /// the process id and address keep the temporary files of concurrent writers apart
+    stringstream oss;
+    oss << filename << "." << getpid() << "." << (const void *) this << ".tmp";
+    m_tmpfilename = oss.str();
+    m_file.open(m_tmpfilename.c_str(), ios::out | ios::binary | ios::trunc);
+}
+
+inline clsLocalBlobWriter::~clsLocalBlobWriter(void) {
+    if (!m_file.is_open()) return;
+    m_file.close();
+    std::remove(m_tmpfilename.c_str());
+}
+
+inline bool clsLocalBlobWriter::write(const void *data, size_t length) {
+    if (!m_file.is_open()) return false;
+    m_file.write((const char *) data, length);
+    return m_file.good();
+}
+
+inline void clsLocalBlobWriter::_write_key(char kind, const string &key) {
+    uint32_t keyLength = (uint32_t) key.size();
+    m_file.write(&kind, 1);
+    m_file.write((const char *) &keyLength, sizeof(keyLength));
+    m_file.write(key.data(), keyLength);
+}
+
+inline bool clsLocalBlobWriter::commit(const BlobMetadata &metadata) {
+    if (!m_file.is_open()) return false;
+    streamoff start = m_file.tellp();
+    uint32_t count = (uint32_t) (metadata.numbers.size() + metadata.strings.size());
+    m_file.write((const char *) &count, sizeof(count));
+    for (map<string, double>::const_iterator it = metadata.numbers.begin(); it != metadata.numbers.end(); it++) {
+        this->_write_key('N', it->first);
+        m_file.write((const char *) &it->second, sizeof(double));
+    }
+    for (map<string, string>::const_iterator it = metadata.strings.begin(); it != metadata.strings.end(); it++) {
+        this->_write_key('S', it->first);
+        uint32_t valueLength = (uint32_t) it->second.size();
+        m_file.write((const char *) &valueLength, sizeof(valueLength));
+        m_file.write(it->second.data(), valueLength);
+    }
+    uint64_t metaLength = (uint64_t) (m_file.tellp() - start);
+    m_file.write((const char *) &metaLength, sizeof(metaLength));
+    m_file.write(LOCAL_BLOB_MAGIC, 8);
+    bool succeed = m_file.good();
+    m_file.close();
+#ifdef windows
+    /// rename() does not replace the existing file on Windows
+    if (succeed) std::remove(m_filename.c_str());
+#endif /* windows */
+    if (!succeed || rename(m_tmpfilename.c_str(), m_filename.c_str()) != 0) {
+        cout << "Save local blob " + m_filename + " failed." << endl;
+        std::remove(m_tmpfilename.c_str());
+        return false;
+    }
+    return true;
+}
+
+inline clsLocalBlobReader::clsLocalBlobReader(const string &filename) : m_length(0), m_position(0) {
+    m_file.open(filename.c_str(), ios::in | ios::binary);
+    if (!m_file.is_open()) return;
+    /// the size of metadata and magic string are at the end of file
+    m_file.seekg(0, ios::end);
+    streamoff fileLength = m_file.tellg();
+    char magic[8];
+    uint64_t metaLength = 0;
+    if (fileLength >= 16) {
+        m_file.seekg(fileLength - 16, ios::beg);
+        m_file.read((char *) &metaLength, sizeof(metaLength));
+        m_file.read(magic, sizeof(magic));
+    }
+    bool succeed = fileLength >= 16 && m_file.good() && strncmp(magic, LOCAL_BLOB_MAGIC, sizeof(magic)) == 0 &&
+        metaLength <= (uint64_t) fileLength - 16;
+    if (succeed) {
+        m_length = (size_t) (fileLength - 16 - (streamoff) metaLength);
+        vector<char> buffer((size_t) metaLength);
+        m_file.seekg((streamoff) m_length, ios::beg);
+        if (!buffer.empty()) m_file.read(&buffer[0], buffer.size());
+        succeed = m_file.good() && this->_parse_metadata(buffer);
+        m_file.seekg(0, ios::beg);
+    }
+    if (!succeed) {
+        cout << "The local blob " + filename + " is corrupted!" << endl;
+        m_file.close();
+        m_length = 0;
+    }
+}
+
+inline bool clsLocalBlobReader::_parse_metadata(const vector<char> &buffer) {
+    size_t pos = 0;
+    uint32_t count = 0;
+    if (buffer.size() < sizeof(count)) return false;
+    memcpy(&count, &buffer[0], sizeof(count));
+    pos += sizeof(count);
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t keyLength = 0;
+        if (pos + 1 + sizeof(keyLength) > buffer.size()) return false;
+        char kind = buffer[pos];
+        memcpy(&keyLength, &buffer[pos + 1], sizeof(keyLength));
+        pos += 1 + sizeof(keyLength);
+        if (pos + keyLength > buffer.size()) return false;
+        string key(buffer.begin() + pos, buffer.begin() + pos + keyLength);
+        pos += keyLength;
+        if (kind == 'N') {
+            double value;
+            if (pos + sizeof(value) > buffer.size()) return false;
+            memcpy(&value, &buffer[pos], sizeof(value));
+            pos += sizeof(value);
+            m_metadata.setNumber(key, value);
+        } else if (kind == 'S') {
+            uint32_t valueLength = 0;
+            if (pos + sizeof(valueLength) > buffer.size()) return false;
+            memcpy(&valueLength, &buffer[pos], sizeof(valueLength));
+            pos += sizeof(valueLength);
+            if (pos + valueLength > buffer.size()) return false;
+            m_metadata.setString(key, string(buffer.begin() + pos, buffer.begin() + pos + valueLength));
+            pos += valueLength;
+        } else {
+            return false;
+        }
+    }
+    return pos == buffer.size();
+}
+
+inline size_t clsLocalBlobReader::read(void *data, size_t length) {
+    if (!m_file.is_open() || m_position >= m_length) return 0;
+    length = min(length, m_length - m_position);
+    m_file.read((char *) data, length);
+    size_t got = (size_t) m_file.gcount();
+    m_position += got;
+    return got;
+}
+
+#endif /* CLS_LOCAL_BLOB_STORE */
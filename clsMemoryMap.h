@@ -0,0 +1,404 @@
+/*!
+ * \brief Define memory-mapped file class for zero-copy loading
+ *
+ *        The file is mapped copy-on-write, i.e., pages can be modified in memory
+ *        without changing the file on disk.
+ *        Besides, an anonymous scratch file can be created and mapped shared, which backs
+ *        data larger than the physical memory, i.e., the pages are written back to the scratch
+ *        file by the OS instead of the swap space.
+ *        Named shared memory can be created by one process and mapped by others, i.e., POSIX
+ *        shared memory object (shm_open) or Windows named file mapping backed by the paging file.
+ *        The POSIX name exists until it is unlinked, so the creator is recorded in the segment,
+ *        and the segment left by a killed process is replaced by the next creator.
+ */
+#ifndef CLS_MEMORY_MAP
+#define CLS_MEMORY_MAP
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <stdint.h>
+
+#ifdef windows
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <cerrno>
+#endif /* windows */
+
+using namespace std;
+
+/*!
+ * Magic string of the header of POSIX named shared memory, \sa SharedMemoryHeader
+ */
+#define SHARED_MEMORY_MAGIC     "RSSHM001"
+/*!
+ * Seconds after which a segment without header is regarded as stale, i.e., the creator
+ * was killed before the header is written
+ */
+#define SHARED_MEMORY_GRACE     10
+
+/*!
+ * \brief Header of POSIX named shared memory, which precedes the data
+ */
+struct SharedMemoryHeader {
+    char magic[8];       ///< \a SHARED_MEMORY_MAGIC, written after the creator
+    int64_t pid;         ///< Process id of the creator
+    char reserved[48];   ///< Keep the data aligned by 64 bytes
+};
+
+/*!
+ * \class clsMemoryMap
+ * \ingroup data
+ * \brief Map the whole file into memory, unmapped by the destructor
+ */
+class clsMemoryMap {
+public:
+    //! Constructor, map the file copy-on-write
+    explicit clsMemoryMap(const string &filename);
+
+    /*!
+     * \brief Constructor, create and map a scratch file which is removed when unmapped
+     * \param[in] directory Directory of the scratch file, the empty string means the temporary directory
+     * \param[in] size Size of the scratch file in bytes
+     */
+    clsMemoryMap(const string &directory, size_t size);
+
+    /*!
+     * \brief Create and map named shared memory shared, which is unnamed when destructed
+     * The existing segment of the name is replaced if it is stale, i.e., the creator has exited
+     * without unnaming it, e.g., killed.
+     * \param[in] name Name of the shared memory, unique on the machine, e.g., "dem_1"
+     * \param[in] size Size in bytes, which is filled with zero
+     * \return NULL if the name exists or failed.
+     */
+    static clsMemoryMap *createShared(const string &name, size_t size);
+
+    /*!
+     * \brief Map existing named shared memory copy-on-write, which stays valid after it is unnamed
+     * \param[in] name Name of the shared memory
+     * \return NULL if the name does not exist or failed.
+     */
+    static clsMemoryMap *openShared(const string &name);
+
+    //! Destructor, unmap the file
+    ~clsMemoryMap(void);
+
+    //! Is the file mapped successfully?
+    bool isMapped(void) const { return m_data != NULL; }
+
+    //! Start address of the mapped file
+    char *data(void) const { return m_data; }
+
+    //! Size of the mapped file in bytes
+    size_t size(void) const { return m_size; }
+
+    //! Is the address inside the mapped file?
+    bool contains(const void *ptr) const {
+        const char *p = static_cast<const char *>(ptr);
+        return m_data != NULL && p >= m_data && p < m_data + m_size;
+    }
+
+    /*!
+     * \brief Advise the kernel on the access pattern, e.g., sequential read ahead
+     * \param[in] sequential True for sequential access, false for random access
+     */
+    void advise(bool sequential) const;
+
+private:
+    //! Constructor of nothing mapped, \sa createShared(), openShared()
+    clsMemoryMap(void);
+
+    //! Disable copy
+    clsMemoryMap(const clsMemoryMap &);
+    clsMemoryMap &operator=(const clsMemoryMap &);
+
+    //! System name of the shared memory, e.g., "/dem_1" of POSIX
+    static string _shared_name(const string &name);
+
+#ifndef windows
+    /*!
+     * \brief Unlink the existing shared memory if it is stale, i.e., the creator is not running,
+     *        or the header is absent for \a SHARED_MEMORY_GRACE seconds
+     * \return true if the name can be created again.
+     */
+    static bool _unlink_stale_shared(const string &sharedname);
+#endif /* windows */
+
+private:
+    ///< Start address of the mapped file
+    char *m_data;
+    ///< Size of the mapped file in bytes, which is rounded up to pages for shared memory on Windows
+    size_t m_size;
+    ///< System name of the shared memory created, which is unnamed when unmapped
+    string m_sharedName;
+#ifdef windows
+    ///< File handle
+    HANDLE m_file;
+    ///< File mapping handle
+    HANDLE m_mapping;
+#else
+    ///< Offset of the data in the mapping, i.e., the size of \a SharedMemoryHeader for shared memory
+    size_t m_offset;
+#endif /* windows */
+};
+
+/// Since clsMemoryMap is not a class template, the following definitions are inline.
+
+#ifdef windows
+inline clsMemoryMap::clsMemoryMap(const string &filename) : m_data(NULL), m_size(0), m_mapping(NULL) {
+    m_file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                         FILE_ATTRIBUTE_NORMAL, NULL);
+    if (m_file == INVALID_HANDLE_VALUE) {
+        cout << "Open file " + filename + " failed." << endl;
+        return;
+    }
+    LARGE_INTEGER filesize;
+    if (!GetFileSizeEx(m_file, &filesize) || filesize.QuadPart == 0) return;
+    m_mapping = CreateFileMappingA(m_file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+    if (m_mapping == NULL) {
+        cout << "Map file " + filename + " failed." << endl;
+        return;
+    }
+    m_data = static_cast<char *>(MapViewOfFile(m_mapping, FILE_MAP_COPY, 0, 0, 0));
+    if (m_data != NULL) m_size = (size_t) filesize.QuadPart;
+}
+
+inline clsMemoryMap::clsMemoryMap(const string &directory, size_t size) : m_data(NULL), m_size(0), m_mapping(NULL) {
+    char tmpdir[MAX_PATH + 1];
+    char tmpname[MAX_PATH + 1];
+    string dir = directory;
+    if (dir.empty() && GetTempPathA(MAX_PATH + 1, tmpdir) > 0) dir = tmpdir;
+    m_file = INVALID_HANDLE_VALUE;
+    if (GetTempFileNameA(dir.c_str(), "rss", 0, tmpname) != 0) {
+        /// deleted by the system when the last handle is closed
+        m_file = CreateFileA(tmpname, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                             FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+    }
+    if (m_file == INVALID_HANDLE_VALUE) {
+        cout << "Create scratch file in " + dir + " failed." << endl;
+        return;
+    }
+    if (size == 0) return;
+    m_mapping = CreateFileMappingA(m_file, NULL, PAGE_READWRITE, (DWORD) ((unsigned long long) size >> 32),
+                                   (DWORD) (size & 0xFFFFFFFF), NULL);
+    if (m_mapping == NULL) {
+        cout << "Map scratch file failed." << endl;
+        return;
+    }
+    m_data = static_cast<char *>(MapViewOfFile(m_mapping, FILE_MAP_WRITE, 0, 0, 0));
+    if (m_data != NULL) m_size = size;
+}
+
+inline clsMemoryMap::clsMemoryMap(void) : m_data(NULL), m_size(0), m_file(INVALID_HANDLE_VALUE),
+                                          m_mapping(NULL) {
+}
+
+inline string clsMemoryMap::_shared_name(const string &name) {
+    return "Local\\" + name;
+}
+
+inline clsMemoryMap *clsMemoryMap::createShared(const string &name, size_t size) {
+    clsMemoryMap *shared = new clsMemoryMap();
+    /// the named mapping exists as long as any handle is open, i.e., the creator or the mapping processes
+    shared->m_mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+                                           (DWORD) ((unsigned long long) size >> 32), (DWORD) (size & 0xFFFFFFFF),
+                                           _shared_name(name).c_str());
+    if (shared->m_mapping != NULL && GetLastError() != ERROR_ALREADY_EXISTS) {
+        shared->m_data = static_cast<char *>(MapViewOfFile(shared->m_mapping, FILE_MAP_WRITE, 0, 0, 0));
+    }
+    if (shared->m_data == NULL) {
+        cout << "Create shared memory " + name + " failed." << endl;
+        delete shared;
+        return NULL;
+    }
+    shared->m_size = size;
+    return shared;
+}
+
+inline clsMemoryMap *clsMemoryMap::openShared(const string &name) {
+    clsMemoryMap *shared = new clsMemoryMap();
+    shared->m_mapping = OpenFileMappingA(FILE_MAP_COPY, FALSE, _shared_name(name).c_str());
+    if (shared->m_mapping != NULL) {
+        shared->m_data = static_cast<char *>(MapViewOfFile(shared->m_mapping, FILE_MAP_COPY, 0, 0, 0));
+    }
+    MEMORY_BASIC_INFORMATION info;
+    if (shared->m_data == NULL || VirtualQuery(shared->m_data, &info, sizeof(info)) == 0) {
+        cout << "Open shared memory " + name + " failed." << endl;
+        delete shared;
+        return NULL;
+    }
+    shared->m_size = info.RegionSize;
+    return shared;
+}
+
+inline clsMemoryMap::~clsMemoryMap(void) {
+    if (m_data != NULL) UnmapViewOfFile(m_data);
+    if (m_mapping != NULL) CloseHandle(m_mapping);
+    if (m_file != INVALID_HANDLE_VALUE) CloseHandle(m_file);
+}
+
+inline void clsMemoryMap::advise(bool sequential) const {
+    /// PrefetchVirtualMemory is available on Windows 8+, the system cache manager is used instead.
+}
+#else
+inline clsMemoryMap::clsMemoryMap(const string &filename) : m_data(NULL), m_size(0), m_offset(0) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        cout << "Open file " + filename + " failed." << endl;
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void *addr = mmap(NULL, (size_t) st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (addr != MAP_FAILED) {
+            m_data = static_cast<char *>(addr);
+            m_size = (size_t) st.st_size;
+        } else {
+            cout << "Map file " + filename + " failed." << endl;
+        }
+    }
+    /// the mapping keeps a reference to the file
+    close(fd);
+}
+
+inline clsMemoryMap::clsMemoryMap(const string &directory, size_t size) : m_data(NULL), m_size(0), m_offset(0) {
+    string dir = directory;
+    if (dir.empty()) dir = getenv("TMPDIR") != NULL ? getenv("TMPDIR") : "/tmp";
+    string pattern = dir + "/rsscratch_XXXXXX";
+    vector<char> tmpname(pattern.begin(), pattern.end());
+    tmpname.push_back('\0');
+    int fd = mkstemp(&tmpname[0]);
+    if (fd < 0) {
+        cout << "Create scratch file in " + dir + " failed." << endl;
+        return;
+    }
+    /// unlinked at once, so the space is freed when unmapped, even if the process is killed
+    unlink(&tmpname[0]);
+    if (size > 0 && ftruncate(fd, (off_t) size) == 0) {
+        void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (addr != MAP_FAILED) {
+            m_data = static_cast<char *>(addr);
+            m_size = size;
+        } else {
+            cout << "Map scratch file failed." << endl;
+        }
+    }
+    close(fd);
+}
+
+inline clsMemoryMap::clsMemoryMap(void) : m_data(NULL), m_size(0), m_offset(0) {
+}
+
+inline string clsMemoryMap::_shared_name(const string &name) {
+    return name.empty() || name[0] != '/' ? "/" + name : name;
+}
+
+inline bool clsMemoryMap::_unlink_stale_shared(const string &sharedname) {
+    int fd = shm_open(sharedname.c_str(), O_RDONLY, 0);
+    /// unlinked meanwhile
+    if (fd < 0) return errno == ENOENT;
+    bool stale = false;
+    struct stat st;
+    if (fstat(fd, &st) == 0) {
+        SharedMemoryHeader header;
+        memset(&header, 0, sizeof(header));
+        if ((size_t) st.st_size >= sizeof(header) &&
+            pread(fd, &header, sizeof(header), 0) == (ssize_t) sizeof(header) &&
+            strncmp(header.magic, SHARED_MEMORY_MAGIC, sizeof(header.magic)) == 0) {
+            stale = kill((pid_t) header.pid, 0) != 0 && errno == ESRCH;
+        } else {
+            stale = time(NULL) - st.st_mtime > SHARED_MEMORY_GRACE;
+        }
+    }
+    close(fd);
+    if (!stale) return false;
+    cout << "Replace the stale shared memory " + sharedname + "." << endl;
+    return shm_unlink(sharedname.c_str()) == 0 || errno == ENOENT;
+}
+
+inline clsMemoryMap *clsMemoryMap::createShared(const string &name, size_t size) {
+    string sharedname = _shared_name(name);
+    int fd = shm_open(sharedname.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0 && errno == EEXIST && _unlink_stale_shared(sharedname)) {
+        fd = shm_open(sharedname.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    }
+    if (fd < 0) {
+        cout << "Create shared memory " + name + " failed." << endl;
+        return NULL;
+    }
+    clsMemoryMap *shared = new clsMemoryMap();
+    shared->m_sharedName = sharedname;
+    size_t total = size + sizeof(SharedMemoryHeader);
+    if (size > 0 && ftruncate(fd, (off_t) total) == 0) {
+        void *addr = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (addr != MAP_FAILED) {
+            /// the magic is written after the creator, so the creator is known if the magic exists
+            SharedMemoryHeader *header = static_cast<SharedMemoryHeader *>(addr);
+            header->pid = (int64_t) getpid();
+            memcpy(header->magic, SHARED_MEMORY_MAGIC, sizeof(header->magic));
+            shared->m_offset = sizeof(SharedMemoryHeader);
+            shared->m_data = static_cast<char *>(addr) + shared->m_offset;
+            shared->m_size = size;
+        }
+    }
+    close(fd);
+    if (shared->m_data == NULL) {
+        cout << "Map shared memory " + name + " failed." << endl;
+        delete shared;
+        return NULL;
+    }
+    return shared;
+}
+
+inline clsMemoryMap *clsMemoryMap::openShared(const string &name) {
+    int fd = shm_open(_shared_name(name).c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        cout << "Open shared memory " + name + " failed." << endl;
+        return NULL;
+    }
+    clsMemoryMap *shared = new clsMemoryMap();
+    struct stat st;
+    if (fstat(fd, &st) == 0 && (size_t) st.st_size > sizeof(SharedMemoryHeader)) {
+        /// private mapping of the read-only descriptor, i.e., copy-on-write as the mapped file
+        void *addr = mmap(NULL, (size_t) st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (addr != MAP_FAILED && strncmp(static_cast<SharedMemoryHeader *>(addr)->magic, SHARED_MEMORY_MAGIC,
+                                          sizeof(SHARED_MEMORY_MAGIC) - 1) != 0) {
+            munmap(addr, (size_t) st.st_size);
+        } else if (addr != MAP_FAILED) {
+            shared->m_offset = sizeof(SharedMemoryHeader);
+            shared->m_data = static_cast<char *>(addr) + shared->m_offset;
+            shared->m_size = (size_t) st.st_size - shared->m_offset;
+        }
+    }
+    close(fd);
+    if (shared->m_data == NULL) {
+        cout << "Map shared memory " + name + " failed." << endl;
+        delete shared;
+        return NULL;
+    }
+    return shared;
+}
+
+inline clsMemoryMap::~clsMemoryMap(void) {
+    if (m_data != NULL) munmap(m_data - m_offset, m_size + m_offset);
+    /// the mapping processes keep the memory until they unmap it
+    if (!m_sharedName.empty()) shm_unlink(m_sharedName.c_str());
+}
+
+inline void clsMemoryMap::advise(bool sequential) const {
+    if (m_data != NULL) madvise(m_data, m_size, sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+}
+#endif /* windows */
+
+#endif /* CLS_MEMORY_MAP */
@@ -0,0 +1,256 @@
+/*!
+ * \brief Define node-local cache of the rasters decoded from remote blob store, e.g., GridFS
+ *
+ *        The decoded raster is stored in the native binary format (*.rsb) and keyed by the identity
+ *        of the remote blob (e.g., GridFS file id, md5, and upload date) and the read options.
+ *        So that the processes on the same node load the same raster by mmap instead of
+ *        downloading and decoding it independently. The total size of the cache is bounded,
+ *        and the least recently used files are evicted. Concurrent processes are synchronized by
+ *        file locking of the cache directory.
+ */
+#ifndef CLS_RASTER_BLOB_CACHE
+#define CLS_RASTER_BLOB_CACHE
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cctype>
+#include <stdint.h>
+
+#ifdef windows
+#include <process.h>
+#define getpid _getpid
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <utime.h>
+#endif /* windows */
+
+using namespace std;
+
+/*!
+ * Extension of the cached raster file, i.e., the native binary format
+ */
+#define BLOB_CACHE_EXTENSION    ".rsb"
+/*!
+ * Lock file of the cache directory
+ */
+#define BLOB_CACHE_LOCK         "rsblob.lock"
+
+/*!
+ * \class clsRasterBlobCache
+ * \ingroup data
+ * \brief Node-local cache of decoded rasters, shared by processes
+ * The cached file is written to a temporary file and renamed under the exclusive lock,
+ * while it is looked up and mapped under the shared lock. The evicted file which has been
+ * mapped stays valid until unmapped. On Windows, the cache is neither locked nor evicted.
+ */
+class clsRasterBlobCache {
+public:
+    /*!
+     * \class ScopedLock
+     * \brief Lock the cache directory until destructed, shared or exclusive
+     */
+    class ScopedLock {
+    public:
+        explicit ScopedLock(bool exclusive) : m_fd(-1) {
+#ifndef windows
+            if (!isEnabled()) return;
+            m_fd = open((_directory() + BLOB_CACHE_LOCK).c_str(), O_RDWR | O_CREAT, 0666);
+            if (m_fd >= 0 && flock(m_fd, exclusive ? LOCK_EX : LOCK_SH) != 0) {
+                close(m_fd);
+                m_fd = -1;
+            }
+#endif /* windows */
+        }
+
+        ~ScopedLock(void) {
+#ifndef windows
+            if (m_fd < 0) return;
+            flock(m_fd, LOCK_UN);
+            close(m_fd);
+#endif /* windows */
+        }
+
+    private:
+        //! Disable copy
+        ScopedLock(const ScopedLock &);
+        ScopedLock &operator=(const ScopedLock &);
+
+        ///< File descriptor of the lock file
+        int m_fd;
+    };
+
+    /*!
+     * \brief Set the cache directory, the empty string (the default) disables the cache
+     * The directory should exist and be writable, and it should be local to the node, e.g., /tmp or local SSD.
+     */
+    static void setDirectory(const string &dir) {
+        string &cachedir = _directory();
+        cachedir = dir;
+        if (!cachedir.empty() && cachedir[cachedir.size() - 1] != '/' && cachedir[cachedir.size() - 1] != '\\') {
+            cachedir += "/";
+        }
+    }
+
+    //! Get the cache directory
+    static string getDirectory(void) { return _directory(); }
+
+    //! Is the cache enabled?
+    static bool isEnabled(void) { return !_directory().empty(); }
+
+    //! Set the maximum total size of the cached files in bytes, 0 (the default) means unbounded
+    static void setCapacity(int64_t bytes) { _capacity() = bytes < 0 ? 0 : bytes; }
+
+    //! Get the maximum total size of the cached files in bytes
+    static int64_t getCapacity(void) { return _capacity(); }
+
+    //! Cached file name of the key, e.g., <dir>/0123456789abcdef.rsb
+    static string getFileName(uint64_t key) {
+        char keystr[17];
+        sprintf(keystr, "%016llx", (unsigned long long) key);
+        return _directory() + keystr + BLOB_CACHE_EXTENSION;
+    }
+
+    /*!
+     * \brief Find the cached file, and mark it as the most recently used
+     * The caller should hold the shared lock until the file is mapped.
+     * \return Cached file name, the empty string if not cached.
+     */
+    static string lookup(uint64_t key) {
+        if (!isEnabled()) return "";
+        string filename = getFileName(key);
+#ifdef windows
+        FILE *fp = fopen(filename.c_str(), "rb");
+        if (fp == NULL) return "";
+        fclose(fp);
+#else
+        /// the modification time is the last access time for LRU, since atime may be disabled
+        if (utime(filename.c_str(), NULL) != 0) return "";
+#endif /* windows */
+        return filename;
+    }
+
+    //! Temporary file name to write the cached file, which is unique among the processes and threads, \sa commit()
+    static string getTemporaryFileName(uint64_t key) {
+        static atomic<unsigned int> counter(0);
+        stringstream oss;
+        oss << getFileName(key) << "." << getpid() << "." << counter++ << ".tmp";
+        return oss.str();
+    }
+
+    /*!
+     * \brief Rename the temporary file as the cached file, and evict the least recently used files
+     * \param[in] tmpfilename Temporary file written completely, which is removed if failed
+     * \param[in] key Cache key
+     * \return false if failed, which does not affect the caller except the cache is missed next time.
+     */
+    static bool commit(const string &tmpfilename, uint64_t key) {
+        if (!isEnabled()) return false;
+        ScopedLock lock(true);
+        string filename = getFileName(key);
+#ifdef windows
+        /// rename() does not replace the existing file on Windows
+        remove(filename.c_str());
+#endif /* windows */
+        if (rename(tmpfilename.c_str(), filename.c_str()) != 0) {
+            remove(tmpfilename.c_str());
+            return false;
+        }
+        if (_capacity() > 0) _evict(_capacity(), filename);
+        return true;
+    }
+
+    //! Total size of the cached files in bytes
+    static int64_t getUsage(void) {
+        ScopedLock lock(false);
+        vector<CachedFile> files;
+        return _list(files);
+    }
+
+    //! Remove all cached files, the other files in the directory are kept
+    static void clear(void) {
+        ScopedLock lock(true);
+        _evict(0, "");
+    }
+
+private:
+    //! Cached file and its size and last access time
+    struct CachedFile {
+        string filename;
+        int64_t size;
+        int64_t accessed;
+
+        bool operator<(const CachedFile &other) const { return accessed < other.accessed; }
+    };
+
+    //! Cache directory shared by all rasters
+    static string &_directory(void) {
+        static string cachedir = "";
+        return cachedir;
+    }
+
+    //! Maximum total size in bytes
+    static int64_t &_capacity(void) {
+        static int64_t capacity = 0;
+        return capacity;
+    }
+
+    //! Is the file named by a cache key, i.e., 16 hex digits and the extension? \sa getFileName()
+    static bool _is_cached_file(const string &name) {
+        string ext = BLOB_CACHE_EXTENSION;
+        if (name.size() != 16 + ext.size() || name.compare(16, ext.size(), ext) != 0) return false;
+        for (size_t i = 0; i < 16; i++) {
+            if (!isxdigit((unsigned char) name[i])) return false;
+        }
+        return true;
+    }
+
+    //! List the cached files, return the total size. The other files in the directory are excluded.
+    static int64_t _list(vector<CachedFile> &files) {
+        int64_t total = 0;
+#ifndef windows
+        DIR *dir = opendir(_directory().c_str());
+        if (dir == NULL) return 0;
+        for (struct dirent *entry = readdir(dir); entry != NULL; entry = readdir(dir)) {
+            string name = entry->d_name;
+            if (!_is_cached_file(name)) continue;
+            struct stat st;
+            CachedFile file;
+            file.filename = _directory() + name;
+            if (stat(file.filename.c_str(), &st) != 0) continue;
+            file.size = (int64_t) st.st_size;
+            file.accessed = (int64_t) st.st_mtime;
+            files.push_back(file);
+            total += file.size;
+        }
+        closedir(dir);
+#endif /* windows */
+        return total;
+    }
+
+    /*!
+     * \brief Remove the least recently used files until the total size is not greater than \a capacity
+     * The caller should hold the exclusive lock.
+     * \param[in] capacity Maximum total size in bytes
+     * \param[in] keep File to keep, i.e., the one just cached
+     */
+    static void _evict(int64_t capacity, const string &keep) {
+        vector<CachedFile> files;
+        int64_t total = _list(files);
+        stable_sort(files.begin(), files.end());
+        for (size_t i = 0; i < files.size() && total > capacity; i++) {
+            if (files[i].filename == keep) continue;
+            if (remove(files[i].filename.c_str()) == 0) total -= files[i].size;
+        }
+    }
+};
+
+#endif /* CLS_RASTER_BLOB_CACHE */
@@ -0,0 +1,566 @@
+/*!
+ * \brief Define the storage backend interface of raster blobs, e.g., GridFS and local directory
+ *
+ *        A blob is a named byte stream with metadata, which is written and read piece by piece.
+ *        The raster serialization, e.g., layouts, compression and tiles, is built on the interface,
+ *        so that it is independent of the backend, \sa clsGridFSBlobStore and clsLocalBlobStore.
+ *        Optionally, the data is compressed as independent frames by clsShuffleCodec,
+ *        which are compressed and decompressed in parallel, and transparent to the caller.
+ */
+#ifndef CLS_RASTER_BLOB_STORE
+#define CLS_RASTER_BLOB_STORE
+
+#include <string>
+#include <vector>
+#include <map>
+#include <sstream>
+#include <cstring>
+#include <cstdio>
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <stdint.h>
+
+#include "clsShuffleCodec.h"
+#include "clsRasterIndexCache.h"
+#ifdef SUPPORT_OMP
+#include <omp.h>
+#endif /* SUPPORT_OMP */
+
+using namespace std;
+
+/*!
+ * Size of each piece of the streaming I/O in bytes,
+ * the same as the default chunk size (255 KB) of GridFS.
+ */
+#define BLOB_PIECE_BYTES        261120
+/*!
+ * Uncompressed size of each compressed frame in bytes, i.e., four pieces.
+ * The checksum is hashed by frames, so it should be a multiple of 8 bytes, \sa clsRasterIndexCache::hash()
+ */
+#define BLOB_FRAME_BYTES        1044480
+
+/*!
+ * Metadata of the compressed blob, which are appended on close
+ */
+#define BLOB_CODEC              "CODEC"           /// Codec name, absent if not compressed
+#define BLOB_CODEC_LEVEL        "CODEC_LEVEL"     /// Compression level
+#define BLOB_CODEC_ELEMSIZE     "CODEC_ELEMSIZE"  /// Value size of byte-shuffle
+#define BLOB_FRAME_SIZE         "FRAME_SIZE"      /// Uncompressed size of each frame
+#define BLOB_RAW_SIZE           "RAW_SIZE"        /// Uncompressed size of the whole data
+#define BLOB_CHECKSUM           "CHECKSUM"        /// FNV-1a hash of the uncompressed data, hex string
+#define BLOB_CODEC_SHUFFLE_ZLIB "SHUFFLE_ZLIB"    /// byte-shuffle and zlib, \sa clsShuffleCodec
+
+/*!
+ * \brief Get the blob name of a tile of the tiled raster, i.e., <name>_V<version>_T<tileRow>_<tileCol>_L<lyr>
+ * \param[in] name Blob name of the tile index
+ * \param[in] tileRow Tile row, from 0
+ * \param[in] tileCol Tile column, from 0
+ * \param[in] lyr Layer number, from 1
+ * \param[in] version Write id of the tiles, \sa GetBlobWriteId(). The tiles written without version
+ *                    are named <name>_T<tileRow>_<tileCol>_L<lyr>.
+ */
+inline string GetRasterTileName(const string &name, int tileRow, int tileCol, int lyr, const string &version = "") {
+    ostringstream oss;
+    oss << name;
+    if (!version.empty()) oss << "_V" << version;
+    oss << "_T" << tileRow << "_" << tileCol << "_L" << lyr;
+    return oss.str();
+}
+
+/*!
+ * \brief Unique id of a write, i.e., <nanoseconds since epoch>.<pid>.<counter> in hexadecimal,
+ *        so that the blobs of different writes of the same raster never share names
+ */
+inline string GetBlobWriteId(void) {
+    static atomic<unsigned int> counter(0);
+    int64_t now = (int64_t) chrono::duration_cast<chrono::nanoseconds>(
+        chrono::system_clock::now().time_since_epoch()).count();
+    ostringstream oss;
+    oss << hex << now << "." << getpid() << "." << counter++;
+    return oss.str();
+}
+
+/*!
+ * \brief Number of frames compressed or decompressed at a time, i.e., one frame per thread
+ */
+inline int BlobFrameBatch(void) {
+#ifdef SUPPORT_OMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif /* SUPPORT_OMP */
+}
+
+/*!
+ * \brief Metadata of blob, i.e., numeric and string values by key
+ */
+struct BlobMetadata {
+public:
+    ///< Numeric values
+    map<string, double> numbers;
+    ///< String values
+    map<string, string> strings;
+
+    //! Set numeric value
+    void setNumber(const string &key, double value) { numbers[key] = value; }
+
+    //! Set string value
+    void setString(const string &key, const string &value) { strings[key] = value; }
+
+    //! Get numeric value, return false if absent
+    bool getNumber(const string &key, double &value) const {
+        map<string, double>::const_iterator it = numbers.find(key);
+        if (it == numbers.end()) return false;
+        value = it->second;
+        return true;
+    }
+
+    //! Get string value, the empty string if absent
+    string getString(const string &key) const {
+        map<string, string>::const_iterator it = strings.find(key);
+        return it == strings.end() ? "" : it->second;
+    }
+};
+
+/*!
+ * \class clsBlobOutput
+ * \ingroup data
+ * \brief Byte stream of the blob being written, which is visible only after committed
+ */
+class clsBlobOutput {
+public:
+    virtual ~clsBlobOutput(void) {}
+
+    //! Append data
+    virtual bool write(const void *data, size_t length) = 0;
+
+    //! Save the blob with the metadata, which replaces the existing blob with the same name
+    virtual bool commit(const BlobMetadata &metadata) = 0;
+};
+
+/*!
+ * \class clsBlobInput
+ * \ingroup data
+ * \brief Byte stream of the blob being read
+ */
+class clsBlobInput {
+public:
+    virtual ~clsBlobInput(void) {}
+
+    //! Length of the stored data in bytes
+    virtual size_t length(void) const = 0;
+
+    //! Metadata of the blob
+    virtual const BlobMetadata &metadata(void) const = 0;
+
+    /*!
+     * \brief Identity of the stored content, which changes whenever the blob is replaced
+     * \return e.g., GridFS file id, md5, and upload date, the empty string if unknown.
+     */
+    virtual string identity(void) const { return ""; }
+
+    /*!
+     * \brief Read the next piece
+     * \param[out] data Buffer of at least \a length bytes
+     * \param[in] length Bytes to read, less bytes are read only at the end of blob
+     * \return Bytes read, 0 at the end of blob or if failed.
+     */
+    virtual size_t read(void *data, size_t length) = 0;
+};
+
+/*!
+ * \class clsRasterBlobStore
+ * \ingroup data
+ * \brief Storage backend of named blobs
+ * Usage:
+ *     clsLocalBlobStore store("/tmp/rasters");  // or clsGridFSBlobStore store(&gfs);
+ *     raster.outputToBlobStore("dem", &store, options);
+ *     clsRasterData<float, int> dem;
+ *     dem.ReadFromBlobStore(&store, "dem", true, &mask);
+ */
+class clsRasterBlobStore {
+public:
+    virtual ~clsRasterBlobStore(void) {}
+
+    //! Create a blob for writing, NULL if failed. The caller should delete the returned stream.
+    virtual clsBlobOutput *openWrite(const string &name) = 0;
+
+    //! Open a blob for reading, NULL if not found. The caller should delete the returned stream.
+    virtual clsBlobInput *openRead(const string &name) = 0;
+
+    //! Remove a blob
+    virtual bool remove(const string &name) = 0;
+
+    /*!
+     * \brief Open another connection to the same blobs for concurrent reads, NULL if not supported
+     * A store should not be shared by threads, e.g., a MongoDB client, so each thread uses its own one.
+     * The caller should delete the returned store.
+     */
+    virtual clsRasterBlobStore *clone(void) { return NULL; }
+
+    //! Write the whole blob at once
+    bool put(const string &name, const void *data, size_t length, const BlobMetadata &metadata) {
+        clsBlobOutput *output = this->openWrite(name);
+        if (output == NULL) return false;
+        bool succeed = output->write(data, length) && output->commit(metadata);
+        delete output;
+        return succeed;
+    }
+
+    //! Read the whole blob at once, and the metadata optionally
+    bool get(const string &name, vector<unsigned char> &data, BlobMetadata *metadata = NULL) {
+        clsBlobInput *input = this->openRead(name);
+        if (input == NULL) return false;
+        data.resize(input->length());
+        bool succeed = data.empty() || input->read(&data[0], data.size()) == data.size();
+        if (metadata != NULL) *metadata = input->metadata();
+        delete input;
+        return succeed;
+    }
+
+    //! Get the metadata of a blob
+    bool metadata(const string &name, BlobMetadata &metadata) {
+        clsBlobInput *input = this->openRead(name);
+        if (input == NULL) return false;
+        metadata = input->metadata();
+        delete input;
+        return true;
+    }
+};
+
+/*!
+ * \class clsBlobWriter
+ * \ingroup data
+ * \brief Write blob piece by piece, and compress by frames optionally
+ */
+class clsBlobWriter {
+public:
+    /*!
+     * \brief Constructor, create the blob
+     * \param[in] store Storage backend
+     * \param[in] name Blob name
+     * \param[in] metadata Metadata of the blob
+     */
+    clsBlobWriter(clsRasterBlobStore *store, const string &name, const BlobMetadata &metadata);
+
+    //! Destructor, save the blob if not closed
+    ~clsBlobWriter(void) { this->close(); }
+
+    //! Is the blob created successfully?
+    bool isOpen(void) const { return m_output != NULL; }
+
+    /*!
+     * \brief Compress the data as frames of byte-shuffle and zlib, which should be called before write()
+     * Each frame is stored as uint32 compressed size, uint32 uncompressed size, and the compressed data,
+     * or the uncompressed data if the two sizes are equal. The codec, uncompressed size, and checksum
+     * are appended to the metadata on close.
+     * \param[in] level zlib compression level, from 1 (the fastest) to 9
+     * \param[in] elemSize Size of each value for byte-shuffle
+     * \return false if any data has been written.
+     */
+    bool enableCompression(int level, int elemSize);
+
+    //! Append data to the blob
+    bool write(const void *data, size_t length);
+
+    //! Save and close the blob
+    bool close(void);
+
+    //! Bytes written, i.e., the uncompressed size
+    size_t written(void) const { return m_written; }
+
+    //! Bytes stored, which is less than written() if compressed
+    size_t stored(void) const { return m_stored; }
+
+private:
+    //! Disable copy
+    clsBlobWriter(const clsBlobWriter &);
+    clsBlobWriter &operator=(const clsBlobWriter &);
+
+    //! Write data to the blob directly
+    bool _write_stored(const void *data, size_t length);
+
+    /*!
+     * \brief Compress the pending frames in parallel and write them in order
+     * \param[in] final Write the last partial frame, i.e., on close
+     */
+    bool _flush_frames(bool final);
+
+private:
+    ///< Blob being written
+    clsBlobOutput *m_output;
+    ///< Blob name
+    string m_name;
+    ///< Metadata, appended by the codec information on close
+    BlobMetadata m_metadata;
+    ///< Bytes written
+    size_t m_written;
+    ///< Bytes stored
+    size_t m_stored;
+    ///< Any write failed?
+    bool m_failed;
+    ///< Compression level, -1 if not compressed
+    int m_level;
+    ///< Value size of byte-shuffle
+    int m_elemSize;
+    ///< Uncompressed data of the pending frames
+    vector<unsigned char> m_pending;
+    ///< Checksum of the uncompressed data flushed, \sa clsBlobReader
+    uint64_t m_checksum;
+};
+
+/*!
+ * \class clsBlobReader
+ * \ingroup data
+ * \brief Read blob piece by piece, the compressed blob is decompressed transparently
+ */
+class clsBlobReader {
+public:
+    /*!
+     * \brief Constructor, open the blob
+     * \param[in] store Storage backend
+     * \param[in] name Blob name
+     */
+    clsBlobReader(clsRasterBlobStore *store, const string &name);
+
+    //! Destructor
+    ~clsBlobReader(void) { if (m_input != NULL) delete m_input; }
+
+    //! Is the blob opened successfully?
+    bool isOpen(void) const { return m_input != NULL; }
+
+    //! Length of the blob in bytes, i.e., the uncompressed size if compressed
+    size_t length(void) const { return m_length; }
+
+    //! Is the blob compressed? \sa clsBlobWriter::enableCompression()
+    bool isCompressed(void) const { return m_elemSize > 0; }
+
+    //! Metadata of the blob
+    const BlobMetadata &metadata(void) const { return m_input != NULL ? m_input->metadata() : m_empty; }
+
+    //! Identity of the stored content, \sa clsBlobInput::identity()
+    string identity(void) const { return m_input != NULL ? m_input->identity() : ""; }
+
+    /*!
+     * \brief Read the next piece of the blob, which is decompressed if compressed
+     * \param[out] data Buffer of at least \a length bytes
+     * \param[in] length Bytes to read, less bytes are read only at the end of blob
+     * \return Bytes read, 0 at the end of blob or if failed, e.g., the checksum mismatched.
+     */
+    size_t read(void *data, size_t length);
+
+private:
+    //! Disable copy
+    clsBlobReader(const clsBlobReader &);
+    clsBlobReader &operator=(const clsBlobReader &);
+
+    //! Read the next frames and decompress them in parallel
+    bool _decode_frames(void);
+
+private:
+    ///< Blob being read
+    clsBlobInput *m_input;
+    ///< Metadata of the blob not opened
+    BlobMetadata m_empty;
+    ///< Length of the blob in bytes
+    size_t m_length;
+    ///< Value size of byte-shuffle, 0 if not compressed
+    int m_elemSize;
+    ///< Uncompressed size of each frame
+    size_t m_frameSize;
+    ///< Decompressed data not read yet
+    vector<unsigned char> m_decoded;
+    ///< Read position of \a m_decoded
+    size_t m_decodedPos;
+    ///< Bytes decompressed
+    size_t m_decodedTotal;
+    ///< Checksum recorded in metadata
+    string m_checksum;
+    ///< Checksum of the decompressed data
+    uint64_t m_hash;
+    ///< Any frame corrupted?
+    bool m_failed;
+};
+
+/// Since clsBlobWriter and clsBlobReader are not class templates, the following definitions are inline.
+
+inline clsBlobWriter::clsBlobWriter(clsRasterBlobStore *store, const string &name, const BlobMetadata &metadata) :
+    m_output(NULL), m_name(name), m_metadata(metadata), m_written(0), m_stored(0), m_failed(false),
+    m_level(-1), m_elemSize(0), m_checksum(FNV_OFFSET_BASIS) {
+    m_output = store->openWrite(name);
+    if (m_output == NULL) cout << "Create blob " + name + " failed." << endl;
+}
+
+inline bool clsBlobWriter::enableCompression(int level, int elemSize) {
+    if (m_written > 0) return false;
+    m_level = level < 1 ? 1 : (level > 9 ? 9 : level);
+    m_elemSize = elemSize < 1 ? 1 : elemSize;
+    return true;
+}
+
+inline bool clsBlobWriter::write(const void *data, size_t length) {
+    if (m_output == NULL || m_failed) return false;
+    if (length == 0) return true;
+    if (m_level < 0) {
+        if (!this->_write_stored(data, length)) return false;
+        m_written += length;
+        return true;
+    }
+    m_pending.insert(m_pending.end(), (const unsigned char *) data, (const unsigned char *) data + length);
+    m_written += length;
+    if (m_pending.size() >= (size_t) BlobFrameBatch() * BLOB_FRAME_BYTES) return this->_flush_frames(false);
+    return true;
+}
+
+inline bool clsBlobWriter::_write_stored(const void *data, size_t length) {
+    if (!m_output->write(data, length)) {
+        cout << "Write blob " + m_name + " failed." << endl;
+        m_failed = true;
+        return false;
+    }
+    m_stored += length;
+    return true;
+}
+
+inline bool clsBlobWriter::_flush_frames(bool final) {
+    int nFrames = int(m_pending.size() / BLOB_FRAME_BYTES);
+    if (final && m_pending.size() % BLOB_FRAME_BYTES > 0) nFrames++;
+    vector<vector<unsigned char> > encoded(nFrames);
+    vector<char> compressed(nFrames, 0);
+#pragma omp parallel for
+    for (int i = 0; i < nFrames; i++) {
+        size_t start = (size_t) i * BLOB_FRAME_BYTES;
+        size_t rawBytes = min((size_t) BLOB_FRAME_BYTES, m_pending.size() - start);
+        compressed[i] = clsShuffleCodec::compress(&m_pending[start], rawBytes, m_elemSize, m_level, encoded[i]);
+    }
+    for (int i = 0; i < nFrames && !m_failed; i++) {
+        size_t start = (size_t) i * BLOB_FRAME_BYTES;
+        uint32_t sizes[2];
+        sizes[1] = (uint32_t) min((size_t) BLOB_FRAME_BYTES, m_pending.size() - start);
+        sizes[0] = compressed[i] ? (uint32_t) encoded[i].size() : sizes[1];
+        this->_write_stored(sizes, sizeof(sizes));
+        if (compressed[i]) this->_write_stored(&encoded[i][0], sizes[0]);
+        else this->_write_stored(&m_pending[start], sizes[1]);
+    }
+    /// hashed by whole frames, i.e., multiples of 8 bytes except the last one, the same as the reader
+    size_t flushed = min(m_pending.size(), (size_t) nFrames * BLOB_FRAME_BYTES);
+    if (flushed > 0) m_checksum = clsRasterIndexCache::hash(&m_pending[0], flushed, m_checksum);
+    m_pending.erase(m_pending.begin(), m_pending.begin() + flushed);
+    return !m_failed;
+}
+
+inline bool clsBlobWriter::close(void) {
+    if (m_output == NULL) return false;
+    if (m_level >= 0 && !m_failed && this->_flush_frames(true)) {
+        char checksum[32];
+        snprintf(checksum, sizeof(checksum), "%016llx", (unsigned long long) m_checksum);
+        m_metadata.setString(BLOB_CODEC, BLOB_CODEC_SHUFFLE_ZLIB);
+        m_metadata.setNumber(BLOB_CODEC_LEVEL, m_level);
+        m_metadata.setNumber(BLOB_CODEC_ELEMSIZE, m_elemSize);
+        m_metadata.setNumber(BLOB_FRAME_SIZE, BLOB_FRAME_BYTES);
+        m_metadata.setNumber(BLOB_RAW_SIZE, (double) m_written);
+        m_metadata.setString(BLOB_CHECKSUM, checksum);
+    }
+    bool succeed = !m_failed && m_output->commit(m_metadata);
+    delete m_output;
+    m_output = NULL;
+    return succeed;
+}
+
+inline clsBlobReader::clsBlobReader(clsRasterBlobStore *store, const string &name) :
+    m_input(NULL), m_length(0), m_elemSize(0), m_frameSize(0), m_decodedPos(0), m_decodedTotal(0),
+    m_checksum(""), m_hash(FNV_OFFSET_BASIS), m_failed(false) {
+    m_input = store->openRead(name);
+    if (m_input == NULL) {
+        cout << "Open blob " + name + " failed." << endl;
+        return;
+    }
+    m_length = m_input->length();
+    const BlobMetadata &meta = m_input->metadata();
+    string codec = meta.getString(BLOB_CODEC);
+    if (codec.empty()) return;
+    double elemSize = 0., frameSize = 0., rawSize = -1.;
+    meta.getNumber(BLOB_CODEC_ELEMSIZE, elemSize);
+    meta.getNumber(BLOB_FRAME_SIZE, frameSize);
+    meta.getNumber(BLOB_RAW_SIZE, rawSize);
+    if (codec != BLOB_CODEC_SHUFFLE_ZLIB || elemSize < 1. || frameSize < 1. || rawSize < 0.) {
+        cout << "The codec " + codec + " of blob " + name + " is not supported!" << endl;
+        delete m_input;
+        m_input = NULL;
+        m_length = 0;
+        return;
+    }
+    m_elemSize = int(elemSize);
+    m_frameSize = (size_t) frameSize;
+    m_length = (size_t) rawSize;
+    m_checksum = meta.getString(BLOB_CHECKSUM);
+}
+
+inline size_t clsBlobReader::read(void *data, size_t length) {
+    if (m_input == NULL || length == 0) return 0;
+    if (!this->isCompressed()) return m_input->read(data, length);
+    size_t got = 0;
+    while (got < length) {
+        if (m_decodedPos == m_decoded.size() && !this->_decode_frames()) break;
+        size_t n = min(length - got, m_decoded.size() - m_decodedPos);
+        memcpy((char *) data + got, &m_decoded[m_decodedPos], n);
+        m_decodedPos += n;
+        got += n;
+    }
+    return got;
+}
+
+inline bool clsBlobReader::_decode_frames(void) {
+    if (m_failed || m_decodedTotal >= m_length) return false;
+    /// 1. read the stored frames of this batch sequentially
+    size_t remainFrames = (m_length - m_decodedTotal + m_frameSize - 1) / m_frameSize;
+    int nFrames = int(min((size_t) BlobFrameBatch(), remainFrames));
+    vector<vector<unsigned char> > frames(nFrames);
+    vector<size_t> rawBytes(nFrames), offsets(nFrames + 1, 0);
+    for (int i = 0; i < nFrames && !m_failed; i++) {
+        uint32_t sizes[2];
+        if (m_input->read(sizes, sizeof(sizes)) != sizeof(sizes) || sizes[1] == 0 ||
+            sizes[1] > m_frameSize || sizes[0] > sizes[1]) {
+            m_failed = true;
+            break;
+        }
+        frames[i].resize(sizes[0]);
+        if (m_input->read(&frames[i][0], sizes[0]) != sizes[0]) m_failed = true;
+        rawBytes[i] = sizes[1];
+        offsets[i + 1] = offsets[i] + sizes[1];
+    }
+    /// 2. decompress in parallel
+    m_decoded.resize(m_failed ? 0 : offsets[nFrames]);
+    m_decodedPos = 0;
+    bool succeed = !m_failed;
+    int nDecoded = m_failed ? 0 : nFrames;
+#pragma omp parallel for
+    for (int i = 0; i < nDecoded; i++) {
+        if (frames[i].size() == rawBytes[i]) {
+            memcpy(&m_decoded[offsets[i]], &frames[i][0], rawBytes[i]);
+        } else if (!clsShuffleCodec::decompress(&frames[i][0], frames[i].size(), m_elemSize,
+                                                &m_decoded[offsets[i]], rawBytes[i])) {
+            succeed = false;
+        }
+    }
+    /// 3. verify the checksum at the end, and no data of the last batch is returned if mismatched
+    if (succeed) {
+        m_hash = clsRasterIndexCache::hash(&m_decoded[0], m_decoded.size(), m_hash);
+        m_decodedTotal += m_decoded.size();
+        if (m_decodedTotal >= m_length && !m_checksum.empty()) {
+            char checksum[32];
+            snprintf(checksum, sizeof(checksum), "%016llx", (unsigned long long) m_hash);
+            succeed = m_checksum == checksum;
+        }
+    }
+    if (!succeed) {
+        cout << "The compressed blob is corrupted!" << endl;
+        m_failed = true;
+        m_decoded.clear();
+    }
+    return succeed;
+}
+
+#endif /* CLS_RASTER_BLOB_STORE */
@@ -21,6 +21,24 @@ void clsRasterData<T, MaskT>::_initialize_raster_class() {
     m_storePositions = false;
     m_useMaskExtent = false;
     m_statisticsCalculated = false;
+    m_neighborIndex = NULL;
+    m_cellOrdering = CELL_ORDER_ROWMAJOR;
+    m_toRowMajor = NULL;
+    m_fromRowMajor = NULL;
+    m_satSum = NULL;
+    m_satCount = NULL;
+    m_pyramidBlockSize = -1;
+    m_pyramidCellStart = NULL;
+    m_pyramidCells = NULL;
+    m_pyramidMin = NULL;
+    m_pyramidMax = NULL;
+    m_mappedFile = NULL;
+    m_sharedMemory = NULL;
+    m_spillFile = "";
+    m_positionBlock = NULL;
+    m_contentHash = 0;
+    m_lazyPending = false;
+    m_materializing = false;
     const char *RASTER_HEADERS[8] = {HEADER_RS_NCOLS, HEADER_RS_NROWS, HEADER_RS_XLL, HEADER_RS_YLL, HEADER_RS_CELLSIZE,
                                      HEADER_RS_NODATA, HEADER_RS_LAYERS, HEADER_RS_CELLSNUM};
     for (int i = 0; i < 6; i++) {
@@ -35,6 +53,7 @@ void clsRasterData<T, MaskT>::_initialize_raster_class() {
         m_statsMap2D.insert(map<string, double *>::value_type(statsnames[i], NULL));
     }
     m_initialized = true;
+    clsRasterManager::registerRaster(this);
 }
 
 template<typename T, typename MaskT>
@@ -49,6 +68,7 @@ void clsRasterData<T, MaskT>::_initialize_read_function(string filename, bool ca
     m_calcPositions = calcPositions;
     m_useMaskExtent = useMaskExtent;
     m_defaultValue = defalutValue;
+    m_contentHash = 0;
 }
 
 template<typename T, typename MaskT>
@@ -69,6 +89,8 @@ clsRasterData<T, MaskT>::clsRasterData(vector<string> filenames, bool calcPositi
                                        clsRasterData<MaskT> *mask /* = NULL */, 
                                        bool useMaskExtent /* = true */,
                                        T defalutValue /* = (T) NODATA_VALUE */) {
+    /// the raster being constructed is registered but locked, i.e., not evicted, \sa clsRasterManager
+    lock_guard<recursive_mutex> lock(m_materializeMutex);
     this->_initialize_raster_class();
     /// if filenames is empty
     if (filenames.empty()) {
@@ -130,11 +152,13 @@ clsRasterData<T, MaskT>::clsRasterData(vector<string> filenames, bool calcPositi
             Release1DArray(tmplyrdata);
         }
         m_is2DRaster = true;
+        clsRasterManager::enforceBudget(this);
     }
 }
 
 template<typename T, typename MaskT>
 clsRasterData<T, MaskT>::clsRasterData(clsRasterData<MaskT> *mask, T *&values) {
+    lock_guard<recursive_mutex> lock(m_materializeMutex);
     this->_initialize_raster_class();
     m_mask = mask;
     m_nCells = m_mask->getCellNumber();
@@ -143,10 +167,12 @@ clsRasterData<T, MaskT>::clsRasterData(clsRasterData<MaskT> *mask, T *&values) {
     this->copyHeader(m_mask->getRasterHeader());
     m_calcPositions = false;
     m_useMaskExtent = true;
+    clsRasterManager::enforceBudget(this);
 }
 
 template<typename T, typename MaskT>
 clsRasterData<T, MaskT>::clsRasterData(clsRasterData<MaskT> *mask, T **&values, int lyrs) {
+    lock_guard<recursive_mutex> lock(m_materializeMutex);
     this->_initialize_raster_class();
     m_mask = mask;
     m_nLyrs = lyrs;
@@ -156,6 +182,7 @@ clsRasterData<T, MaskT>::clsRasterData(clsRasterData<MaskT> *mask, T **&values,
     // m_raster2DData = values; // DO NOT ASSIGN ARRAY DIRECTLY, IN CASE OF MEMORY ERROR!
     m_useMaskExtent = true;
     m_is2DRaster = true;
+    clsRasterManager::enforceBudget(this);
 }
 
 #ifdef USE_MONGODB
@@ -206,23 +233,33 @@ void clsRasterData<T, MaskT>::_construct_from_single_file(string filename, bool
     } else {
         _read_raster_file_by_gdal(m_filePathName, &m_headers, &m_rasterData, &m_srs);
     }
+    m_contentHash = this->_calculate_content_hash();
     /******** Mask and calculate valid positions ********/
     this->_mask_and_calculate_valid_positions();
+    /// the raster read transparently is kept until the next read, \sa clsRasterManager
+    if (!m_materializing) clsRasterManager::enforceBudget(this);
 }
 
 template<typename T, typename MaskT>
 clsRasterData<T, MaskT>::~clsRasterData(void) {
+    clsRasterManager::unregisterRaster(this);
+    /// wait for the eviction by another thread, which locked the raster before unregistered
+    lock_guard<recursive_mutex> lock(m_materializeMutex);
     StatusMessage(("Release raster: " + m_coreFileName).c_str());
-    if (m_rasterData != NULL) Release1DArray(m_rasterData);
-    if (m_rasterPositionData != NULL && m_storePositions) Release2DArray(m_nCells, m_rasterPositionData);
-    if (m_raster2DData != NULL && m_is2DRaster) Release2DArray(m_nCells, m_raster2DData);
+    this->_release_storage();
+    if (m_sharedMemory != NULL) delete m_sharedMemory;
     if (m_is2DRaster && m_statisticsCalculated) this->releaseStatsMap2D();
+    this->releaseNeighborIndex();
+    if (m_toRowMajor != NULL) Release1DArray(m_toRowMajor);
+    if (m_fromRowMajor != NULL) Release1DArray(m_fromRowMajor);
+    this->_release_derived_data();
 }
 
 /************* Get information functions ***************/
 
 template<typename T, typename MaskT>
 void clsRasterData<T, MaskT>::calculateStatistics() {
+    this->_materialize();
     if (this->m_statisticsCalculated) return;
     if (m_is2DRaster && m_raster2DData != NULL) {
         double **derivedvs;
@@ -262,6 +299,8 @@ void clsRasterData<T, MaskT>::releaseStatsMap2D() {
 
 template<typename T, typename MaskT>
 void clsRasterData<T, MaskT>::updateStatistics() {
+    this->_materialize();
+    this->_release_derived_data();
     if (m_is2DRaster && this->m_statisticsCalculated) this->releaseStatsMap2D();
     this->m_statisticsCalculated = false;
     this->calculateStatistics();
@@ -269,6 +308,7 @@ void clsRasterData<T, MaskT>::updateStatistics() {
 
 template<typename T, typename MaskT>
 double clsRasterData<T, MaskT>::getStatistics(string sindex, int lyr) {
+    this->_materialize();
     sindex = GetUpper(sindex);
     if (this->m_is2DRaster && m_raster2DData != NULL)  // for 2D raster data
     {
@@ -299,6 +339,7 @@ double clsRasterData<T, MaskT>::getStatistics(string sindex, int lyr) {
 
 template<typename T, typename MaskT>
 void clsRasterData<T, MaskT>::getStatistics(string sindex, int *lyrnum, double **values) {
+    this->_materialize();
     if (!m_is2DRaster || m_raster2DData == NULL) {
         cout << "Please initialize the raster object first." << endl;
         *values = NULL;
@@ -324,7 +365,8 @@ void clsRasterData<T, MaskT>::getStatistics(string sindex, int *lyrnum, double *
 
 template<typename T, typename MaskT>
 int clsRasterData<T, MaskT>::getPosition(int row, int col) {
-    if (m_calcPositions || m_rasterPositionData == NULL){
+    this->_materialize();
+    if (!m_calcPositions || m_rasterPositionData == NULL){
         return this->getCols() * row + col;
     }
     for (int i = 0; i < m_nCells; i++) {
@@ -369,6 +411,7 @@ int clsRasterData<T, MaskT>::getPosition(double x, double y) {
 
 template<typename T, typename MaskT>
 bool clsRasterData<T, MaskT>::getRasterData(int *nRows, T **data) {
+    this->_materialize();
     if (NULL == m_rasterData) {
         cout << "Please initialize the raster object first." << endl;
         return false;
@@ -380,6 +423,7 @@ bool clsRasterData<T, MaskT>::getRasterData(int *nRows, T **data) {
 
 template<typename T, typename MaskT>
 bool clsRasterData<T, MaskT>::get2DRasterData(int *nRows, int *nCols, T ***data) {
+    this->_materialize();
     if (m_is2DRaster && m_raster2DData != NULL) {
         *nRows = m_nCells;
         *nCols = m_nLyrs;
@@ -393,6 +437,7 @@ bool clsRasterData<T, MaskT>::get2DRasterData(int *nRows, int *nCols, T ***data)
 
 template<typename T, typename MaskT>
 void clsRasterData<T, MaskT>::getRasterPositionData(int &nRows, int ***data) {
+    this->_materialize();
     if (m_mask != NULL && m_mask->PositionsCalculated() && m_useMaskExtent) {
         m_mask->getRasterPositionData(nRows, data);
     } else if (m_calcPositions) {
@@ -405,8 +450,210 @@ void clsRasterData<T, MaskT>::getRasterPositionData(int &nRows, int ***data) {
     }
 }
 
+template<typename T, typename MaskT>
+bool clsRasterData<T, MaskT>::_get_stored_positions(int ***positions) {
+    *positions = NULL;
+    if (m_calcPositions && m_rasterPositionData != NULL) {
+        *positions = m_rasterPositionData;
+        return true;
+    }
+    if (m_mask != NULL && m_useMaskExtent && m_mask->PositionsCalculated() &&
+        m_mask->getCellNumber() == m_nCells) {
+        *positions = m_mask->getRasterPositionDataPointer();
+        return *positions != NULL;
+    }
+    return m_nCells == this->getRows() * this->getCols();
+}
+
+template<typename T, typename MaskT>
+const int *clsRasterData<T, MaskT>::getNeighborIndex(void) {
+    this->_materialize();
+    /// the table is built once by the first caller, and the concurrent callers wait for it
+    lock_guard<recursive_mutex> lock(m_materializeMutex);
+    if (m_neighborIndex != NULL) return m_neighborIndex;
+    int **positions = NULL;
+    if (!this->_get_stored_positions(&positions)) {
+        cout << "The positions of the stored cells are not available!" << endl;
+        return NULL;
+    }
+    /// share the table of mask if the position data is the same
+    if (positions != NULL && m_mask != NULL && positions == m_mask->getRasterPositionDataPointer()) {
+        return m_mask->getNeighborIndex();
+    }
+    int nRows = this->getRows();
+    int nCols = this->getCols();
+    int *gridIndex = NULL;
+    if (positions != NULL) {
+        Initialize1DArray(nRows * nCols, gridIndex, -1);
+#pragma omp parallel for
+        for (int i = 0; i < m_nCells; i++) {
+            gridIndex[positions[i][0] * nCols + positions[i][1]] = i;
+        }
+    }
+    int *neighbors = NULL;
+    Initialize1DArray(m_nCells * 8, neighbors, -1);
+#pragma omp parallel for
+    for (int i = 0; i < m_nCells; i++) {
+        int row = positions == NULL ? i / nCols : positions[i][0];
+        int col = positions == NULL ? i % nCols : positions[i][1];
+        for (int k = 0; k < 8; k++) {
+            int nrow = row + D8_DELTA_ROW[k];
+            int ncol = col + D8_DELTA_COL[k];
+            if (nrow < 0 || nrow >= nRows || ncol < 0 || ncol >= nCols) continue;
+            neighbors[i * 8 + k] = positions == NULL ? nrow * nCols + ncol : gridIndex[nrow * nCols + ncol];
+        }
+    }
+    if (gridIndex != NULL) Release1DArray(gridIndex);
+    m_neighborIndex = neighbors;
+    return m_neighborIndex;
+}
+
+template<typename T, typename MaskT>
+void clsRasterData<T, MaskT>::releaseNeighborIndex(void) {
+    if (m_neighborIndex != NULL) Release1DArray(m_neighborIndex);
+}
+
+template<typename T, typename MaskT>
+const int *clsRasterData<T, MaskT>::_get_row_major_order(int **positions) {
+    if (positions == NULL) return NULL;
+    if (positions == m_rasterPositionData && m_storePositions) return m_fromRowMajor;
+    if (m_mask != NULL && positions == m_mask->getRasterPositionDataPointer()) {
+        return m_mask->getOrderFromRowMajor();
+    }
+    return NULL;
+}
+
+template<typename T, typename MaskT>
+bool clsRasterData<T, MaskT>::reorderCells(CellOrdering ordering, int tileSize /* = 64 */) {
+    this->_materialize();
+    if (ordering == m_cellOrdering) return true;
+    if (!m_calcPositions || !m_storePositions || m_rasterPositionData == NULL) {
+        cout << "Only the raster which owns its position data can be reordered!" << endl;
+        return false;
+    }
+    /// the rasters which share the positions, e.g., read with this mask, follow the current order
+    int sharers = clsRasterManager::countPositionSharers(this);
+    if (sharers > 0) {
+        cout << "The positions of " + m_coreFileName + " are shared by " << sharers
+             << " raster(s), which should be released before reordering!" << endl;
+        return false;
+    }
+    if (tileSize <= 0) tileSize = 64;
+    int nRows = this->getRows();
+    int nCols = this->getCols();
+    int maxDim = nRows > nCols ? nRows : nCols;
+    uint64_t side = 1;  /// side length of the Hilbert curve, i.e., power of 2
+    while (side < (uint64_t) maxDim) side <<= 1;
+    int nTileCols = (nCols + tileSize - 1) / tileSize;
+    /// 1. sort keys of the stored cells along the given curve
+    vector<pair<uint64_t, int> > keys(m_nCells);
+#pragma omp parallel for
+    for (int i = 0; i < m_nCells; i++) {
+        uint64_t row = (uint64_t) m_rasterPositionData[i][0];
+        uint64_t col = (uint64_t) m_rasterPositionData[i][1];
+        uint64_t key = 0;
+        if (ordering == CELL_ORDER_MORTON) {
+            for (int b = 0; b < 32; b++) {
+                key |= ((col >> b) & 1ULL) << (2 * b);
+                key |= ((row >> b) & 1ULL) << (2 * b + 1);
+            }
+        } else if (ordering == CELL_ORDER_HILBERT) {
+            uint64_t x = col;
+            uint64_t y = row;
+            for (uint64_t s = side >> 1; s > 0; s >>= 1) {
+                uint64_t rx = (x & s) > 0 ? 1 : 0;
+                uint64_t ry = (y & s) > 0 ? 1 : 0;
+                key += s * s * ((3 * rx) ^ ry);
+                if (ry == 0) {  /// rotate the quadrant
+                    if (rx == 1) {
+                        x = side - 1 - x;
+                        y = side - 1 - y;
+                    }
+                    uint64_t t = x;
+                    x = y;
+                    y = t;
+                }
+            }
+        } else if (ordering == CELL_ORDER_TILED) {
+            uint64_t tile = (row / tileSize) * nTileCols + col / tileSize;
+            key = tile * tileSize * tileSize + (row % tileSize) * tileSize + col % tileSize;
+        } else {
+            key = row * nCols + col;
+        }
+        keys[i] = make_pair(key, i);
+    }
+    sort(keys.begin(), keys.end());
+    /// 2. permute the data and position pointers
+    if (m_is2DRaster && m_raster2DData != NULL) {
+        T **newData = new T *[m_nCells];
+        for (int i = 0; i < m_nCells; i++) newData[i] = m_raster2DData[keys[i].second];
+        delete[] m_raster2DData;
+        m_raster2DData = newData;
+    } else if (m_rasterData != NULL) {
+        T *newData = new T[m_nCells];
+#pragma omp parallel for
+        for (int i = 0; i < m_nCells; i++) newData[i] = m_rasterData[keys[i].second];
+        if (m_mappedFile != NULL && m_mappedFile->contains(m_rasterData)) {
+            /// keep the data in the mapped file
+            memcpy(m_rasterData, newData, sizeof(T) * m_nCells);
+            delete[] newData;
+        } else {
+            delete[] m_rasterData;
+            m_rasterData = newData;
+        }
+    }
+    int **newPositions = new int *[m_nCells];
+    for (int i = 0; i < m_nCells; i++) newPositions[i] = m_rasterPositionData[keys[i].second];
+    delete[] m_rasterPositionData;
+    m_rasterPositionData = newPositions;
+    /// 3. update permutation maps between the stored order and the row-major order
+    this->_build_row_major_order(ordering);
+    this->releaseNeighborIndex();
+    return true;
+}
+
+template<typename T, typename MaskT>
+void clsRasterData<T, MaskT>::_build_row_major_order(CellOrdering ordering) {
+    if (m_toRowMajor != NULL) Release1DArray(m_toRowMajor);
+    if (m_fromRowMajor != NULL) Release1DArray(m_fromRowMajor);
+    m_cellOrdering = CELL_ORDER_ROWMAJOR;
+    if (m_rasterPositionData == NULL || !m_storePositions || m_nCells <= 0) return;
+    int nCols = this->getCols();
+    vector<pair<uint64_t, int> > gridIdx(m_nCells);
+#pragma omp parallel for
+    for (int i = 0; i < m_nCells; i++) {
+        gridIdx[i] = make_pair((uint64_t) m_rasterPositionData[i][0] * nCols + m_rasterPositionData[i][1], i);
+    }
+    bool rowMajor = true;
+    for (int i = 1; i < m_nCells && rowMajor; i++) {
+        rowMajor = gridIdx[i - 1].first < gridIdx[i].first;
+    }
+    if (rowMajor) return;
+    sort(gridIdx.begin(), gridIdx.end());
+    m_cellOrdering = ordering;
+    m_toRowMajor = new int[m_nCells];
+    m_fromRowMajor = new int[m_nCells];
+    for (int i = 0; i < m_nCells; i++) {
+        m_fromRowMajor[i] = gridIdx[i].second;
+        m_toRowMajor[gridIdx[i].second] = i;
+    }
+}
+
+template<typename T, typename MaskT>
+const clsManagedRaster *clsRasterData<T, MaskT>::getPositionOwner(void) const {
+    /// the raster not read yet will follow the order of mask at the time of reading
+    if (m_mask == NULL || m_storePositions || m_nCells <= 0 || m_lazyPending.load(memory_order_acquire)) {
+        return NULL;
+    }
+    /// the positions of mask are shared, or the values are stored in the order of mask, e.g., by
+    /// the constructor from mask and values
+    if (m_rasterPositionData != NULL || m_useMaskExtent) return m_mask;
+    return NULL;
+}
+
 template<typename T, typename MaskT>
 T clsRasterData<T, MaskT>::getValue(int validCellIndex, int lyr /* = 1 */) {
+    this->_materialize();
     if (m_rasterData == NULL || (m_is2DRaster && m_raster2DData == NULL)) {
         cout << "Please initialize the raster object first." << endl;
         return m_noDataValue;
@@ -426,6 +673,7 @@ T clsRasterData<T, MaskT>::getValue(int validCellIndex, int lyr /* = 1 */) {
 
 template<typename T, typename MaskT>
 T clsRasterData<T, MaskT>::getValue(RowColCoor pos, int lyr /* = 1 */) {
+    this->_materialize();
     int row = pos.row;
     int col = pos.col;
     if (m_rasterData == NULL || (m_is2DRaster && m_raster2DData == NULL)) {
@@ -462,19 +710,24 @@ T clsRasterData<T, MaskT>::getValue(initializer_list<int> poslist, int lyr /* =
 
 template<typename T, typename MaskT>
 void clsRasterData<T, MaskT>::setValue(RowColCoor pos, T value, int lyr /* = 1 */) {
+    this->_materialize();
+    this->releaseSummedAreaTables();
     int idx = this->getPosition(pos.row, pos.col);
-    if (idx == -1) {
-        if (m_is2DRaster) {
-            m_raster2DData[pos.row * this->getCols() + pos.col][lyr] = value;
-        } else {
-            m_rasterData[pos.row * this->getCols() + pos.col] = value;
+    /// the cell not stored by the raster with positions, e.g., NODATA excluded, can not be set
+    if (idx == -1) return;
+    /// mark the block as modified, the pyramid will be updated incrementally
+    {
+        lock_guard<recursive_mutex> lock(m_materializeMutex);
+        if (m_pyramidMin != NULL && lyr >= 1 && lyr <= m_nLyrs && m_pyramidMin[lyr - 1] != NULL &&
+            pos.row >= 0 && pos.row < this->getRows() && pos.col >= 0 && pos.col < this->getCols()) {
+            m_pyramidDirty[lyr - 1].push_back((pos.row / m_pyramidBlockSize) * m_pyramidSizes[0].second +
+                                              pos.col / m_pyramidBlockSize);
         }
+    }
+    if (m_is2DRaster) {
+        m_raster2DData[idx][lyr - 1] = value;
     } else {
-        if (m_is2DRaster) {
-            m_raster2DData[idx][lyr] = value;
-        } else {
-            m_rasterData[idx] = value;
-        }
+        m_rasterData[idx] = value;
     }
 }
 
@@ -485,6 +738,7 @@ T clsRasterData<T, MaskT>::isNoData(RowColCoor pos, int lyr /* = 1 */) {
 
 template<typename T, typename MaskT>
 void clsRasterData<T, MaskT>::getValue(int validCellIndex, int *nLyrs, T **values) {
+    this->_materialize();
     if (m_rasterData == NULL && (m_is2DRaster && m_raster2DData == NULL)) {
         cout << "Please first initialize the raster object." << endl;
     }
@@ -537,21 +791,28 @@ void clsRasterData<T, MaskT>::getValue(initializer_list<int> poslist, int *nLyrs
 /************* Output to file functions ***************/
 
 template<typename T, typename MaskT>
-void clsRasterData<T, MaskT>::outputToFile(string filename) {
+bool clsRasterData<T, MaskT>::outputToFile(string filename,
+                                           const GTiffWriteOptions &options /* = GTiffWriteOptions() */) {
     string filetype = GetUpper(GetSuffix(filename));
     if (StringMatch(filetype, ASCIIExtension)) {
-        outputASCFile(filename);
+        return outputASCFile(filename);
     } else if (StringMatch(filetype, GTiffExtension)) {
-        outputFileByGDAL(filename);
+        return outputFileByGDAL(filename, options);
+    } else if (StringMatch(filetype, NativeExtension)) {
+        return outputNativeFile(filename);
     } else {
-        outputFileByGDAL(ReplaceSuffix(filename, string(GTiffExtension)));
+        return outputFileByGDAL(ReplaceSuffix(filename, string(GTiffExtension)), options);
     }
 }
 
 template<typename T, typename MaskT>
-void clsRasterData<T, MaskT>::_write_ASC_headers(string filename, map<string, double> &header) {
+bool clsRasterData<T, MaskT>::_write_ASC_headers(string filename, map<string, double> &header) {
     DeleteExistedFile(filename);
     ofstream rasterFile(filename.c_str(), ios::app | ios::out);
+    if (!rasterFile.is_open()) {
+        cout << "Create ASC file " + filename + " failed." << endl;
+        return false;
+    }
     //write file
     int rows = int(header[HEADER_RS_NROWS]);
     int cols = int(header[HEADER_RS_NCOLS]);
@@ -563,10 +824,12 @@ void clsRasterData<T, MaskT>::_write_ASC_headers(string filename, map<string, do
     rasterFile << HEADER_RS_CELLSIZE << " " << (float) header[HEADER_RS_CELLSIZE] << endl;
     rasterFile << HEADER_RS_NODATA << " " << setprecision(6) << header[HEADER_RS_NODATA] << endl;
     rasterFile.close();
+    return !rasterFile.fail();
 }
 
 template<typename T, typename MaskT>
-void clsRasterData<T, MaskT>::outputASCFile(string filename) {
+bool clsRasterData<T, MaskT>::outputASCFile(string filename) {
+    this->_materialize();
     /// 1. Is there need to calculate valid position index?
     int count;
     int **position;
@@ -578,8 +841,10 @@ void clsRasterData<T, MaskT>::outputASCFile(string filename) {
         m_mask->getRasterPositionData(count, &position);
         outputdirectly = false;
     }
+    /// stored cells may be ordered along a space-filling curve
+    const int *order = outputdirectly ? NULL : this->_get_row_major_order(position);
     /// 2. Write ASC raster headers first (for 1D raster data only)
-    if (!m_is2DRaster) this->_write_ASC_headers(filename, m_headers);
+    if (!m_is2DRaster && !this->_write_ASC_headers(filename, m_headers)) return false;
     /// 3. Begin to write raster data
     int rows = int(m_headers[HEADER_RS_NROWS]);
     int cols = int(m_headers[HEADER_RS_NCOLS]);
@@ -591,7 +856,7 @@ void clsRasterData<T, MaskT>::outputASCFile(string filename) {
             stringstream oss;
             oss << prePath << coreName << "_" << (lyr + 1) << "." << ASCIIExtension;
             string tmpfilename = oss.str();
-            this->_write_ASC_headers(tmpfilename, m_headers);
+            if (!this->_write_ASC_headers(tmpfilename, m_headers)) return false;
             // write data
             ofstream rasterFile(tmpfilename.c_str(), ios::app | ios::out);
             int index = 0;
@@ -602,14 +867,19 @@ void clsRasterData<T, MaskT>::outputASCFile(string filename) {
                         rasterFile << setprecision(6) << m_raster2DData[index][lyr] << " ";
                         continue;
                     }
-                    if (index < m_nCells && (position[index][0] == i && position[index][1] == j)) {
-                        rasterFile << setprecision(6) << m_raster2DData[index][lyr] << " ";
+                    int cell = order == NULL ? index : order[index];
+                    if (index < m_nCells && (position[cell][0] == i && position[cell][1] == j)) {
+                        rasterFile << setprecision(6) << m_raster2DData[cell][lyr] << " ";
                         index++;
                     } else { rasterFile << setprecision(6) << NODATA_VALUE << " "; }
                 }
                 rasterFile << endl;
             }
             rasterFile.close();
+            if (rasterFile.fail()) {
+                cout << "Write ASC file " + tmpfilename + " failed." << endl;
+                return false;
+            }
         }
     } else {  /// 3.2 1D raster data
         ofstream rasterFile(filename.c_str(), ios::app | ios::out);
@@ -622,8 +892,9 @@ void clsRasterData<T, MaskT>::outputASCFile(string filename) {
                     continue;
                 }
                 if (index < m_nCells) {
-                    if (position[index][0] == i && position[index][1] == j) {
-                        rasterFile << setprecision(6) << m_rasterData[index] << " ";
+                    int cell = order == NULL ? index : order[index];
+                    if (position[cell][0] == i && position[cell][1] == j) {
+                        rasterFile << setprecision(6) << m_rasterData[cell] << " ";
                         index++;
                     } else { rasterFile << setprecision(6) << NODATA_VALUE << " "; }
                 } else { rasterFile << setprecision(6) << NODATA_VALUE << " "; }
@@ -631,123 +902,395 @@ void clsRasterData<T, MaskT>::outputASCFile(string filename) {
             rasterFile << endl;
         }
         rasterFile.close();
+        if (rasterFile.fail()) {
+            cout << "Write ASC file " + filename + " failed." << endl;
+            return false;
+        }
     }
     position = NULL;
+    return true;
 }
 
 template<typename T, typename MaskT>
-void
-clsRasterData<T, MaskT>::_write_single_geotiff(string filename,
-                                               map<string, double> &header,
-                                               string srs,
-                                               float *values) {
+GDALDataset *clsRasterData<T, MaskT>::_create_geotiff(string filename, int nBands, GDALDataType outType,
+                                                      const GTiffWriteOptions &options) {
     /// 1. Create GeoTiff file driver
     GDALDriver *poDriver = GetGDALDriverManager()->GetDriverByName("GTiff");
-    // char **papszOptions = poDriver->GetMetadata();
-    char **papszOptions = NULL;
-    int nRows = int(header[HEADER_RS_NROWS]);
-    int nCols = int(header[HEADER_RS_NCOLS]);
-    GDALDataset *poDstDS = poDriver->Create(filename.c_str(), nCols, nRows, 1, GDT_Float32, papszOptions);
-    /// 2. Write raster data
-    GDALRasterBand *poDstBand = poDstDS->GetRasterBand(1);
-    poDstBand->RasterIO(GF_Write, 0, 0, nCols, nRows, values, nCols, nRows, GDT_Float32, 0, 0);
-    poDstBand->SetNoDataValue(header[HEADER_RS_NODATA]);
-    /// 3. Writer header information
+    char **papszOptions = options.toGDALOptions();
+    int nRows = int(m_headers[HEADER_RS_NROWS]);
+    int nCols = int(m_headers[HEADER_RS_NCOLS]);
+    GDALDataset *poDstDS = poDriver->Create(filename.c_str(), nCols, nRows, nBands, outType, papszOptions);
+    CSLDestroy(papszOptions);
+    if (poDstDS == NULL) {
+        cout << "Create GeoTIFF file " + filename + " failed." << endl;
+        return NULL;
+    }
+    for (int band = 1; band <= nBands; band++) {
+        poDstDS->GetRasterBand(band)->SetNoDataValue(this->_output_nodata(outType));
+    }
+    /// 2. Writer header information
     double geoTrans[6];
-    geoTrans[0] = header[HEADER_RS_XLL] - 0.5 * header[HEADER_RS_CELLSIZE];
-    geoTrans[1] = header[HEADER_RS_CELLSIZE];
+    geoTrans[0] = m_headers[HEADER_RS_XLL] - 0.5 * m_headers[HEADER_RS_CELLSIZE];
+    geoTrans[1] = m_headers[HEADER_RS_CELLSIZE];
     geoTrans[2] = 0.;
-    geoTrans[3] = header[HEADER_RS_YLL] + (nRows - 0.5) * header[HEADER_RS_CELLSIZE];
+    geoTrans[3] = m_headers[HEADER_RS_YLL] + (nRows - 0.5) * m_headers[HEADER_RS_CELLSIZE];
     geoTrans[4] = 0.;
-    geoTrans[5] = -header[HEADER_RS_CELLSIZE];
+    geoTrans[5] = -m_headers[HEADER_RS_CELLSIZE];
     poDstDS->SetGeoTransform(geoTrans);
-    poDstDS->SetProjection(srs.c_str());
+    poDstDS->SetProjection(m_srs.c_str());
+    return poDstDS;
+}
+
+template<typename T, typename MaskT>
+template<typename BufT>
+bool clsRasterData<T, MaskT>::_write_geotiff_strips(string filename, int **position, const int *order,
+                                                    int firstLyr, int nBands, GDALDataType outType,
+                                                    const GTiffWriteOptions &options) {
+    GDALDataset *poDstDS = this->_create_geotiff(filename, nBands, outType, options);
+    if (poDstDS == NULL) return false;
+    int nRows = int(m_headers[HEADER_RS_NROWS]);
+    int nCols = int(m_headers[HEADER_RS_NCOLS]);
+    GDALDataType bufType = GDALDataTypeOf<BufT>::value;
+    GSpacing bandSpace = sizeof(BufT);
+    GSpacing pixelSpace = bandSpace * nBands;
+    GSpacing lineSpace = pixelSpace * nCols;
+    double outNoData = this->_output_nodata(outType);
+    bool remap = !FloatEqual(outNoData, m_headers[HEADER_RS_NODATA]);
+    BufT noDataValue = (BufT) outNoData;
+    if (position == NULL && !m_is2DRaster && typeid(T) == typeid(BufT) && !remap) {
+        /// no intermediate copy if the full grid is stored as the buffer type
+        CPLErr result = poDstDS->RasterIO(GF_Write, 0, 0, nCols, nRows, m_rasterData, nCols, nRows, bufType,
+                                          1, NULL, pixelSpace, lineSpace, bandSpace);
+        GDALClose(poDstDS);
+        if (result != CE_None) cout << "Write GeoTIFF file " + filename + " failed." << endl;
+        return result == CE_None;
+    }
+    /// scatter valid cells into one strip of rows at a time, values of bands are interleaved by pixel
+    int blockXSize = 0;
+    int blockYSize = 0;
+    poDstDS->GetRasterBand(1)->GetBlockSize(&blockXSize, &blockYSize);
+    if (blockYSize < 1) blockYSize = 1;
+    if (blockYSize > nRows) blockYSize = nRows;
+    /// the strip size is counted in size_t, and the strip is lowered to fit the buffer of int length
+    size_t rowLength = (size_t) nCols * nBands;
+    if (rowLength > (size_t) INT_MAX) {
+        cout << "Row of " << filename << " is too large to be buffered!" << endl;
+        GDALClose(poDstDS);
+        return false;
+    }
+    if ((size_t) blockYSize * rowLength > (size_t) INT_MAX) blockYSize = int(INT_MAX / rowLength);
+    BufT *strip = NULL;
+    Initialize1DArray(int((size_t) blockYSize * rowLength), strip, noDataValue);
+    int validnum = 0;
+    CPLErr result = CE_None;
+    for (int row0 = 0; row0 < nRows && result == CE_None; row0 += blockYSize) {
+        int stripRows = min(blockYSize, nRows - row0);
+        size_t stripSize = (size_t) stripRows * nCols;
+        if (position == NULL) {
+            for (size_t i = 0; i < stripSize; i++) {
+                size_t cell = (size_t) row0 * nCols + i;
+                BufT *pixel = strip + (size_t) i * nBands;
+                if (m_is2DRaster) {
+                    for (int band = 0; band < nBands; band++) {
+                        pixel[band] = this->_output_value(m_raster2DData[cell][firstLyr + band], remap, noDataValue);
+                    }
+                } else { pixel[0] = this->_output_value(m_rasterData[cell], remap, noDataValue); }
+            }
+        } else {
+            for (size_t i = 0; i < stripSize * nBands; i++) strip[i] = noDataValue;
+            for (; validnum < m_nCells; validnum++) {
+                int cell = order == NULL ? validnum : order[validnum];
+                int row = position[cell][0];
+                if (row >= row0 + stripRows) break;
+                BufT *pixel = strip + ((size_t) (row - row0) * nCols + position[cell][1]) * nBands;
+                if (m_is2DRaster) {
+                    for (int band = 0; band < nBands; band++) {
+                        pixel[band] = this->_output_value(m_raster2DData[cell][firstLyr + band], remap, noDataValue);
+                    }
+                } else { pixel[0] = this->_output_value(m_rasterData[cell], remap, noDataValue); }
+            }
+        }
+        result = poDstDS->RasterIO(GF_Write, 0, row0, nCols, stripRows, strip, nCols, stripRows, bufType,
+                                   nBands, NULL, pixelSpace, lineSpace, bandSpace);
+    }
+    Release1DArray(strip);
     GDALClose(poDstDS);
+    if (result != CE_None) cout << "Write GeoTIFF file " + filename + " failed." << endl;
+    return result == CE_None;
 }
 
 template<typename T, typename MaskT>
-void clsRasterData<T, MaskT>::outputFileByGDAL(string filename) {
+bool clsRasterData<T, MaskT>::outputFileByGDAL(string filename,
+                                               const GTiffWriteOptions &options /* = GTiffWriteOptions() */) {
+    this->_materialize();
+    GDALDataType nativeType = GDALDataTypeOf<T>::value;
+    if (nativeType == GDT_Unknown) {
+        /// e.g., bool or long, converted by a double buffer and written as Float32 by default
+        GDALDataType outType = options.dataType == GDT_Unknown ? GDT_Float32 : options.dataType;
+        return this->template _output_geotiff<double>(filename, outType, options);
+    } else {
+        GDALDataType outType = options.dataType == GDT_Unknown ? nativeType : options.dataType;
+        return this->template _output_geotiff<T>(filename, outType, options);
+    }
+}
+
+template<typename T, typename MaskT>
+template<typename BufT>
+bool clsRasterData<T, MaskT>::_output_geotiff(string filename, GDALDataType outType,
+                                              const GTiffWriteOptions &options) {
     /// 1. Is there need to calculate valid position index?
     int count;
-    int **position;
-    bool outputdirectly = true;
+    int **position = NULL;
     if (m_rasterPositionData != NULL) {
         this->getRasterPositionData(count, &position);
-        outputdirectly = false;
     } else if (m_useMaskExtent && m_mask != NULL) {
         m_mask->getRasterPositionData(count, &position);
-        outputdirectly = false;
     }
-    /// 2. Get raster data
-    /// 2.1 2D raster data
-    T noDataValue = (T) m_headers[HEADER_RS_NODATA];
-    int nRows = int(m_headers[HEADER_RS_NROWS]);
-    int nCols = int(m_headers[HEADER_RS_NCOLS]);
-    if (m_is2DRaster) {
+    const int *order = position == NULL ? NULL : this->_get_row_major_order(position);
+    /// 2. Write raster data
+    bool succeed = true;
+    if (!m_is2DRaster) {
+        succeed = this->template _write_geotiff_strips<BufT>(filename, position, order, 0, 1, outType, options);
+    } else if (options.multiBand) {
+        succeed = this->template _write_geotiff_strips<BufT>(filename, position, order, 0, m_nLyrs, outType, options);
+    } else {
         string prePath = GetPathFromFullName(filename);
         string coreName = GetCoreFileName(filename);
         for (int lyr = 0; lyr < m_nLyrs; lyr++) {
             stringstream oss;
             oss << prePath << coreName << "_" << (lyr + 1) << "." << GTiffExtension;
-            string tmpfilename = oss.str();
-            float *rasterdata1D = NULL;
-            Initialize1DArray(nRows * nCols, rasterdata1D, (float) noDataValue);
-            int validnum = 0;
-            for (int i = 0; i < nRows; ++i) {
-                for (int j = 0; j < nCols; ++j) {
-                    int index = i * nCols + j;
-                    if (outputdirectly) {
-                        rasterdata1D[index] = m_raster2DData[index][lyr];
-                        continue;
-                    }
-                    if (validnum < m_nCells && (position[validnum][0] == i && position[validnum][1] == j)) {
-                        rasterdata1D[index] = m_raster2DData[validnum][lyr];
-                        validnum++;
-                    }
-                }
-            }
-            this->_write_single_geotiff(tmpfilename, m_headers, m_srs, rasterdata1D);
-            Release1DArray(rasterdata1D);
+            succeed = this->template _write_geotiff_strips<BufT>(oss.str(), position, order, lyr, 1,
+                                                                 outType, options) && succeed;
         }
-    } else {  /// 3.2 1D raster data
-        float *rasterdata1D = NULL;
-        bool newbuilddata = true;
-        if (outputdirectly) {
-            if (typeid(T) != typeid(float)) {
-                /// copyArray() should be an common used function
-                rasterdata1D = new float[m_nCells];
-                for (int i = 0; i < m_nCells; i++) {
-                    rasterdata1D[i] = (float) m_rasterData[i];
-                }
+    }
+    position = NULL;
+    return succeed;
+}
+
+template<typename T, typename MaskT>
+bool clsRasterData<T, MaskT>::outputNativeFile(string filename) {
+    this->_materialize();
+    NativeRasterHeader header;
+    vector<int32_t> runs;
+    int **positions = NULL;
+    const int *order = NULL;
+    if (!this->_get_native_layout(header, runs, &positions, &order)) {
+        cout << "The positions of valid cells are not available!" << endl;
+        return false;
+    }
+    /// write sections sequentially
+    DeleteExistedFile(filename);
+    ofstream rasterFile(filename.c_str(), ios::out | ios::binary);
+    if (!rasterFile.is_open()) {
+        cout << "Create native raster file " + filename + " failed." << endl;
+        return false;
+    }
+    rasterFile.write((const char *) &header, sizeof(NativeRasterHeader));
+    this->_write_native_sections(rasterFile, header, runs, positions, order);
+    bool succeed = rasterFile.good();
+    rasterFile.close();
+    if (!succeed) cout << "Write native raster file " + filename + " failed." << endl;
+    return succeed;
+}
+
+template<typename T, typename MaskT>
+bool clsRasterData<T, MaskT>::outputToSharedMemory(string name) {
+    this->_materialize();
+    NativeRasterHeader header;
+    vector<int32_t> runs;
+    int **positions = NULL;
+    const int *order = NULL;
+    if (!this->_get_native_layout(header, runs, &positions, &order)) {
+        cout << "The positions of valid cells are not available!" << endl;
+        return false;
+    }
+    /// the previously published segment is unnamed first, so the name can be reused
+    if (m_sharedMemory != NULL) {
+        delete m_sharedMemory;
+        m_sharedMemory = NULL;
+    }
+    clsMemoryMap *shared = clsMemoryMap::createShared(name, (size_t) header.fileSize);
+    if (shared == NULL) return false;
+    NativeMemoryWriter writer(shared->data());
+    this->_write_native_sections(writer, header, runs, positions, order);
+    /// the magic string is written last, so the partially written segment is never attached
+    char magic[sizeof(header.magic)];
+    memcpy(magic, header.magic, sizeof(magic));
+    memset(header.magic, 0, sizeof(header.magic));
+    writer.seekp(0);
+    writer.write((const char *) &header, sizeof(NativeRasterHeader));
+    atomic_thread_fence(memory_order_release);
+    memcpy(shared->data(), magic, sizeof(magic));
+    m_sharedMemory = shared;
+    return true;
+}
+
+template<typename T, typename MaskT>
+bool clsRasterData<T, MaskT>::_get_native_layout(NativeRasterHeader &header, vector<int32_t> &runs,
+                                                 int ***positions, const int **order) {
+    if (!this->_get_stored_positions(positions)) return false;
+    *order = this->_get_row_major_order(*positions);
+    /// 1. row runs of the valid cells in row-major order
+    runs.clear();
+    if (*positions != NULL) this->_get_row_runs(*positions, runs);
+    /// 2. fill the header and offsets of each section
+    memset(&header, 0, sizeof(NativeRasterHeader));
+    memcpy(header.magic, NATIVE_RS_MAGIC, sizeof(header.magic));
+    header.version = NATIVE_RS_VERSION;
+    header.dataType = GDALDataTypeOf<T>::value;
+    header.typeSize = sizeof(T);
+    header.is2DRaster = m_is2DRaster ? 1 : 0;
+    header.nRows = this->getRows();
+    header.nCols = this->getCols();
+    header.nLyrs = m_nLyrs;
+    header.nCells = m_nCells;
+    header.nRuns = int(runs.size() / 3);
+    header.hasStatistics = m_statisticsCalculated ? 1 : 0;
+    header.xll = m_headers[HEADER_RS_XLL];
+    header.yll = m_headers[HEADER_RS_YLL];
+    header.cellSize = m_headers[HEADER_RS_CELLSIZE];
+    header.noData = m_headers[HEADER_RS_NODATA];
+    int64_t offset = sizeof(NativeRasterHeader);
+#define NATIVE_RS_ALIGN(x) (((x) + NATIVE_RS_ALIGNMENT - 1) / NATIVE_RS_ALIGNMENT * NATIVE_RS_ALIGNMENT)
+    header.srsOffset = NATIVE_RS_ALIGN(offset);
+    header.srsLength = (int64_t) m_srs.size();
+    offset = header.srsOffset + header.srsLength;
+    if (*positions != NULL) {
+        header.runsOffset = NATIVE_RS_ALIGN(offset);
+        offset = header.runsOffset + (int64_t) runs.size() * sizeof(int32_t);
+        header.positionsOffset = NATIVE_RS_ALIGN(offset);
+        offset = header.positionsOffset + (int64_t) m_nCells * 2 * sizeof(int32_t);
+    }
+    if (m_statisticsCalculated) {
+        header.statsOffset = NATIVE_RS_ALIGN(offset);
+        offset = header.statsOffset + 6 * m_nLyrs * sizeof(double);
+    }
+    header.dataOffset = NATIVE_RS_ALIGN(offset);
+    header.fileSize = header.dataOffset + (int64_t) m_nCells * m_nLyrs * sizeof(T);
+#undef NATIVE_RS_ALIGN
+    return true;
+}
+
+template<typename T, typename MaskT>
+template<typename StreamT>
+void clsRasterData<T, MaskT>::_write_native_sections(StreamT &out, const NativeRasterHeader &header,
+                                                     const vector<int32_t> &runs, int **positions,
+                                                     const int *order) {
+    out.seekp(header.srsOffset);
+    out.write(m_srs.c_str(), header.srsLength);
+    if (positions != NULL) {
+        out.seekp(header.runsOffset);
+        if (!runs.empty()) out.write((const char *) &runs[0], runs.size() * sizeof(int32_t));
+        out.seekp(header.positionsOffset);
+        for (int idx = 0; idx < m_nCells; idx++) {
+            int cell = order == NULL ? idx : order[idx];
+            int32_t pos[2] = {positions[cell][0], positions[cell][1]};
+            out.write((const char *) pos, sizeof(pos));
+        }
+    }
+    if (m_statisticsCalculated) {
+        out.seekp(header.statsOffset);
+        const char *statsnames[6] = {STATS_RS_VALIDNUM, STATS_RS_MEAN, STATS_RS_MAX, STATS_RS_MIN,
+                                     STATS_RS_STD, STATS_RS_RANGE};
+        for (int i = 0; i < 6; i++) {
+            if (m_is2DRaster) {
+                out.write((const char *) m_statsMap2D.at(statsnames[i]), m_nLyrs * sizeof(double));
             } else {
-                rasterdata1D = (float *) m_rasterData;
-                newbuilddata = false;
+                out.write((const char *) &m_statsMap.at(statsnames[i]), sizeof(double));
             }
+        }
+    }
+    out.seekp(header.dataOffset);
+    if (!m_is2DRaster && order == NULL) {
+        out.write((const char *) m_rasterData, (streamsize) m_nCells * sizeof(T));
+    } else {
+        for (int idx = 0; idx < m_nCells; idx++) {
+            int cell = order == NULL ? idx : order[idx];
+            if (m_is2DRaster) out.write((const char *) m_raster2DData[cell], m_nLyrs * sizeof(T));
+            else out.write((const char *) &m_rasterData[cell], sizeof(T));
+        }
+    }
+}
+
+template<typename T, typename MaskT>
+bool clsRasterData<T, MaskT>::outputToBlobStore(string filename, clsRasterBlobStore* store, const BlobWriteOptions &options){
+    this->_materialize();
+    int **positions = NULL;
+    if (options.tileSize > 0 && !this->_get_stored_positions(&positions)) {
+        cout << "The positions of valid cells of " + m_coreFileName + " are not available!" << endl;
+        return false;
+    }
+    bool validCellsOnly = options.validCellsOnly && options.tileSize <= 0;
+    if (validCellsOnly && (!this->_get_stored_positions(&positions) || positions == NULL)) {
+        cout << "The positions of valid cells of " + m_coreFileName + " are not available, "
+            "the full-sized data is written!" << endl;
+        validCellsOnly = false;
+    }
+    int level = -1;
+    if (StringMatch(options.compress, BLOB_CODEC_SHUFFLE_ZLIB)) {
+        level = options.level < 1 ? 1 : options.level;
+    } else if (!options.compress.empty() && !StringMatch(options.compress, "NONE")) {
+        cout << "The compression " + options.compress + " is not supported, the data is not compressed!" << endl;
+    }
+    /// the tiles of the replaced blob, which are removed after the blob is replaced
+    vector<string> staleTiles;
+    _get_tile_names(store, filename, staleTiles);
+    bool succeed;
+    GDALDataType nativeType = GDALDataTypeOf<T>::value;
+    if (nativeType == GDT_Unknown) {
+        /// e.g., bool or long, converted by a double buffer and stored as Float64 by default
+        GDALDataType outType = options.dataType == GDT_Unknown ? GDT_Float64 : options.dataType;
+        if (options.tileSize > 0) {
+            succeed = this->template _output_blob_tiles<double>(filename, store, positions, outType, level,
+                                                                options.tileSize);
+        } else if (validCellsOnly) {
+            succeed = this->template _output_blob_valid_cells<double>(filename, store, positions, outType, level);
         } else {
-            Initialize1DArray(nRows * nCols, rasterdata1D, (float) noDataValue);
-        }
-        int validnum = 0;
-        if (!outputdirectly) {
-            for (int i = 0; i < nRows; ++i) {
-                for (int j = 0; j < nCols; ++j) {
-                    int index = i * nCols + j;
-                    if (validnum < m_nCells && (position[validnum][0] == i && position[validnum][1] == j)) {
-                        rasterdata1D[index] = m_rasterData[validnum];
-                        validnum++;
-                    }
-                }
-            }
+            succeed = this->template _output_blob<double>(filename, store, outType, level);
+        }
+    } else {
+        GDALDataType outType = options.dataType == GDT_Unknown ? nativeType : options.dataType;
+        if (options.tileSize > 0) {
+            succeed = this->template _output_blob_tiles<T>(filename, store, positions, outType, level,
+                                                           options.tileSize);
+        } else if (validCellsOnly) {
+            succeed = this->template _output_blob_valid_cells<T>(filename, store, positions, outType, level);
+        } else {
+            succeed = this->template _output_blob<T>(filename, store, outType, level);
         }
-        this->_write_single_geotiff(filename, m_headers, m_srs, rasterdata1D);
-        if (!newbuilddata) { rasterdata1D = NULL; }
-        else { Release1DArray(rasterdata1D); }
     }
-    position = NULL;
+    if (!succeed) return false;
+    for (size_t i = 0; i < staleTiles.size(); i++) store->remove(staleTiles[i]);
+    return true;
 }
 
-#ifdef USE_MONGODB
 template<typename T, typename MaskT>
-void clsRasterData<T, MaskT>::outputToMongoDB(string filename, MongoGridFS* gfs){
+bool clsRasterData<T, MaskT>::_get_tile_names(clsRasterBlobStore* store, const string &filename,
+                                              vector<string> &names) {
+    BlobMetadata meta;
+    if (!store->metadata(filename, meta) || meta.getString(HEADER_RS_LAYOUT) != BLOB_LAYOUT_TILED) return false;
+    clsBlobReader index(store, filename);
+    if (!index.isOpen()) return false;
+    double nTileCols = 0., nLyrs = 1.;
+    meta.getNumber(HEADER_RS_NTILECOLS, nTileCols);
+    meta.getNumber(HEADER_RS_LAYERS, nLyrs);
+    if (nTileCols < 1. || index.length() % sizeof(int32_t) != 0) return false;
+    vector<int32_t> counts(index.length() / sizeof(int32_t));
+    if (!counts.empty() && index.read(&counts[0], index.length()) != index.length()) return false;
+    string version = meta.getString(HEADER_RS_TILEVERSION);
+    int tileCols = int(nTileCols);
+    for (int t = 0; t < int(counts.size()); t++) {
+        if (counts[t] <= 0) continue;
+        for (int lyr = 1; lyr <= int(nLyrs); lyr++) {
+            names.push_back(GetRasterTileName(filename, t / tileCols, t % tileCols, lyr, version));
+        }
+    }
+    return true;
+}
+
+template<typename T, typename MaskT>
+template<typename BufT>
+bool clsRasterData<T, MaskT>::_output_blob(string filename, clsRasterBlobStore* store, GDALDataType outType, int level){
     /// 1. Is there need to calculate valid position index?
     int count;
     int** position;
@@ -760,80 +1303,261 @@ void clsRasterData<T, MaskT>::outputToMongoDB(string filename, MongoGridFS* gfs)
         m_mask->getRasterPositionData(count, &position);
         outputdirectly = false;
     }
-    /// 2. Get raster data
-    /// 2.1 2D raster data
-    T noDataValue = (T) m_headers[HEADER_RS_NODATA];
+    const int *order = outputdirectly ? NULL : this->_get_row_major_order(position);
+    /// 2. Create blob with the header information as metadata
+    BlobMetadata p;
+    this->_append_blob_metadata(p, outType);
+    p.setString(HEADER_RS_LAYOUT, BLOB_LAYOUT_FULL);
+    clsBlobWriter writer(store, filename, p);
+    if (!writer.isOpen()) return false;
+    /// 3. Write full-sized data by strips of rows, the layers of each cell are contiguous
+    GDALDataType bufType = GDALDataTypeOf<BufT>::value;
+    int outSize = GDALGetDataTypeSize(outType) / 8;
+    if (level > 0) writer.enableCompression(level, outSize);
+    double outNoData = this->_output_nodata(outType);
+    bool remap = !FloatEqual(outNoData, m_headers[HEADER_RS_NODATA]);
+    BufT noDataValue = (BufT) outNoData;
     int nRows = int(m_headers[HEADER_RS_NROWS]);
     int nCols = int(m_headers[HEADER_RS_NCOLS]);
-    int datalength;
-    if (m_is2DRaster){
-        string coreName = GetCoreFileName(filename);
-        T *rasterdata1D = NULL;
-        datalength = nRows * nCols * m_nLyrs;
-        Initialize1DArray(datalength, rasterdata1D, noDataValue);
-        int countindex = 0;
-        int rowcolindex = 0;
-        int dataIndex = 0;
-        for (int i = 0; i < nRows; ++i)
-        {
-            for (int j = 0; j < nCols; ++j)
-            {
-                rowcolindex = i * nCols + j;
-                for (int k = 0; k < m_nLyrs; k++)
-                {
-                    dataIndex = i * nCols * m_nLyrs + j * m_nLyrs + k;
-                    if (outputdirectly){
-                        rasterdata1D[dataIndex] = m_raster2DData[rowcolindex][k];
-                        continue;
-                    }
-                    if (countindex < m_nCells && (position[countindex][0] == i && position[countindex][1] == j))
-                    {
-                        rasterdata1D[dataIndex] = m_raster2DData[countindex][k];
-                        countindex++;
-                    }
+    int nLyrs = m_is2DRaster ? m_nLyrs : 1;
+    size_t rowLength = (size_t) nCols * nLyrs;
+    int stripRows = max(1, int(BLOB_PIECE_BYTES / (rowLength * max((int) sizeof(BufT), outSize))));
+    /// the full-sized 1D data of the stored type is written without copy
+    bool writedirectly = outputdirectly && !m_is2DRaster && outType == GDALDataTypeOf<T>::value && !remap;
+    BufT *strip = NULL;
+    unsigned char *converted = NULL;
+    if (!writedirectly) Initialize1DArray(int(stripRows * rowLength), strip, noDataValue);
+    if (!writedirectly && outType != bufType) Initialize1DArray(int(stripRows * rowLength * outSize), converted, 0);
+    int validnum = 0;
+    bool succeed = true;
+    for (int row0 = 0; row0 < nRows && succeed; row0 += stripRows) {
+        int rows = min(stripRows, nRows - row0);
+        size_t stripLength = rows * rowLength;
+        if (writedirectly) {
+            succeed = writer.write(m_rasterData + row0 * rowLength, stripLength * sizeof(T));
+            continue;
+        }
+        if (outputdirectly) {
+#pragma omp parallel for
+            for (int i = 0; i < rows * nCols; i++) {
+                for (int k = 0; k < nLyrs; k++) {
+                    strip[i * nLyrs + k] = this->_output_value(m_is2DRaster ? m_raster2DData[row0 * nCols + i][k]
+                                                                            : m_rasterData[row0 * nCols + i],
+                                                               remap, noDataValue);
                 }
             }
-        }
-        this->_write_stream_data_as_gridfs(gfs, filename, m_headers, m_srs, rasterdata1D, datalength);
-        Release1DArray(rasterdata1D);
-    }
-    else{  /// 3.2 1D raster data
-        float *rasterdata1D = NULL;
-        datalength = nRows * nCols;
-        if (outputdirectly)
-            rasterdata1D = m_rasterData;
-        else
-            Initialize1DArray(datalength, rasterdata1D, (T) noDataValue);
-        int validnum = 0;
-        if (!outputdirectly) {
-            for (int i = 0; i < nRows; ++i) {
-                for (int j = 0; j < nCols; ++j) {
-                    int index = i * nCols + j;
-
-                    if (validnum < m_nCells && (position[validnum][0] == i && position[validnum][1] == j)) {
-                        rasterdata1D[index] = m_rasterData[validnum];
-                        validnum++;
+        } else {
+            for (size_t i = 0; i < stripLength; i++) strip[i] = noDataValue;
+            /// scatter the valid cells of this strip, which are visited in row-major order
+            for (; validnum < m_nCells; validnum++) {
+                int cell = order == NULL ? validnum : order[validnum];
+                int row = position[cell][0];
+                if (row >= row0 + rows) break;
+                size_t idx = ((row - row0) * nCols + position[cell][1]) * nLyrs;
+                if (m_is2DRaster) {
+                    for (int k = 0; k < nLyrs; k++) {
+                        strip[idx + k] = this->_output_value(m_raster2DData[cell][k], remap, noDataValue);
                     }
+                } else {
+                    strip[idx] = this->_output_value(m_rasterData[cell], remap, noDataValue);
                 }
             }
         }
-        this->_write_stream_data_as_gridfs(gfs, filename, m_headers, m_srs, rasterdata1D, datalength);
-        if (outputdirectly) rasterdata1D = NULL;
-        else Release1DArray(rasterdata1D);
+        if (converted == NULL) {
+            succeed = writer.write(strip, stripLength * sizeof(BufT));
+        } else {
+            GDALCopyWords(strip, bufType, sizeof(BufT), converted, outType, outSize, int(stripLength));
+            succeed = writer.write(converted, stripLength * outSize);
+        }
+    }
+    if (strip != NULL) Release1DArray(strip);
+    if (converted != NULL) Release1DArray(converted);
+    return writer.close() && succeed;
+}
+
+template<typename T, typename MaskT>
+template<typename BufT>
+bool clsRasterData<T, MaskT>::_output_blob_valid_cells(string filename, clsRasterBlobStore* store, int **positions,
+                                                       GDALDataType outType, int level){
+    /// 1. Row runs of the valid cells, which are written before the values
+    vector<int32_t> runs;
+    this->_get_row_runs(positions, runs);
+    const int *order = this->_get_row_major_order(positions);
+    BlobMetadata p;
+    this->_append_blob_metadata(p, outType);
+    p.setString(HEADER_RS_LAYOUT, BLOB_LAYOUT_VALID);
+    p.setNumber(HEADER_RS_NRUNS, double(runs.size() / 3));
+    clsBlobWriter writer(store, filename, p);
+    if (!writer.isOpen()) return false;
+    GDALDataType bufType = GDALDataTypeOf<BufT>::value;
+    int outSize = GDALGetDataTypeSize(outType) / 8;
+    /// the row runs are shuffled by the value size too, which does no harm
+    if (level > 0) writer.enableCompression(level, outSize);
+    if (!runs.empty() && !writer.write(&runs[0], runs.size() * sizeof(int32_t))) return false;
+    /// 2. Values of the valid cells in row-major order, the layers of each cell are contiguous
+    int nLyrs = m_is2DRaster ? m_nLyrs : 1;
+    double outNoData = this->_output_nodata(outType);
+    bool remap = !FloatEqual(outNoData, m_headers[HEADER_RS_NODATA]);
+    BufT noDataValue = (BufT) outNoData;
+    if (!m_is2DRaster && order == NULL && outType == GDALDataTypeOf<T>::value && !remap) {
+        /// the 1D data of the stored type is already in row-major order
+        bool succeed = writer.write(m_rasterData, (size_t) m_nCells * sizeof(T));
+        return writer.close() && succeed;
+    }
+    int pieceCells = max(1, int(BLOB_PIECE_BYTES / (nLyrs * max((int) sizeof(BufT), outSize))));
+    BufT *piece = NULL;
+    unsigned char *converted = NULL;
+    Initialize1DArray(pieceCells * nLyrs, piece, (BufT) 0);
+    if (outType != bufType) Initialize1DArray(pieceCells * nLyrs * outSize, converted, 0);
+    bool succeed = true;
+    for (int idx0 = 0; idx0 < m_nCells && succeed; idx0 += pieceCells) {
+        int cells = min(pieceCells, m_nCells - idx0);
+#pragma omp parallel for
+        for (int i = 0; i < cells; i++) {
+            int cell = order == NULL ? idx0 + i : order[idx0 + i];
+            for (int k = 0; k < nLyrs; k++) {
+                piece[i * nLyrs + k] = this->_output_value(m_is2DRaster ? m_raster2DData[cell][k] : m_rasterData[cell],
+                                                           remap, noDataValue);
+            }
+        }
+        if (converted == NULL) {
+            succeed = writer.write(piece, (size_t) cells * nLyrs * sizeof(BufT));
+        } else {
+            GDALCopyWords(piece, bufType, sizeof(BufT), converted, outType, outSize, cells * nLyrs);
+            succeed = writer.write(converted, (size_t) cells * nLyrs * outSize);
+        }
     }
+    Release1DArray(piece);
+    if (converted != NULL) Release1DArray(converted);
+    return writer.close() && succeed;
 }
+
 template<typename T, typename MaskT>
-void clsRasterData<T, MaskT>::_write_stream_data_as_gridfs(MongoGridFS* gfs, string filename,
-    map<string, double>& header, string srs, T *values, size_t datalength) {
-    bson_t p = BSON_INITIALIZER;
+template<typename BufT>
+bool clsRasterData<T, MaskT>::_output_blob_tiles(string filename, clsRasterBlobStore* store, int **positions,
+                                                 GDALDataType outType, int level, int tileSize){
+    int nRows = this->getRows();
+    int nCols = this->getCols();
+    int nLyrs = m_is2DRaster ? m_nLyrs : 1;
+    int nTileRows = (nRows + tileSize - 1) / tileSize;
+    int nTileCols = (nCols + tileSize - 1) / tileSize;
+    /// 1. Group the valid cells by tiles, the validity is determined by the first layer
+    vector<vector<int> > tileCells(nTileRows * nTileCols);
+    for (int i = 0; i < m_nCells; i++) {
+        T value = m_is2DRaster ? m_raster2DData[i][0] : m_rasterData[i];
+        if (positions == NULL && FloatEqual(value, m_noDataValue)) continue;
+        int row = positions == NULL ? i / nCols : positions[i][0];
+        int col = positions == NULL ? i % nCols : positions[i][1];
+        tileCells[(row / tileSize) * nTileCols + col / tileSize].push_back(i);
+    }
+    /// 2. Write the full-sized tile of each layer, the tiles without valid cells are omitted
+    GDALDataType bufType = GDALDataTypeOf<BufT>::value;
+    int outSize = GDALGetDataTypeSize(outType) / 8;
+    double outNoData = this->_output_nodata(outType);
+    bool remap = !FloatEqual(outNoData, m_headers[HEADER_RS_NODATA]);
+    BufT noDataValue = (BufT) outNoData;
+    BufT *tile = NULL;
+    unsigned char *converted = NULL;
+    Initialize1DArray(tileSize * tileSize, tile, noDataValue);
+    if (outType != bufType) Initialize1DArray(tileSize * tileSize * outSize, converted, 0);
+    vector<int32_t> counts(tileCells.size(), 0);
+    /// the tiles are named by the id of this write, so the tiles of the existing blob are intact
+    string version = GetBlobWriteId();
+    vector<string> written;
+    bool succeed = true;
+    for (size_t t = 0; t < tileCells.size() && succeed; t++) {
+        if (tileCells[t].empty()) continue;
+        int tileRow = int(t) / nTileCols;
+        int tileCol = int(t) % nTileCols;
+        int row0 = tileRow * tileSize;
+        int col0 = tileCol * tileSize;
+        int tileRows = min(tileSize, nRows - row0);
+        int tileCols = min(tileSize, nCols - col0);
+        for (int lyr = 1; lyr <= nLyrs && succeed; lyr++) {
+            for (int i = 0; i < tileRows * tileCols; i++) tile[i] = noDataValue;
+            for (size_t j = 0; j < tileCells[t].size(); j++) {
+                int cell = tileCells[t][j];
+                int row = positions == NULL ? cell / nCols : positions[cell][0];
+                int col = positions == NULL ? cell % nCols : positions[cell][1];
+                tile[(row - row0) * tileCols + col - col0] =
+                    this->_output_value(m_is2DRaster ? m_raster2DData[cell][lyr - 1] : m_rasterData[cell],
+                                        remap, noDataValue);
+            }
+            BlobMetadata p;
+            p.setNumber(HEADER_RS_TILEROW, tileRow);
+            p.setNumber(HEADER_RS_TILECOL, tileCol);
+            p.setNumber(HEADER_RS_TILELAYER, lyr);
+            p.setNumber(HEADER_RS_NROWS, tileRows);
+            p.setNumber(HEADER_RS_NCOLS, tileCols);
+            p.setString(HEADER_RS_DATATYPE, GDALGetDataTypeName(outType));
+            written.push_back(GetRasterTileName(filename, tileRow, tileCol, lyr, version));
+            clsBlobWriter writer(store, written.back(), p);
+            if (level > 0) writer.enableCompression(level, outSize);
+            if (converted == NULL) {
+                succeed = writer.write(tile, (size_t) tileRows * tileCols * sizeof(BufT));
+            } else {
+                GDALCopyWords(tile, bufType, sizeof(BufT), converted, outType, outSize, tileRows * tileCols);
+                succeed = writer.write(converted, (size_t) tileRows * tileCols * outSize);
+            }
+            succeed = writer.close() && succeed;
+        }
+        counts[t] = (int32_t) tileCells[t].size();
+    }
+    Release1DArray(tile);
+    if (converted != NULL) Release1DArray(converted);
+    /// 3. Write the tile index with the header information as metadata
+    if (succeed) {
+        BlobMetadata p;
+        this->_append_blob_metadata(p, outType);
+        p.setString(HEADER_RS_LAYOUT, BLOB_LAYOUT_TILED);
+        p.setNumber(HEADER_RS_TILESIZE, tileSize);
+        p.setNumber(HEADER_RS_NTILEROWS, nTileRows);
+        p.setNumber(HEADER_RS_NTILECOLS, nTileCols);
+        p.setString(HEADER_RS_TILEVERSION, version);
+        clsBlobWriter writer(store, filename, p);
+        succeed = writer.write(&counts[0], counts.size() * sizeof(int32_t));
+        succeed = writer.close() && succeed;
+    }
+    /// the tiles of the failed write are never referenced
+    if (!succeed) {
+        for (size_t i = 0; i < written.size(); i++) store->remove(written[i]);
+    }
+    return succeed;
+}
+
+template<typename T, typename MaskT>
+double clsRasterData<T, MaskT>::_output_nodata(GDALDataType outType) const {
+    map<string, double>::const_iterator iter = m_headers.find(HEADER_RS_NODATA);
+    double noData = iter == m_headers.end() ? (double) m_noDataValue : iter->second;
+    return GDALRepresentableNoData(noData, outType, GDALDataTypeOf<T>::value);
+}
+
+template<typename T, typename MaskT>
+void clsRasterData<T, MaskT>::_append_blob_metadata(BlobMetadata &meta, GDALDataType dataType) {
+    map<string, double> header = m_headers;
+    /// the layer number of the stored data, which is not updated in the header of 2D raster
+    header[HEADER_RS_LAYERS] = m_is2DRaster ? m_nLyrs : 1;
+    header[HEADER_RS_NODATA] = this->_output_nodata(dataType);
     for (map<string, double>::iterator iter = header.begin(); iter != header.end(); iter++){
-        BSON_APPEND_DOUBLE(&p, iter->first.c_str(), iter->second);
+        meta.setNumber(iter->first, iter->second);
     }
-    BSON_APPEND_UTF8(&p, HEADER_RS_SRS, srs.c_str());
-    char* buf = (char* )values;
-    size_t buflength = datalength * sizeof(T);
-    gfs->writeStreamData(filename, buf, buflength, &p);
-    bson_destroy(&p);
+    meta.setString(HEADER_RS_SRS, m_srs);
+    meta.setString(HEADER_RS_DATATYPE, GDALGetDataTypeName(dataType));
+}
+
+#ifdef USE_MONGODB
+template<typename T, typename MaskT>
+bool clsRasterData<T, MaskT>::outputToMongoDB(string filename, MongoGridFS* gfs,
+                                              GDALDataType dataType /* = GDT_Unknown */){
+    BlobWriteOptions options;
+    options.dataType = dataType;
+    return this->outputToMongoDB(filename, gfs, options);
+}
+
+template<typename T, typename MaskT>
+bool clsRasterData<T, MaskT>::outputToMongoDB(string filename, MongoGridFS* gfs, const BlobWriteOptions &options){
+    clsGridFSBlobStore store(gfs);
+    return this->outputToBlobStore(filename, &store, options);
 }
 #endif /* USE_MONGODB */
 
@@ -842,8 +1566,14 @@ template<typename T, typename MaskT>
 void clsRasterData<T, MaskT>::ReadFromFile(string filename, bool calcPositions /* = true */,
                                            clsRasterData<MaskT> *mask /* = NULL */, bool useMaskExtent /* = true */,
                                            T defalutValue /* = (T) NODATA_VALUE */) {
+    /// the raster being read is not evicted or measured by other threads, \sa clsRasterManager
+    lock_guard<recursive_mutex> lock(m_materializeMutex);
     this->_check_raster_file_exists(filename);
     this->_initialize_raster_class();
+    if (StringMatch(GetUpper(GetSuffix(filename)), NativeExtension)) {
+        this->ReadNativeFile(filename, mask, defalutValue);
+        return;
+    }
     this->_construct_from_single_file(filename, calcPositions, mask, useMaskExtent, defalutValue);
 }
 
@@ -851,87 +1581,793 @@ template<typename T, typename MaskT>
 void clsRasterData<T, MaskT>::ReadASCFile(string filename, bool calcPositions /* = true */,
                                           clsRasterData<MaskT> *mask /* = NULL */, bool useMaskExtent /* = true */,
                                           T defalutValue /* = (T) NODATA_VALUE */) {
+    lock_guard<recursive_mutex> lock(m_materializeMutex);
     this->_initialize_read_function(filename, calcPositions, mask, useMaskExtent, defalutValue);
     this->_read_asc_file(m_filePathName, &m_headers, &m_rasterData);
     m_srs = "";
+    m_contentHash = this->_calculate_content_hash();
     this->_mask_and_calculate_valid_positions();
+    clsRasterManager::enforceBudget(this);
 }
 
 template<typename T, typename MaskT>
 void clsRasterData<T, MaskT>::ReadByGDAL(string filename, bool calcPositions /* = true */,
                                          clsRasterData<MaskT> *mask /* = NULL */, bool useMaskExtent /* = true */,
                                          T defalutValue /* = (T) NODATA_VALUE */) {
+    lock_guard<recursive_mutex> lock(m_materializeMutex);
     this->_initialize_read_function(filename, calcPositions, mask, useMaskExtent, defalutValue);
     this->_read_raster_file_by_gdal(m_filePathName, &m_headers, &m_rasterData, &m_srs);
+    m_contentHash = this->_calculate_content_hash();
+    this->_mask_and_calculate_valid_positions();
+    clsRasterManager::enforceBudget(this);
+}
+
+template<typename T, typename MaskT>
+bool clsRasterData<T, MaskT>::ReadNativeFile(string filename, clsRasterData<MaskT> *mask /* = NULL */,
+                                             T defalutValue /* = (T) NODATA_VALUE */) {
+    lock_guard<recursive_mutex> lock(m_materializeMutex);
+    this->_initialize_read_function(filename, true, mask, true, defalutValue);
+    /// 1. map the whole file and check the header
+    return this->_attach_native_layout(new clsMemoryMap(filename), "The file " + filename, true);
+}
+
+template<typename T, typename MaskT>
+bool clsRasterData<T, MaskT>::ReadFromSharedMemory(string name, clsRasterData<MaskT> *mask /* = NULL */,
+                                                   T defalutValue /* = (T) NODATA_VALUE */) {
+    lock_guard<recursive_mutex> lock(m_materializeMutex);
+    this->_initialize_read_function(name, true, mask, true, defalutValue);
+    clsMemoryMap *mapped = clsMemoryMap::openShared(name);
+    if (mapped == NULL) return false;
+    /// the size of shared memory may be rounded up to pages, e.g., on Windows
+    return this->_attach_native_layout(mapped, "The shared memory " + name, false);
+}
+
+template<typename T, typename MaskT>
+bool clsRasterData<T, MaskT>::_attach_native_layout(clsMemoryMap *mapped, const string &source, bool exactSize) {
+    const NativeRasterHeader *header = (const NativeRasterHeader *) mapped->data();
+    string error = "";
+    if (!mapped->isMapped() || mapped->size() < sizeof(NativeRasterHeader) ||
+        strncmp(header->magic, NATIVE_RS_MAGIC, sizeof(header->magic)) != 0) {
+        error = "is not a native raster file";
+    } else if (header->version != NATIVE_RS_VERSION) {
+        error = "has an unsupported version";
+    } else if (header->fileSize > (int64_t) mapped->size() ||
+        (exactSize && header->fileSize != (int64_t) mapped->size())) {
+        error = "is truncated";
+    } else if (header->typeSize != (int32_t) sizeof(T) || header->dataType != GDALDataTypeOf<T>::value) {
+        error = "has a different data type";
+    } else {
+        error = _check_native_sections(*header, (int64_t) mapped->size());
+    }
+    if (error.empty() && header->positionsOffset > 0) {
+        const int32_t *positions = (const int32_t *) (mapped->data() + header->positionsOffset);
+        for (int i = 0; i < header->nCells; i++) {
+            if (positions[2 * i] < 0 || positions[2 * i] >= header->nRows ||
+                positions[2 * i + 1] < 0 || positions[2 * i + 1] >= header->nCols) {
+                error = "has positions out of the extent";
+                break;
+            }
+        }
+    }
+    if (!error.empty()) {
+        cout << source + " " + error + "!" << endl;
+        delete mapped;
+        return false;
+    }
+    m_mappedFile = mapped;
+    char *base = mapped->data();
+    /// 2. headers and SRS
+    this->_copy_native_header(*header);
+    m_srs = string(base + header->srsOffset, (size_t) header->srsLength);
+    /// 3. raster data in place
+    T *data = (T *) (base + header->dataOffset);
+    if (m_is2DRaster) {
+        m_raster2DData = new T *[m_nCells];
+#pragma omp parallel for
+        for (int i = 0; i < m_nCells; i++) {
+            m_raster2DData[i] = data + (size_t) i * m_nLyrs;
+        }
+    } else {
+        m_rasterData = data;
+    }
+    /// 4. positions of valid cells, shared with mask if possible
+    if (header->positionsOffset > 0) {
+        int32_t *positions = (int32_t *) (base + header->positionsOffset);
+        m_calcPositions = true;
+        if (this->_is_same_as_mask_positions(positions)) {
+            m_rasterPositionData = m_mask->getRasterPositionDataPointer();
+            m_storePositions = false;
+        } else {
+            m_rasterPositionData = new int *[m_nCells];
+#pragma omp parallel for
+            for (int i = 0; i < m_nCells; i++) {
+                m_rasterPositionData[i] = positions + 2 * (size_t) i;
+            }
+            m_storePositions = true;
+            m_useMaskExtent = false;
+        }
+    } else {
+        m_calcPositions = false;
+        m_useMaskExtent = false;
+    }
+    /// 5. statistics
+    if (header->hasStatistics) {
+        const double *stats = (const double *) (base + header->statsOffset);
+        const char *statsnames[6] = {STATS_RS_VALIDNUM, STATS_RS_MEAN, STATS_RS_MAX, STATS_RS_MIN,
+                                     STATS_RS_STD, STATS_RS_RANGE};
+        for (int i = 0; i < 6; i++) {
+            if (m_is2DRaster) {
+                double *lyrstats = NULL;
+                Initialize1DArray(m_nLyrs, lyrstats, stats + i * m_nLyrs);
+                m_statsMap2D[statsnames[i]] = lyrstats;
+            } else {
+                m_statsMap[statsnames[i]] = stats[i];
+            }
+        }
+        m_statisticsCalculated = true;
+    }
+    return true;
+}
+
+template<typename T, typename MaskT>
+bool clsRasterData<T, MaskT>::_is_same_as_mask_positions(const int32_t *positions) {
+    if (m_mask == NULL || m_mask->getCellNumber() != m_nCells ||
+        m_mask->getRasterPositionDataPointer() == NULL || m_mask->getOrderFromRowMajor() != NULL) {
+        return false;
+    }
+    int **maskPositions = m_mask->getRasterPositionDataPointer();
+    for (int i = 0; i < m_nCells; i++) {
+        if (maskPositions[i][0] != positions[2 * i] || maskPositions[i][1] != positions[2 * i + 1]) return false;
+    }
+    return true;
+}
+
+template<typename T, typename MaskT>
+string clsRasterData<T, MaskT>::_check_native_sections(const NativeRasterHeader &header, int64_t size) {
+    if (header.nRows <= 0 || header.nCols <= 0 || header.nLyrs <= 0 || header.nCells < 0 ||
+        (int64_t) header.nCells > (int64_t) header.nRows * header.nCols || header.nRuns < 0 ||
+        (header.positionsOffset == 0 && (int64_t) header.nCells != (int64_t) header.nRows * header.nCols)) {
+        return "has invalid sizes";
+    }
+    /// i.e., offset + count * elemSize <= size, without overflow
+    int64_t sections[5][3] = {{header.srsOffset, header.srsLength, 1},
+                              {header.runsOffset, (int64_t) header.nRuns * 3, sizeof(int32_t)},
+                              {header.positionsOffset, (int64_t) header.nCells * 2, sizeof(int32_t)},
+                              {header.statsOffset, (int64_t) header.nLyrs * 6, sizeof(double)},
+                              {header.dataOffset, (int64_t) header.nCells * header.nLyrs, sizeof(T)}};
+    for (int i = 0; i < 5; i++) {
+        int64_t offset = sections[i][0];
+        int64_t count = sections[i][1];
+        if ((i == 1 || i == 2) && offset == 0) continue;  /// the full grid is stored
+        if (i == 3 && !header.hasStatistics) continue;
+        if (offset < 0 || count < 0 || offset > size || count > (size - offset) / sections[i][2]) {
+            return "has sections out of the size";
+        }
+    }
+    return "";
+}
+
+template<typename T, typename MaskT>
+void clsRasterData<T, MaskT>::_copy_native_header(const NativeRasterHeader &header) {
+    m_nCells = header.nCells;
+    m_nLyrs = header.nLyrs;
+    m_is2DRaster = header.is2DRaster != 0;
+    m_headers[HEADER_RS_NROWS] = header.nRows;
+    m_headers[HEADER_RS_NCOLS] = header.nCols;
+    m_headers[HEADER_RS_XLL] = header.xll;
+    m_headers[HEADER_RS_YLL] = header.yll;
+    m_headers[HEADER_RS_CELLSIZE] = header.cellSize;
+    m_headers[HEADER_RS_NODATA] = header.noData;
+    m_headers[HEADER_RS_LAYERS] = header.nLyrs;
+    m_headers[HEADER_RS_CELLSNUM] = header.nCells;
+    m_noDataValue = (T) header.noData;
+}
+
+template<typename T, typename MaskT>
+bool clsRasterData<T, MaskT>::ReadHeaderOnly(string filename, bool calcPositions /* = true */,
+                                             clsRasterData<MaskT> *mask /* = NULL */,
+                                             bool useMaskExtent /* = true */,
+                                             T defalutValue /* = (T) NODATA_VALUE */) {
+    lock_guard<recursive_mutex> lock(m_materializeMutex);
+    if (!this->_check_raster_file_exists(filename)) return false;
+    this->_initialize_raster_class();
+    this->_initialize_read_function(filename, calcPositions, mask, useMaskExtent, defalutValue);
+    string suffix = GetUpper(GetSuffix(filename));
+    if (StringMatch(suffix, NativeExtension)) {
+        /// the file is mapped on materialization, only the fixed-size header and SRS are read here
+        NativeRasterHeader header;
+        ifstream nativefile(filename.c_str(), ios::in | ios::binary);
+        nativefile.read((char *) &header, sizeof(header));
+        if (!nativefile.good() || strncmp(header.magic, NATIVE_RS_MAGIC, sizeof(header.magic)) != 0 ||
+            header.version != NATIVE_RS_VERSION) {
+            cout << "The file " + filename + " is not a supported native raster file!" << endl;
+            return false;
+        }
+        nativefile.seekg(0, ios::end);
+        string error = _check_native_sections(header, (int64_t) nativefile.tellg());
+        if (!error.empty()) {
+            cout << "The file " + filename + " " + error + "!" << endl;
+            return false;
+        }
+        this->_copy_native_header(header);
+        m_srs.assign((size_t) header.srsLength, '\0');
+        nativefile.seekg(header.srsOffset);
+        if (header.srsLength > 0) nativefile.read(&m_srs[0], header.srsLength);
+    } else {
+        if (StringMatch(suffix, ASCIIExtension)) {
+            this->_read_asc_file(m_filePathName, &m_headers, NULL);
+            m_srs = "";
+        } else {
+            this->_read_raster_file_by_gdal(m_filePathName, &m_headers, NULL, &m_srs);
+        }
+        if (m_headers.empty()) return false;
+        /// the same as the header after masked, \sa _mask_and_calculate_valid_positions()
+        if (m_mask != NULL && m_useMaskExtent) {
+            this->copyHeader(m_mask->getRasterHeader());
+            m_headers.at(HEADER_RS_NODATA) = m_noDataValue;
+            m_srs = string(m_mask->getSRS());
+        }
+    }
+    m_lazyPending.store(true, memory_order_release);
+    return true;
+}
+
+template<typename T, typename MaskT>
+void clsRasterData<T, MaskT>::_materialize_data(void) {
+    lock_guard<recursive_mutex> lock(m_materializeMutex);
+    /// another thread may have read the data while waiting for the lock,
+    /// and the reading thread itself may access the raster during reading.
+    if (!m_lazyPending.load(memory_order_acquire) || m_materializing) return;
+    m_materializing = true;
+    if (!m_spillFile.empty()) {
+        this->_read_spill_file();
+    } else if (StringMatch(GetUpper(GetSuffix(m_filePathName)), NativeExtension)) {
+        if (!this->ReadNativeFile(m_filePathName, m_mask, m_defaultValue)) m_nCells = -1;
+    } else {
+        this->_construct_from_single_file(m_filePathName, m_calcPositions, m_mask, m_useMaskExtent, m_defaultValue);
+    }
+    m_materializing = false;
+    m_lazyPending.store(false, memory_order_release);
+}
+
+template<typename T, typename MaskT>
+void clsRasterData<T, MaskT>::ReadFromBlobStore(clsRasterBlobStore* store, string filename,
+    bool calcPositions /* = true */, clsRasterData<MaskT> *mask /* = NULL */, bool useMaskExtent /* = true */,
+    T defalutValue /* = (T) NODATA_VALUE */){
+    lock_guard<recursive_mutex> lock(m_materializeMutex);
+    this->_initialize_read_function(filename, calcPositions, mask, useMaskExtent, defalutValue);
+    /// 1. Open blob
+    clsBlobReader reader(store, filename);
+    if (!reader.isOpen()) return;
+    /// 2. Load the decoded raster from node-local cache if the stored content is not changed
+    uint64_t cachekey = this->_blob_cache_key(reader.identity());
+    if (cachekey != 0) {
+        if (this->_load_blob_cache(cachekey)) return;
+        this->_initialize_read_function(filename, calcPositions, mask, useMaskExtent, defalutValue);
+    }
+    /// 3. Decode the blob, and cache it in the native binary format
+    if (!this->_read_blob(store, filename, reader)) {
+        /// the partially read data is released, i.e., the same as an unopened blob
+        this->_release_storage();
+        m_nCells = -1;
+        return;
+    }
+    clsRasterManager::enforceBudget(this);
+    if (cachekey == 0) return;
+    int **positions = NULL;
+    if (!this->_get_stored_positions(&positions)) return;
+    string tmpfilename = clsRasterBlobCache::getTemporaryFileName(cachekey);
+    if (this->outputNativeFile(tmpfilename)) {
+        clsRasterBlobCache::commit(tmpfilename, cachekey);
+    } else {
+        DeleteExistedFile(tmpfilename);
+    }
+}
+
+template<typename T, typename MaskT>
+bool clsRasterData<T, MaskT>::_read_blob(clsRasterBlobStore *store, const string &filename, clsBlobReader &reader) {
+    /// 1. Get metadata
+    const BlobMetadata &meta = reader.metadata();
+    /// 2. Retrieve raster header values
+    GDALDataType srcType;
+    if (!this->_read_blob_header(meta, filename, srcType)) return false;
+    int nRows = (int) m_headers[HEADER_RS_NROWS];
+    int nCols = (int) m_headers[HEADER_RS_NCOLS];
+    T nodatavalue = m_noDataValue;
+    int valueSize = GDALGetDataTypeSize(srcType) / 8;
+    bool succeed;
+    string layout = meta.getString(HEADER_RS_LAYOUT);
+    if (layout == BLOB_LAYOUT_VALID) {
+        /// 3. Valid cells only, rebuild the positions from row runs and read the values in place.
+        succeed = this->_read_blob_valid_cells(reader, meta, srcType);
+        if (!succeed) cout << "The raster " + filename + " is corrupted!" << endl;
+        return succeed;
+    }
+    if (layout == BLOB_LAYOUT_TILED) {
+        /// 3. Tiles, only the tiles containing the valid cells of mask are read if mask is provided
+        succeed = this->_read_blob_tiles(store, filename, reader, srcType, 0, 0, nRows, nCols, m_mask != NULL);
+        if (!succeed) {
+            cout << "The tiles of raster " + filename + " are corrupted!" << endl;
+            return false;
+        }
+        this->_mask_and_calculate_valid_positions();
+        return true;
+    }
+    /// The stored cell number is derived from the file length, since CELLSNUM of a masked raster
+    /// is the valid cell number, while the stored data may be full-sized.
+    size_t nValues = reader.length() / valueSize;
+    m_nCells = int(nValues / m_nLyrs);
+
+    /// 3. Store data.
+    bool reBuildData = false;
+    bool consistent = true;
+    /// check data length
+    if (m_nCells != nRows * nCols){
+        if (m_mask == NULL) {
+            cout << "When the stored raster is not full-sized, mask data must be provided!" << endl;
+            return false;
+        }
+        int nValidMaskNumber = m_mask->getCellNumber();
+        if (nValidMaskNumber != m_nCells) {
+            cout << "The cell number must the same between mask and the current raster data." << endl;
+            consistent = false;
+        }
+    }
+    else reBuildData = true;
+    if (m_is2DRaster) Initialize2DArray(m_nCells, m_nLyrs, m_raster2DData, nodatavalue);
+    else Initialize1DArray(m_nCells, m_rasterData, nodatavalue);
+    if (GDALDataTypeOf<T>::value == GDT_Unknown) {
+        succeed = this->template _read_blob_values<double>(reader, srcType, nValues);
+    } else {
+        succeed = this->template _read_blob_values<T>(reader, srcType, nValues);
+    }
+    if (!succeed) {
+        cout << "The raster " + filename + " is truncated!" << endl;
+    }
+    if (reBuildData) this->_mask_and_calculate_valid_positions();
+    return succeed && consistent;
+}
+
+template<typename T, typename MaskT>
+uint64_t clsRasterData<T, MaskT>::_blob_cache_key(const string &identity) {
+    if (!clsRasterBlobCache::isEnabled() || identity.empty()) return 0;
+    /// the decoded raster depends on the stored content, the data type, and the read options
+    uint64_t h = clsRasterIndexCache::hash(identity.data(), identity.size());
+    h = clsRasterIndexCache::hash(m_filePathName.data(), m_filePathName.size(), h);
+    double options[5] = {double(GDALDataTypeOf<T>::value), double(sizeof(T)), m_calcPositions ? 1. : 0.,
+                         m_useMaskExtent ? 1. : 0., double(m_defaultValue)};
+    h = clsRasterIndexCache::hash(options, sizeof(options), h);
+    if (m_mask != NULL) {
+        /// the mask is identified by its content hash, or its header and positions of valid cells
+        uint64_t maskhash = m_mask->getContentHash();
+        if (maskhash == 0) {
+            int **positions = m_mask->getRasterPositionDataPointer();
+            if (positions == NULL) return 0;
+            int nValidMaskNumber = m_mask->getCellNumber();
+            double header[7] = {double(m_mask->getRows()), double(m_mask->getCols()), m_mask->getXllCenter(),
+                                m_mask->getYllCenter(), m_mask->getCellWidth(), double(nValidMaskNumber),
+                                double(m_mask->getCellOrdering())};
+            maskhash = clsRasterIndexCache::hash(header, sizeof(header));
+            for (int i = 0; i < nValidMaskNumber; i++) {
+                maskhash = clsRasterIndexCache::hash(positions[i], 2 * sizeof(int), maskhash);
+            }
+        }
+        h = clsRasterIndexCache::hash(&maskhash, sizeof(maskhash), h);
+    }
+    return h == 0 ? 1 : h;  /// 0 means not cacheable
+}
+
+template<typename T, typename MaskT>
+bool clsRasterData<T, MaskT>::_load_blob_cache(uint64_t cachekey) {
+    /// the shared lock prevents the cached file from being evicted until it is mapped
+    clsRasterBlobCache::ScopedLock lock(false);
+    string cachefile = clsRasterBlobCache::lookup(cachekey);
+    if (cachefile.empty()) return false;
+    string filename = m_filePathName;
+    bool useMaskExtent = m_useMaskExtent;
+    if (!this->ReadNativeFile(cachefile, m_mask, m_defaultValue)) return false;
+    m_filePathName = filename;
+    m_coreFileName = GetCoreFileName(m_filePathName);
+    if (!useMaskExtent) m_useMaskExtent = false;
+    return true;
+}
+
+template<typename T, typename MaskT>
+bool clsRasterData<T, MaskT>::ReadWindowFromBlobStore(clsRasterBlobStore* store, string filename, int row, int col,
+                                                      int nRows, int nCols, bool calcPositions /* = true */,
+                                                      T defalutValue /* = (T) NODATA_VALUE */) {
+    lock_guard<recursive_mutex> lock(m_materializeMutex);
+    this->_initialize_read_function(filename, calcPositions, NULL, false, defalutValue);
+    clsBlobReader reader(store, filename);
+    if (!reader.isOpen()) return false;
+    const BlobMetadata &meta = reader.metadata();
+    GDALDataType srcType;
+    if (!this->_read_blob_header(meta, filename, srcType)) return false;
+    if (meta.getString(HEADER_RS_LAYOUT) != BLOB_LAYOUT_TILED) {
+        cout << "The raster " + filename + " is not tiled, which should be read entirely!" << endl;
+        return false;
+    }
+    /// clip the window by the stored extent
+    int rowEnd = min(row + nRows, this->getRows());
+    int colEnd = min(col + nCols, this->getCols());
+    row = max(row, 0);
+    col = max(col, 0);
+    if (row >= rowEnd || col >= colEnd) {
+        cout << "The window is out of the extent of " + filename + "!" << endl;
+        return false;
+    }
+    if (!this->_read_blob_tiles(store, filename, reader, srcType, row, col, rowEnd - row, colEnd - col, false)) {
+        cout << "The tiles of raster " + filename + " are corrupted!" << endl;
+        return false;
+    }
+    this->_mask_and_calculate_valid_positions();
+    clsRasterManager::enforceBudget(this);
+    return true;
+}
+
+template<typename T, typename MaskT>
+bool clsRasterData<T, MaskT>::_read_blob_header(const BlobMetadata &meta, const string &filename,
+                                                GDALDataType &srcType) {
+    const char* RASTER_HEADERS[8] = {HEADER_RS_NCOLS, HEADER_RS_NROWS, HEADER_RS_XLL, HEADER_RS_YLL, HEADER_RS_CELLSIZE,
+        HEADER_RS_NODATA, HEADER_RS_LAYERS, HEADER_RS_CELLSNUM};
+    for (int i = 0; i < 8; i++){
+        meta.getNumber(RASTER_HEADERS[i], m_headers[RASTER_HEADERS[i]]);
+    }
+    m_srs = meta.getString(HEADER_RS_SRS);
+    m_noDataValue = (T) m_headers[HEADER_RS_NODATA];
+    m_nLyrs = (int) m_headers[HEADER_RS_LAYERS];
+    if (m_nLyrs < 1) m_nLyrs = 1;
+    m_is2DRaster = m_nLyrs > 1;
+    /// The data type is recorded since the DATATYPE metadata is written, and float before that.
+    srcType = GDT_Float32;
+    string dataTypeName = meta.getString(HEADER_RS_DATATYPE);
+    if (!dataTypeName.empty()) srcType = GDALGetDataTypeByName(dataTypeName.c_str());
+    if (srcType == GDT_Unknown || GDALGetDataTypeSize(srcType) < 8) {
+        cout << "The data type " + dataTypeName + " of raster " + filename + " is not supported!" << endl;
+        return false;
+    }
+    return true;
+}
+
+template<typename T, typename MaskT>
+bool clsRasterData<T, MaskT>::_read_blob_tiles(clsRasterBlobStore* store, const string &filename, clsBlobReader &index,
+                                               GDALDataType srcType, int row, int col, int nRows, int nCols,
+                                               bool byMask) {
+    /// 1. Tile index, i.e., the valid cell number of each tile
+    const BlobMetadata &meta = index.metadata();
+    double tileSize = 0., nTileRows = 0., nTileCols = 0.;
+    meta.getNumber(HEADER_RS_TILESIZE, tileSize);
+    meta.getNumber(HEADER_RS_NTILEROWS, nTileRows);
+    meta.getNumber(HEADER_RS_NTILECOLS, nTileCols);
+    int nTiles = int(nTileRows) * int(nTileCols);
+    if (tileSize < 1. || nTiles < 1 || index.length() != nTiles * sizeof(int32_t)) return false;
+    vector<int32_t> counts(nTiles);
+    if (index.read(&counts[0], index.length()) != index.length()) return false;
+    int ts = int(tileSize);
+    /// 2. Tiles containing the valid cells of mask, and the window is shrunk to these cells
+    vector<char> needed(nTiles, byMask ? 0 : 1);
+    if (byMask) {
+        map<string, double> header = m_headers;
+        int rowMin = row + nRows, rowMax = row - 1, colMin = col + nCols, colMax = col - 1;
+        int maskRows = m_mask->getRows();
+        int maskCols = m_mask->getCols();
+        int nMaskCells = m_mask->PositionsCalculated() ? m_mask->getCellNumber() : maskRows * maskCols;
+        int **maskPositions = m_mask->PositionsCalculated() ? m_mask->getRasterPositionDataPointer() : NULL;
+        for (int i = 0; i < nMaskCells; i++) {
+            int maskRow = maskPositions != NULL ? maskPositions[i][0] : i / maskCols;
+            int maskCol = maskPositions != NULL ? maskPositions[i][1] : i % maskCols;
+            if (maskPositions == NULL &&
+                FloatEqual(m_mask->getValue(RowColCoor(maskRow, maskCol)), m_mask->getNoDataValue())) {
+                continue;
+            }
+            XYCoor xy = m_mask->getCoordinateByRowCol(maskRow, maskCol);
+            RowCol pos = this->getPositionByCoordinate(xy.first, xy.second, &header);
+            if (pos.first < row || pos.first >= row + nRows || pos.second < col || pos.second >= col + nCols) {
+                continue;
+            }
+            needed[(pos.first / ts) * int(nTileCols) + pos.second / ts] = 1;
+            rowMin = min(rowMin, pos.first);
+            rowMax = max(rowMax, pos.first);
+            colMin = min(colMin, pos.second);
+            colMax = max(colMax, pos.second);
+        }
+        row = rowMin;
+        col = colMin;
+        nRows = max(0, rowMax - rowMin + 1);
+        nCols = max(0, colMax - colMin + 1);
+    }
+    vector<int> tiles;
+    if (nRows > 0 && nCols > 0) {
+        for (int tileRow = row / ts; tileRow <= (row + nRows - 1) / ts; tileRow++) {
+            for (int tileCol = col / ts; tileCol <= (col + nCols - 1) / ts; tileCol++) {
+                int t = tileRow * int(nTileCols) + tileCol;
+                if (counts[t] > 0 && needed[t]) tiles.push_back(t);
+            }
+        }
+    }
+    /// 3. Header of the window
+    int storedRows = this->getRows();
+    int storedCols = this->getCols();
+    double cellSize = m_headers[HEADER_RS_CELLSIZE];
+    m_headers[HEADER_RS_XLL] += col * cellSize;
+    m_headers[HEADER_RS_YLL] += (m_headers[HEADER_RS_NROWS] - row - nRows) * cellSize;
+    m_headers[HEADER_RS_NROWS] = nRows;
+    m_headers[HEADER_RS_NCOLS] = nCols;
+    m_nCells = nRows * nCols;
+    m_headers[HEADER_RS_CELLSNUM] = m_nCells;
+    if (m_is2DRaster) Initialize2DArray(m_nCells, m_nLyrs, m_raster2DData, m_noDataValue);
+    else Initialize1DArray(m_nCells, m_rasterData, m_noDataValue);
+    /// 4. Fetch and convert the tiles
+    string version = meta.getString(HEADER_RS_TILEVERSION);
+    if (GDALDataTypeOf<T>::value == GDT_Unknown) {
+        return this->template _fetch_blob_tiles<double>(store, filename, version, srcType, tiles, ts,
+                                                        storedRows, storedCols, row, col, nRows, nCols);
+    }
+    return this->template _fetch_blob_tiles<T>(store, filename, version, srcType, tiles, ts,
+                                               storedRows, storedCols, row, col, nRows, nCols);
+}
+
+template<typename T, typename MaskT>
+template<typename BufT>
+bool clsRasterData<T, MaskT>::_fetch_blob_tiles(clsRasterBlobStore* store, const string &filename,
+                                                const string &version, GDALDataType srcType,
+                                                const vector<int> &tiles, int tileSize, int storedRows,
+                                                int storedCols, int row, int col, int nRows, int nCols) {
+    int nLyrs = m_is2DRaster ? m_nLyrs : 1;
+    int nTileCols = (storedCols + tileSize - 1) / tileSize;
+    int valueSize = GDALGetDataTypeSize(srcType) / 8;
+    int nItems = int(tiles.size()) * nLyrs;
+    /// 1. One store per thread, since the store may not be shared by threads, e.g., a MongoDB client
+    vector<clsRasterBlobStore *> stores(1, store);
+#ifdef SUPPORT_OMP
+    /// e.g., BatchReadFromMongoDB() reads the rasters in parallel already
+    int threads = omp_in_parallel() ? 1 : min(omp_get_max_threads(), nItems);
+    for (int i = 1; i < threads; i++) {
+        clsRasterBlobStore *cloned = store->clone();
+        if (cloned == NULL) break;
+        stores.push_back(cloned);
+    }
+#endif /* SUPPORT_OMP */
+    /// 2. Fetch, convert and copy the intersection of each tile and the window in parallel
+    GDALDataType bufType = GDALDataTypeOf<BufT>::value;
+    vector<char> fetched(nItems, 0);
+#pragma omp parallel for num_threads(int(stores.size())) schedule(dynamic)
+    for (int i = 0; i < nItems; i++) {
+        clsRasterBlobStore *local = stores[0];
+#ifdef SUPPORT_OMP
+        local = stores[omp_get_thread_num()];
+#endif /* SUPPORT_OMP */
+        int t = tiles[i / nLyrs];
+        int lyr = i % nLyrs;
+        int row0 = (t / nTileCols) * tileSize;
+        int col0 = (t % nTileCols) * tileSize;
+        int tileCols = min(tileSize, storedCols - col0);
+        int tileRows = min(tileSize, storedRows - row0);
+        size_t tileBytes = (size_t) tileRows * tileCols * valueSize;
+        clsBlobReader reader(local, GetRasterTileName(filename, t / nTileCols, t % nTileCols, lyr + 1, version));
+        if (!reader.isOpen() || reader.length() != tileBytes) continue;
+        vector<unsigned char> payload(tileBytes);
+        if (reader.read(&payload[0], tileBytes) != tileBytes) continue;
+        vector<BufT> values(tileRows * tileCols);
+        GDALCopyWords(&payload[0], srcType, valueSize, &values[0], bufType, sizeof(BufT), tileRows * tileCols);
+        for (int r = max(row0, row); r < min(row0 + tileRows, row + nRows); r++) {
+            for (int c = max(col0, col); c < min(col0 + tileCols, col + nCols); c++) {
+                T value = (T) values[(r - row0) * tileCols + c - col0];
+                int idx = (r - row) * nCols + c - col;
+                if (m_is2DRaster) m_raster2DData[idx][lyr] = value;
+                else m_rasterData[idx] = value;
+            }
+        }
+        fetched[i] = 1;
+    }
+    for (size_t i = 1; i < stores.size(); i++) delete stores[i];
+    return find(fetched.begin(), fetched.end(), 0) == fetched.end();
+}
+
+template<typename T, typename MaskT>
+bool clsRasterData<T, MaskT>::_read_blob_valid_cells(clsBlobReader &reader, const BlobMetadata &meta,
+                                                     GDALDataType srcType) {
+    bool calcPositions = m_calcPositions;
+    /// 1. Row runs of the valid cells
+    double nRuns = -1.;
+    meta.getNumber(HEADER_RS_NRUNS, nRuns);
+    size_t runsBytes = (size_t) nRuns * 3 * sizeof(int32_t);
+    if (nRuns < 0 || runsBytes > reader.length()) return false;
+    vector<int32_t> runs((size_t) nRuns * 3);
+    size_t readBytes = 0;
+    while (readBytes < runsBytes) {
+        size_t n = reader.read((char *) &runs[0] + readBytes, min((size_t) BLOB_PIECE_BYTES, runsBytes - readBytes));
+        if (n == 0) return false;
+        readBytes += n;
+    }
+    int count = this->_build_positions_by_row_runs(runs.data(), int(nRuns));
+    if (count < 0) return false;
+    m_nCells = count;
+    m_headers[HEADER_RS_CELLSNUM] = m_nCells;
+    size_t nValues = (size_t) m_nCells * m_nLyrs;
+    if ((reader.length() - runsBytes) / (GDALGetDataTypeSize(srcType) / 8) != nValues) return false;
+    /// 2. Share the positions of mask if they are the same and in the same grid
+    bool sameAsMask = false;
+    if (m_mask != NULL && this->_is_same_as_mask_positions(m_positionBlock)) {
+        map<string, double> maskHeader = m_mask->getRasterHeader();
+        const char *keys[5] = {HEADER_RS_NROWS, HEADER_RS_NCOLS, HEADER_RS_XLL, HEADER_RS_YLL, HEADER_RS_CELLSIZE};
+        sameAsMask = true;
+        for (int i = 0; i < 5; i++) {
+            if (!FloatEqual(m_headers.at(keys[i]), maskHeader.at(keys[i]))) sameAsMask = false;
+        }
+    }
+    if (sameAsMask) {
+        delete[] m_positionBlock;
+        m_positionBlock = NULL;
+        delete[] m_rasterPositionData;
+        m_rasterPositionData = m_mask->getRasterPositionDataPointer();
+        m_storePositions = false;
+    }
+    /// 3. Values of the valid cells, which are in the same order of positions
+    if (m_is2DRaster) Initialize2DArray(m_nCells, m_nLyrs, m_raster2DData, m_noDataValue);
+    else Initialize1DArray(m_nCells, m_rasterData, m_noDataValue);
+    bool succeed;
+    if (GDALDataTypeOf<T>::value == GDT_Unknown) {
+        succeed = this->template _read_blob_values<double>(reader, srcType, nValues);
+    } else {
+        succeed = this->template _read_blob_values<T>(reader, srcType, nValues);
+    }
+    if (!succeed || m_mask == NULL || sameAsMask) return succeed;
+    /// 4. Otherwise, extract by mask from the full grid, the same as the full-sized layout
+    this->_expand_valid_cells_to_grid();
+    m_calcPositions = calcPositions;
     this->_mask_and_calculate_valid_positions();
+    return true;
+}
+
+template<typename T, typename MaskT>
+void clsRasterData<T, MaskT>::_expand_valid_cells_to_grid(void) {
+    int nCols = this->getCols();
+    int nGridCells = this->getRows() * nCols;
+    if (m_is2DRaster) {
+        T **grid = NULL;
+        Initialize2DArray(nGridCells, m_nLyrs, grid, m_noDataValue);
+#pragma omp parallel for
+        for (int i = 0; i < m_nCells; i++) {
+            int idx = m_rasterPositionData[i][0] * nCols + m_rasterPositionData[i][1];
+            for (int lyr = 0; lyr < m_nLyrs; lyr++) grid[idx][lyr] = m_raster2DData[i][lyr];
+        }
+        Release2DArray(m_nCells, m_raster2DData);
+        m_raster2DData = grid;
+    } else {
+        T *grid = NULL;
+        Initialize1DArray(nGridCells, grid, m_noDataValue);
+#pragma omp parallel for
+        for (int i = 0; i < m_nCells; i++) {
+            grid[m_rasterPositionData[i][0] * nCols + m_rasterPositionData[i][1]] = m_rasterData[i];
+        }
+        Release1DArray(m_rasterData);
+        m_rasterData = grid;
+    }
+    delete[] m_rasterPositionData;
+    m_rasterPositionData = NULL;
+    if (m_positionBlock != NULL) Release1DArray(m_positionBlock);
+    m_storePositions = false;
+    m_nCells = nGridCells;
+    m_headers[HEADER_RS_CELLSNUM] = m_nCells;
+}
+
+template<typename T, typename MaskT>
+template<typename BufT>
+bool clsRasterData<T, MaskT>::_read_blob_values(clsBlobReader &reader, GDALDataType srcType, size_t nValues) {
+    GDALDataType bufType = GDALDataTypeOf<BufT>::value;
+    int valueSize = GDALGetDataTypeSize(srcType) / 8;
+    size_t totalBytes = nValues * valueSize;
+    if (!m_is2DRaster && srcType == GDALDataTypeOf<T>::value) {
+        /// the stored values are adopted by the raster data directly
+        char *dst = (char *) m_rasterData;
+        size_t readBytes = 0;
+        while (readBytes < totalBytes) {
+            size_t n = reader.read(dst + readBytes, min((size_t) BLOB_PIECE_BYTES, totalBytes - readBytes));
+            if (n == 0) break;
+            readBytes += n;
+        }
+        return readBytes == totalBytes;
+    }
+    /// read chunk by chunk, convert, and scatter each value into the raster data
+    size_t chunkValues = BLOB_PIECE_BYTES / valueSize;
+    unsigned char *chunk = NULL;
+    BufT *converted = NULL;
+    Initialize1DArray(int(chunkValues * valueSize), chunk, 0);
+    Initialize1DArray(int(chunkValues), converted, 0);
+    size_t readValues = 0;
+    while (readValues < nValues) {
+        size_t n = reader.read(chunk, min(chunkValues, nValues - readValues) * valueSize) / valueSize;
+        if (n == 0) break;
+        GDALCopyWords(chunk, srcType, valueSize, converted, bufType, sizeof(BufT), int(n));
+        if (m_is2DRaster) {
+#pragma omp parallel for
+            for (int i = 0; i < int(n); i++) {
+                size_t idx = readValues + i;
+                m_raster2DData[idx / m_nLyrs][idx % m_nLyrs] = (T) converted[i];
+            }
+        } else {
+#pragma omp parallel for
+            for (int i = 0; i < int(n); i++) m_rasterData[readValues + i] = (T) converted[i];
+        }
+        readValues += n;
+    }
+    Release1DArray(chunk);
+    Release1DArray(converted);
+    return readValues == nValues;
 }
-
 #ifdef USE_MONGODB
 template<typename T, typename MaskT>
 void clsRasterData<T, MaskT>::ReadFromMongoDB(MongoGridFS* gfs, string filename, bool calcPositions /* = true */,
     clsRasterData<MaskT> *mask /* = NULL */, bool useMaskExtent /* = true */, T defalutValue /* = (T) NODATA_VALUE */){
-    this->_initialize_read_function(filename, calcPositions, mask, useMaskExtent, defalutValue);
-    /// 1. Get stream data and metadata by file name
-    char* buf;
-    size_t length;
-    gfs->getStreamData(filename, buf, length);
-    bson_t *bmeta = gfs->getFileMetadata(filename);
-    /// 2. Retrieve raster header values
-    const char* RASTER_HEADERS[8] = {HEADER_RS_NCOLS, HEADER_RS_NROWS, HEADER_RS_XLL, HEADER_RS_YLL, HEADER_RS_CELLSIZE,
-        HEADER_RS_NODATA, HEADER_RS_LAYERS, HEADER_RS_CELLSNUM};
-    for (int i = 0; i < 8; i++){
-        GetNumericFromBson(bmeta, RASTER_HEADERS[i], m_headers[RASTER_HEADERS[i]]);
-    }
-    m_srs = GetStringFromBson(bmeta, HEADER_RS_SRS);
+    clsGridFSBlobStore store(gfs);
+    this->ReadFromBlobStore(&store, filename, calcPositions, mask, useMaskExtent, defalutValue);
+}
 
-    int nRows = (int) m_headers[HEADER_RS_NROWS];
-    int nCols = (int) m_headers[HEADER_RS_NCOLS];
-    T nodatavalue = (T)m_headers[HEADER_RS_NODATA];
-    m_nLyrs = (int) m_headers[HEADER_RS_LAYERS];
-    if (m_headers.find(HEADER_RS_CELLSNUM) != m_headers.end())
-        m_nCells = (int) m_headers[HEADER_RS_CELLSNUM];
-    /// TODO (by LJ), currently data stored in MongoDB is always float. I can not find a elegant way to make it template.
-    if (m_nCells < 0) {
-        m_nCells = length / sizeof(float) / m_nLyrs;
-    }
+template<typename T, typename MaskT>
+bool clsRasterData<T, MaskT>::ReadWindowFromMongoDB(MongoGridFS* gfs, string filename, int row, int col,
+                                                    int nRows, int nCols, bool calcPositions /* = true */,
+                                                    T defalutValue /* = (T) NODATA_VALUE */) {
+    clsGridFSBlobStore store(gfs);
+    return this->ReadWindowFromBlobStore(&store, filename, row, col, nRows, nCols, calcPositions, defalutValue);
+}
 
-    /// 3. Store data.
-    bool reBuildData = false;
-    /// check data length
-    if (m_nCells != nRows * nCols){
-        if (m_mask == NULL)
-            cout << "When raster stored in MongoDB is not full-sized, mask data must be provided!" << endl;
-        int nValidMaskNumber = m_mask->getCellNumber();
-        if (nValidMaskNumber != m_nCells)
-            cout << "The cell number must the same between mask and the current raster data." << endl;
-    }
-    else reBuildData = true;
-    /// read data directly
-    if (m_nLyrs == 1){
-        float *tmpdata = (float* )buf;
-        Initialize1DArray(m_nCells, m_rasterData, nodatavalue);
-#pragma omp parallel for
-        for (int i = 0; i < m_nCells; i++)
-            m_rasterData[i] = (T) tmpdata[i];
-        Release1DArray(tmpdata);
-        m_is2DRaster = false;
-    }
-    else{
-        float *tmpdata = (float *) buf;
-        m_raster2DData = new T *[m_nCells];
-        for (int i = 0; i < m_nCells; i++){
-            m_raster2DData[i] = new T [m_nLyrs];
-            for (int j = 0; j < m_nLyrs; j++){
-                int idx = i * m_nLyrs + j;
-                m_raster2DData[i][j] = (T) tmpdata[idx];
+template<typename T, typename MaskT>
+map<string, clsRasterData<T, MaskT> *> clsRasterData<T, MaskT>::BatchReadFromMongoDB(
+    mongoc_client_pool_t *pool, const string &dbName, const string &gfsName, const vector<string> &filenames,
+    clsRasterData<MaskT> *mask /* = NULL */, bool calcPositions /* = true */, bool useMaskExtent /* = true */,
+    T defalutValue /* = (T) NODATA_VALUE */, int nThreads /* = 0 */) {
+    map<string, clsRasterData<T, MaskT> *> rasters;
+    int nFiles = (int) filenames.size();
+    if (pool == NULL || nFiles == 0) return rasters;
+    /// the lazy mask is read before shared by threads, and kept in memory while the rasters are masked
+    if (mask != NULL) {
+        mask->getCellNumber();
+        mask->pin();
+    }
+    int threads = nThreads > 0 ? nThreads : 1;
+#ifdef SUPPORT_OMP
+    if (nThreads <= 0) threads = omp_get_max_threads();
+#endif /* SUPPORT_OMP */
+    threads = min(threads, nFiles);
+    vector<clsRasterData<T, MaskT> *> loaded(nFiles, (clsRasterData<T, MaskT> *) NULL);
+#pragma omp parallel num_threads(threads)
+    {
+        /// one client and GridFS per thread, since a client should not be shared by threads
+        mongoc_client_t *client = mongoc_client_pool_pop(pool);
+        bson_error_t err;
+        mongoc_gridfs_t *gridfs = mongoc_client_get_gridfs(client, dbName.c_str(), gfsName.c_str(), &err);
+        MongoGridFS *gfs = gridfs == NULL ? NULL : new MongoGridFS(gridfs);
+#pragma omp for schedule(dynamic)
+        for (int i = 0; i < nFiles; i++) {
+            if (gfs == NULL) continue;
+            /// pinned before read, so that the rasters read are not evicted by the reading of the others
+            clsRasterData<T, MaskT> *raster = new clsRasterData<T, MaskT>();
+            raster->pin();
+            raster->ReadFromMongoDB(gfs, filenames[i], calcPositions, mask, useMaskExtent, defalutValue);
+            /// the data of a missing or corrupted blob is released, \sa ReadFromBlobStore()
+            if (raster->getCellNumber() < 0) {
+                delete raster;
+                raster = NULL;
             }
+            loaded[i] = raster;
         }
-        m_is2DRaster = true;
-        Release1DArray(tmpdata);
+        if (gfs != NULL) delete gfs;
+        mongoc_client_pool_push(pool, client);
     }
-    buf = NULL;
-    if (reBuildData) this->_mask_and_calculate_valid_positions();
+    for (int i = 0; i < nFiles; i++) {
+        if (loaded[i] == NULL) {
+            cout << "Read raster " + filenames[i] + " from GridFS " + dbName + "." + gfsName + " failed!" << endl;
+            continue;
+        }
+        loaded[i]->unpin();
+        rasters[filenames[i]] = loaded[i];
+    }
+    if (mask != NULL) mask->unpin();
+    clsRasterManager::enforceBudget();
+    return rasters;
 }
+
 #endif /* USE_MONGODB */
 
 template<typename T, typename MaskT>
@@ -963,6 +2399,12 @@ void clsRasterData<T, MaskT>::_read_asc_file(string ascFileName, map<string, dou
     
     tmpheader.insert(make_pair(HEADER_RS_LAYERS, 1.));
     tmpheader.insert(make_pair(HEADER_RS_CELLSNUM, -1.));
+    /// read header only, \sa ReadHeaderOnly()
+    if (values == NULL) {
+        rasterFile.close();
+        *header = tmpheader;
+        return;
+    }
     /// get all raster values (i.e., include NODATA_VALUE, m_excludeNODATA = False)
     T *tmprasterdata = new T[rows * cols];
     for (int i = 0; i < rows; ++i) {
@@ -1003,6 +2445,13 @@ void clsRasterData<T, MaskT>::_read_raster_file_by_gdal(string filename, map<str
     tmpheader.insert(make_pair(HEADER_RS_LAYERS, 1.));
     tmpheader.insert(make_pair(HEADER_RS_CELLSNUM, -1.));
     string tmpsrs = string(poDataset->GetProjectionRef());
+    /// read header only, \sa ReadHeaderOnly()
+    if (values == NULL) {
+        GDALClose(poDataset);
+        *header = tmpheader;
+        if (srs != NULL) *srs = tmpsrs;
+        return;
+    }
     /// get all raster values (i.e., include NODATA_VALUE)
     int fullsize_nCells = nRows * nCols;
     if (m_nCells < 0){ /// if m_nCells has been assigned
@@ -1070,7 +2519,7 @@ void clsRasterData<T, MaskT>::_read_raster_file_by_gdal(string filename, map<str
     /// returned parameters
     *header = tmpheader;
     *values = tmprasterdata;
-    *srs = tmpsrs;
+    if (srs != NULL) *srs = tmpsrs;
 }
 
 template<typename T, typename MaskT>
@@ -1089,18 +2538,17 @@ void clsRasterData<T, MaskT>::_add_other_layer_raster_data(int row, int col, int
 
 template<typename T, typename MaskT>
 void clsRasterData<T, MaskT>::Copy(const clsRasterData<T, MaskT> &orgraster) {
-    if (m_is2DRaster && m_raster2DData != NULL && m_nCells > 0) {
-        Release2DArray(m_nCells, m_raster2DData);
-    }
-    if (!m_is2DRaster && m_rasterData != NULL) {
-        Release1DArray(m_rasterData);
-    }
-    if (m_rasterPositionData != NULL) {
-        Release2DArray(2, m_rasterPositionData);
-    }
+    lock_guard<recursive_mutex> lock(m_materializeMutex);
+    orgraster._materialize();
+    this->_release_storage();
+    if (m_sharedMemory != NULL) delete m_sharedMemory;
     if (m_statisticsCalculated) {
         releaseStatsMap2D();
     }
+    this->releaseNeighborIndex();
+    if (m_toRowMajor != NULL) Release1DArray(m_toRowMajor);
+    if (m_fromRowMajor != NULL) Release1DArray(m_fromRowMajor);
+    this->_release_derived_data();
     _initialize_raster_class();
     m_filePathName = orgraster.getFilePath();
     m_coreFileName = orgraster.getCoreName();
@@ -1119,6 +2567,11 @@ void clsRasterData<T, MaskT>::Copy(const clsRasterData<T, MaskT> &orgraster) {
     if (m_calcPositions) {
         m_storePositions = true;
         Initialize2DArray(m_nCells, 2, m_rasterPositionData, orgraster.getRasterPositionDataPointer());
+        m_cellOrdering = orgraster.getCellOrdering();
+        if (orgraster.getOrderToRowMajor() != NULL) {
+            Initialize1DArray(m_nCells, m_toRowMajor, orgraster.getOrderToRowMajor());
+            Initialize1DArray(m_nCells, m_fromRowMajor, orgraster.getOrderFromRowMajor());
+        }
     }
     m_useMaskExtent = orgraster.MaskExtented();
     m_statisticsCalculated = orgraster.StatisticsCalculated();
@@ -1129,10 +2582,13 @@ void clsRasterData<T, MaskT>::Copy(const clsRasterData<T, MaskT> &orgraster) {
         }
     }
     this->copyHeader(orgraster.getRasterHeader());
+    clsRasterManager::enforceBudget(this);
 }
 
 template<typename T, typename MaskT>
 void clsRasterData<T, MaskT>::replaceNoData(T replacedv) {
+    this->_materialize();
+    this->_release_derived_data();
     if (m_is2DRaster && m_raster2DData != NULL) {
 #pragma omp parallel for
         for (int i = 0; i < m_nCells; i++) {
@@ -1154,6 +2610,8 @@ void clsRasterData<T, MaskT>::replaceNoData(T replacedv) {
 
 template<typename T, typename MaskT>
 void clsRasterData<T, MaskT>::reclassify(map<int, T> reclassMap) {
+    this->_materialize();
+    this->_release_derived_data();
     if (m_is2DRaster && m_raster2DData != NULL) {
 #pragma omp parallel for
         for (int i = 0; i < m_nCells; i++) {
@@ -1179,6 +2637,552 @@ void clsRasterData<T, MaskT>::reclassify(map<int, T> reclassMap) {
     }
 }
 
+/************* Window query functions ***************/
+
+template<typename T, typename MaskT>
+void clsRasterData<T, MaskT>::_release_derived_data(void) {
+    this->releaseSummedAreaTables();
+    this->releaseMinMaxPyramids();
+}
+
+template<typename T, typename MaskT>
+void clsRasterData<T, MaskT>::_release_storage(void) {
+    /// data and positions may point into the mapped file, then only the pointer arrays are allocated
+    if (m_rasterData != NULL) {
+        if (m_mappedFile != NULL && m_mappedFile->contains(m_rasterData)) m_rasterData = NULL;
+        else Release1DArray(m_rasterData);
+    }
+    if (m_raster2DData != NULL && m_is2DRaster) {
+        if (m_mappedFile != NULL && m_nCells > 0 && m_mappedFile->contains(m_raster2DData[0])) {
+            delete[] m_raster2DData;
+            m_raster2DData = NULL;
+        } else { Release2DArray(m_nCells, m_raster2DData); }
+    }
+    if (m_rasterPositionData != NULL && m_storePositions) {
+        if (m_positionBlock != NULL ||
+            (m_mappedFile != NULL && m_nCells > 0 && m_mappedFile->contains(m_rasterPositionData[0]))) {
+            delete[] m_rasterPositionData;
+        } else { Release2DArray(m_nCells, m_rasterPositionData); }
+    }
+    m_rasterPositionData = NULL;
+    if (m_positionBlock != NULL) Release1DArray(m_positionBlock);
+    if (m_mappedFile != NULL) {
+        delete m_mappedFile;
+        m_mappedFile = NULL;
+    }
+    /// the evicted data has been released
+    if (!m_spillFile.empty()) {
+        DeleteExistedFile(m_spillFile);
+        m_spillFile = "";
+    }
+}
+
+template<typename T, typename MaskT>
+bool clsRasterData<T, MaskT>::moveToScratchFile(string directory /* = "" */, bool sequential /* = true */) {
+    lock_guard<recursive_mutex> lock(m_materializeMutex);
+    this->_materialize();
+    if (m_mappedFile != NULL) {
+        cout << "The raster " + m_coreFileName + " is already memory mapped!" << endl;
+        return false;
+    }
+    if (m_nCells <= 0 || (m_rasterData == NULL && m_raster2DData == NULL)) return false;
+    /// layout: data [nCells][nLyrs], positions [nCells][2] aligned as the native format
+    size_t lyrs = m_is2DRaster ? (size_t) m_nLyrs : 1;
+    size_t dataSize = (size_t) m_nCells * lyrs * sizeof(T);
+    size_t positionsOffset = (dataSize + NATIVE_RS_ALIGNMENT - 1) / NATIVE_RS_ALIGNMENT * NATIVE_RS_ALIGNMENT;
+    bool movePositions = m_rasterPositionData != NULL && m_storePositions;
+    size_t scratchSize = movePositions ? positionsOffset + (size_t) m_nCells * 2 * sizeof(int) : dataSize;
+    clsMemoryMap *scratch = new clsMemoryMap(directory, scratchSize);
+    if (!scratch->isMapped()) {
+        delete scratch;
+        return false;
+    }
+    StatusMessage(("Move raster " + m_coreFileName + " to scratch file...").c_str());
+    char *base = scratch->data();
+    /// 1. raster data
+    T *data = (T *) base;
+    if (m_is2DRaster) {
+        /// the pointer array is kept, so that the pointers got by get2DRasterDataPointer() are valid
+#pragma omp parallel for
+        for (int i = 0; i < m_nCells; i++) {
+            memcpy(data + i * lyrs, m_raster2DData[i], lyrs * sizeof(T));
+            delete[] m_raster2DData[i];
+            m_raster2DData[i] = data + i * lyrs;
+        }
+    } else {
+        memcpy(data, m_rasterData, dataSize);
+        Release1DArray(m_rasterData);
+        m_rasterData = data;
+    }
+    /// 2. positions of valid cells, the stored order is kept
+    if (movePositions) {
+        /// the pointer array is kept too, which may be shared by other rasters masked by this one
+        int *positions = (int *) (base + positionsOffset);
+        bool rowAllocated = m_positionBlock == NULL;
+#pragma omp parallel for
+        for (int i = 0; i < m_nCells; i++) {
+            positions[2 * i] = m_rasterPositionData[i][0];
+            positions[2 * i + 1] = m_rasterPositionData[i][1];
+            if (rowAllocated) delete[] m_rasterPositionData[i];
+            m_rasterPositionData[i] = positions + 2 * (size_t) i;
+        }
+        if (!rowAllocated) Release1DArray(m_positionBlock);
+    }
+    m_mappedFile = scratch;
+    m_mappedFile->advise(sequential);
+    return true;
+}
+
+template<typename T, typename MaskT>
+int64_t clsRasterData<T, MaskT>::getFootprint(void) const {
+    /// the raster being read or evicted by another thread is measured last time
+    unique_lock<recursive_mutex> lock(m_materializeMutex, try_to_lock);
+    if (!lock.owns_lock()) return this->_get_last_footprint();
+    if (m_nCells <= 0) return this->_set_last_footprint(0);
+    int64_t bytes = 0;
+    /// the evicted raster data is not in memory, and the mapped data is paged by the OS,
+    /// while the row pointers of the mapped data and the owned positions are always kept.
+    bool mapped = m_mappedFile != NULL;
+    if (!m_lazyPending.load(memory_order_acquire)) {
+        if (m_is2DRaster && m_raster2DData != NULL) {
+            bytes += (int64_t) m_nCells * ((mapped ? 0 : m_nLyrs * sizeof(T)) + sizeof(T *));
+        } else if (!m_is2DRaster && m_rasterData != NULL && !mapped) {
+            bytes += (int64_t) m_nCells * sizeof(T);
+        }
+    }
+    if (m_rasterPositionData != NULL && m_storePositions) {
+        bytes += (int64_t) m_nCells * ((mapped ? 0 : 2 * sizeof(int)) + sizeof(int *));
+    }
+    return this->_set_last_footprint(bytes);
+}
+
+template<typename T, typename MaskT>
+int64_t clsRasterData<T, MaskT>::evict(void) {
+    /// the raster being read or read back, e.g., by another thread, is skipped
+    unique_lock<recursive_mutex> lock(m_materializeMutex, try_to_lock);
+    if (!lock.owns_lock() || m_materializing || this->isPinned()) return 0;
+    if (m_lazyPending.load(memory_order_acquire) || m_mappedFile != NULL || m_nCells <= 0) return 0;
+    if ((m_is2DRaster && m_raster2DData == NULL) || (!m_is2DRaster && m_rasterData == NULL)) return 0;
+    /// 1. write the raster data in the stored order, i.e., the same as the data section of the native format
+    string spillfile = clsRasterManager::getSpillFileName();
+    StatusMessage(("Evict raster " + m_coreFileName + " to spill file...").c_str());
+    ofstream spill(spillfile.c_str(), ios::out | ios::binary | ios::trunc);
+    if (m_is2DRaster) {
+        for (int i = 0; i < m_nCells; i++) {
+            spill.write((const char *) m_raster2DData[i], m_nLyrs * sizeof(T));
+        }
+    } else {
+        spill.write((const char *) m_rasterData, (streamsize) m_nCells * sizeof(T));
+    }
+    bool succeed = spill.good();
+    spill.close();
+    if (!succeed) {
+        cout << "Write spill file " + spillfile + " failed." << endl;
+        DeleteExistedFile(spillfile);
+        return 0;
+    }
+    /// 2. release the raster data, and read it back on the next access
+    int64_t released = 0;
+    if (m_is2DRaster) {
+        released = (int64_t) m_nCells * (m_nLyrs * sizeof(T) + sizeof(T *));
+        Release2DArray(m_nCells, m_raster2DData);
+    } else {
+        released = (int64_t) m_nCells * sizeof(T);
+        Release1DArray(m_rasterData);
+    }
+    m_spillFile = spillfile;
+    m_lazyPending.store(true, memory_order_release);
+    return released;
+}
+
+template<typename T, typename MaskT>
+void clsRasterData<T, MaskT>::_read_spill_file(void) {
+    StatusMessage(("Read raster " + m_coreFileName + " back from spill file...").c_str());
+    ifstream spill(m_spillFile.c_str(), ios::in | ios::binary);
+    if (m_is2DRaster) {
+        Initialize2DArray(m_nCells, m_nLyrs, m_raster2DData, m_noDataValue);
+        for (int i = 0; i < m_nCells && spill.good(); i++) {
+            spill.read((char *) m_raster2DData[i], m_nLyrs * sizeof(T));
+        }
+    } else {
+        Initialize1DArray(m_nCells, m_rasterData, m_noDataValue);
+        spill.read((char *) m_rasterData, (streamsize) m_nCells * sizeof(T));
+    }
+    if (!spill.good()) cout << "Read spill file " + m_spillFile + " failed!" << endl;
+    spill.close();
+    DeleteExistedFile(m_spillFile);
+    m_spillFile = "";
+}
+
+template<typename T, typename MaskT>
+void clsRasterData<T, MaskT>::releaseSummedAreaTables(void) {
+    lock_guard<recursive_mutex> lock(m_materializeMutex);
+    if (m_satSum != NULL) {
+        for (int lyr = 0; lyr < m_nLyrs; lyr++) {
+            if (m_satSum[lyr] != NULL) Release1DArray(m_satSum[lyr]);
+        }
+        delete[] m_satSum;
+        m_satSum = NULL;
+    }
+    if (m_satCount != NULL) {
+        for (int lyr = 0; lyr < m_nLyrs; lyr++) {
+            if (m_satCount[lyr] != NULL) Release1DArray(m_satCount[lyr]);
+        }
+        delete[] m_satCount;
+        m_satCount = NULL;
+    }
+}
+
+template<typename T, typename MaskT>
+bool clsRasterData<T, MaskT>::buildSummedAreaTable(int lyr /* = 1 */) {
+    this->_materialize();
+    if (lyr < 1 || lyr > m_nLyrs) return false;
+    /// the table is built once by the first caller, and the concurrent callers wait for it
+    lock_guard<recursive_mutex> lock(m_materializeMutex);
+    if (m_satSum != NULL && m_satSum[lyr - 1] != NULL) return true;
+    if ((m_is2DRaster && m_raster2DData == NULL) || (!m_is2DRaster && m_rasterData == NULL)) {
+        cout << "Please initialize the raster object first." << endl;
+        return false;
+    }
+    int **positions = NULL;
+    if (!this->_get_stored_positions(&positions)) {
+        cout << "The positions of the stored cells are not available!" << endl;
+        return false;
+    }
+    int nRows = this->getRows();
+    int nCols = this->getCols();
+    int tabCols = nCols + 1;
+    double *sum = NULL;
+    int *count = NULL;
+    Initialize1DArray((nRows + 1) * tabCols, sum, 0.);
+    Initialize1DArray((nRows + 1) * tabCols, count, 0);
+    /// 1. scatter valid values, the first row and column of the tables are zeros
+#pragma omp parallel for
+    for (int i = 0; i < m_nCells; i++) {
+        T v = m_is2DRaster ? m_raster2DData[i][lyr - 1] : m_rasterData[i];
+        if (FloatEqual(v, m_noDataValue)) continue;
+        int row = positions == NULL ? i / nCols : positions[i][0];
+        int col = positions == NULL ? i % nCols : positions[i][1];
+        sum[(row + 1) * tabCols + col + 1] = (double) v;
+        count[(row + 1) * tabCols + col + 1] = 1;
+    }
+    /// 2. prefix sum along each row, then along each column
+#pragma omp parallel for
+    for (int row = 1; row <= nRows; row++) {
+        for (int col = 1; col <= nCols; col++) {
+            sum[row * tabCols + col] += sum[row * tabCols + col - 1];
+            count[row * tabCols + col] += count[row * tabCols + col - 1];
+        }
+    }
+#pragma omp parallel for
+    for (int col = 1; col <= nCols; col++) {
+        for (int row = 1; row <= nRows; row++) {
+            sum[row * tabCols + col] += sum[(row - 1) * tabCols + col];
+            count[row * tabCols + col] += count[(row - 1) * tabCols + col];
+        }
+    }
+    if (m_satSum == NULL) {
+        m_satSum = new double *[m_nLyrs];
+        m_satCount = new int *[m_nLyrs];
+        for (int i = 0; i < m_nLyrs; i++) {
+            m_satSum[i] = NULL;
+            m_satCount[i] = NULL;
+        }
+    }
+    m_satSum[lyr - 1] = sum;
+    m_satCount[lyr - 1] = count;
+    return true;
+}
+
+template<typename T, typename MaskT>
+bool clsRasterData<T, MaskT>::_clip_window(int &row0, int &col0, int &row1, int &col1, int lyr) {
+    if (row0 > row1) swap(row0, row1);
+    if (col0 > col1) swap(col0, col1);
+    row0 = max(row0, 0);
+    col0 = max(col0, 0);
+    row1 = min(row1, this->getRows() - 1);
+    col1 = min(col1, this->getCols() - 1);
+    if (row0 > row1 || col0 > col1) return false;
+    /// corners in the summed-area table, i.e., (row0, col0) exclusive and (row1, col1) inclusive
+    row1 += 1;
+    col1 += 1;
+    return this->buildSummedAreaTable(lyr);
+}
+
+template<typename T, typename MaskT>
+double clsRasterData<T, MaskT>::windowSum(int row0, int col0, int row1, int col1, int lyr /* = 1 */) {
+    if (!this->_clip_window(row0, col0, row1, col1, lyr)) return 0.;
+    int tabCols = this->getCols() + 1;
+    const double *sum = m_satSum[lyr - 1];
+    return sum[row1 * tabCols + col1] - sum[row0 * tabCols + col1]
+        - sum[row1 * tabCols + col0] + sum[row0 * tabCols + col0];
+}
+
+template<typename T, typename MaskT>
+int clsRasterData<T, MaskT>::windowCount(int row0, int col0, int row1, int col1, int lyr /* = 1 */) {
+    if (!this->_clip_window(row0, col0, row1, col1, lyr)) return 0;
+    int tabCols = this->getCols() + 1;
+    const int *count = m_satCount[lyr - 1];
+    return count[row1 * tabCols + col1] - count[row0 * tabCols + col1]
+        - count[row1 * tabCols + col0] + count[row0 * tabCols + col0];
+}
+
+template<typename T, typename MaskT>
+double clsRasterData<T, MaskT>::windowMean(int row0, int col0, int row1, int col1, int lyr /* = 1 */) {
+    int count = this->windowCount(row0, col0, row1, col1, lyr);
+    if (count <= 0) return NODATA_VALUE;
+    return this->windowSum(row0, col0, row1, col1, lyr) / count;
+}
+
+template<typename T, typename MaskT>
+void clsRasterData<T, MaskT>::releaseMinMaxPyramids(void) {
+    lock_guard<recursive_mutex> lock(m_materializeMutex);
+    if (m_pyramidMin != NULL) {
+        for (int lyr = 0; lyr < m_nLyrs; lyr++) {
+            if (m_pyramidMin[lyr] != NULL) Release1DArray(m_pyramidMin[lyr]);
+            if (m_pyramidMax[lyr] != NULL) Release1DArray(m_pyramidMax[lyr]);
+        }
+        delete[] m_pyramidMin;
+        delete[] m_pyramidMax;
+        m_pyramidMin = NULL;
+        m_pyramidMax = NULL;
+    }
+    if (m_pyramidCellStart != NULL) Release1DArray(m_pyramidCellStart);
+    if (m_pyramidCells != NULL) Release1DArray(m_pyramidCells);
+    m_pyramidOffsets.clear();
+    m_pyramidSizes.clear();
+    m_pyramidDirty.clear();
+    m_pyramidBlockSize = -1;
+}
+
+template<typename T, typename MaskT>
+bool clsRasterData<T, MaskT>::buildMinMaxPyramid(int lyr /* = 1 */, int blockSize /* = 32 */) {
+    this->_materialize();
+    if (lyr < 1 || lyr > m_nLyrs) return false;
+    /// the pyramid is built or updated once by the first caller, and the concurrent callers wait for it
+    lock_guard<recursive_mutex> lock(m_materializeMutex);
+    if (m_pyramidMin != NULL && m_pyramidMin[lyr - 1] != NULL) {
+        this->_update_min_max_pyramid(lyr);
+        return true;
+    }
+    if ((m_is2DRaster && m_raster2DData == NULL) || (!m_is2DRaster && m_rasterData == NULL)) {
+        cout << "Please initialize the raster object first." << endl;
+        return false;
+    }
+    int **positions = NULL;
+    if (!this->_get_stored_positions(&positions)) {
+        cout << "The positions of the stored cells are not available!" << endl;
+        return false;
+    }
+    int nCols = this->getCols();
+    /// 1. group the stored cells by blocks, which is shared by all layers
+    if (m_pyramidCells == NULL) {
+        m_pyramidBlockSize = blockSize > 0 ? blockSize : 32;
+        int levelRows = (this->getRows() + m_pyramidBlockSize - 1) / m_pyramidBlockSize;
+        int levelCols = (nCols + m_pyramidBlockSize - 1) / m_pyramidBlockSize;
+        m_pyramidOffsets.push_back(0);
+        while (true) {
+            m_pyramidSizes.push_back(RowCol(levelRows, levelCols));
+            m_pyramidOffsets.push_back(m_pyramidOffsets.back() + levelRows * levelCols);
+            if (levelRows == 1 && levelCols == 1) break;
+            levelRows = (levelRows + 1) / 2;
+            levelCols = (levelCols + 1) / 2;
+        }
+        int nBlocks = m_pyramidOffsets[1];
+        int blockCols = m_pyramidSizes[0].second;
+        int *cellBlock = new int[m_nCells];
+#pragma omp parallel for
+        for (int i = 0; i < m_nCells; i++) {
+            int row = positions == NULL ? i / nCols : positions[i][0];
+            int col = positions == NULL ? i % nCols : positions[i][1];
+            cellBlock[i] = (row / m_pyramidBlockSize) * blockCols + col / m_pyramidBlockSize;
+        }
+        Initialize1DArray(nBlocks + 1, m_pyramidCellStart, 0);
+        for (int i = 0; i < m_nCells; i++) m_pyramidCellStart[cellBlock[i] + 1]++;
+        for (int b = 0; b < nBlocks; b++) m_pyramidCellStart[b + 1] += m_pyramidCellStart[b];
+        vector<int> cursor(m_pyramidCellStart, m_pyramidCellStart + nBlocks);
+        m_pyramidCells = new int[m_nCells];
+        for (int i = 0; i < m_nCells; i++) m_pyramidCells[cursor[cellBlock[i]]++] = i;
+        delete[] cellBlock;
+        m_pyramidMin = new double *[m_nLyrs];
+        m_pyramidMax = new double *[m_nLyrs];
+        for (int i = 0; i < m_nLyrs; i++) {
+            m_pyramidMin[i] = NULL;
+            m_pyramidMax[i] = NULL;
+        }
+        m_pyramidDirty.resize(m_nLyrs);
+    }
+    /// 2. min/max of each block, and then merge 2 * 2 nodes level by level
+    Initialize1DArray(m_pyramidOffsets.back(), m_pyramidMin[lyr - 1], DBL_MAX);
+    Initialize1DArray(m_pyramidOffsets.back(), m_pyramidMax[lyr - 1], -DBL_MAX);
+    int nBlocks = m_pyramidOffsets[1];
+    for (int b = 0; b < nBlocks; b++) m_pyramidDirty[lyr - 1].push_back(b);
+    this->_update_min_max_pyramid(lyr);
+    return true;
+}
+
+template<typename T, typename MaskT>
+void clsRasterData<T, MaskT>::_update_min_max_pyramid(int lyr) {
+    vector<int> &dirty = m_pyramidDirty[lyr - 1];
+    if (dirty.empty()) return;
+    double *minv = m_pyramidMin[lyr - 1];
+    double *maxv = m_pyramidMax[lyr - 1];
+    sort(dirty.begin(), dirty.end());
+    dirty.erase(unique(dirty.begin(), dirty.end()), dirty.end());
+    int nDirty = (int) dirty.size();
+#pragma omp parallel for
+    for (int d = 0; d < nDirty; d++) {
+        int b = dirty[d];
+        double bmin = DBL_MAX;
+        double bmax = -DBL_MAX;
+        for (int k = m_pyramidCellStart[b]; k < m_pyramidCellStart[b + 1]; k++) {
+            int i = m_pyramidCells[k];
+            T v = m_is2DRaster ? m_raster2DData[i][lyr - 1] : m_rasterData[i];
+            if (FloatEqual(v, m_noDataValue)) continue;
+            if (v < bmin) bmin = v;
+            if (v > bmax) bmax = v;
+        }
+        minv[b] = bmin;
+        maxv[b] = bmax;
+    }
+    /// propagate to the ancestors of the modified blocks
+    for (size_t level = 1; level < m_pyramidSizes.size(); level++) {
+        int lowerCols = m_pyramidSizes[level - 1].second;
+        int lowerRows = m_pyramidSizes[level - 1].first;
+        int levelCols = m_pyramidSizes[level].second;
+        for (int d = 0; d < nDirty; d++) {
+            int lowerIdx = dirty[d];
+            dirty[d] = (lowerIdx / lowerCols / 2) * levelCols + (lowerIdx % lowerCols) / 2;
+        }
+        sort(dirty.begin(), dirty.end());
+        dirty.erase(unique(dirty.begin(), dirty.end()), dirty.end());
+        nDirty = (int) dirty.size();
+#pragma omp parallel for
+        for (int d = 0; d < nDirty; d++) {
+            int brow = dirty[d] / levelCols;
+            int bcol = dirty[d] % levelCols;
+            double nmin = DBL_MAX;
+            double nmax = -DBL_MAX;
+            for (int r = brow * 2; r < min(brow * 2 + 2, lowerRows); r++) {
+                for (int c = bcol * 2; c < min(bcol * 2 + 2, lowerCols); c++) {
+                    int lowerIdx = m_pyramidOffsets[level - 1] + r * lowerCols + c;
+                    nmin = min(nmin, minv[lowerIdx]);
+                    nmax = max(nmax, maxv[lowerIdx]);
+                }
+            }
+            minv[m_pyramidOffsets[level] + dirty[d]] = nmin;
+            maxv[m_pyramidOffsets[level] + dirty[d]] = nmax;
+        }
+    }
+    dirty.clear();
+}
+
+template<typename T, typename MaskT>
+void clsRasterData<T, MaskT>::_query_min_max_pyramid(int lyr, int level, int brow, int bcol,
+                                                     const int *window, double *minmax) {
+    int idx = m_pyramidOffsets[level] + brow * m_pyramidSizes[level].second + bcol;
+    double nmin = m_pyramidMin[lyr - 1][idx];
+    double nmax = m_pyramidMax[lyr - 1][idx];
+    /// skip the node which can not change the result
+    if (nmin > nmax || (nmin >= minmax[0] && nmax <= minmax[1])) return;
+    int span = m_pyramidBlockSize << level;
+    int row0 = brow * span;
+    int col0 = bcol * span;
+    int row1 = row0 + span - 1;
+    int col1 = col0 + span - 1;
+    if (row0 > window[2] || row1 < window[0] || col0 > window[3] || col1 < window[1]) return;
+    if (row0 >= window[0] && row1 <= window[2] && col0 >= window[1] && col1 <= window[3]) {
+        minmax[0] = min(minmax[0], nmin);
+        minmax[1] = max(minmax[1], nmax);
+        return;
+    }
+    if (level > 0) {
+        for (int r = brow * 2; r < min(brow * 2 + 2, m_pyramidSizes[level - 1].first); r++) {
+            for (int c = bcol * 2; c < min(bcol * 2 + 2, m_pyramidSizes[level - 1].second); c++) {
+                this->_query_min_max_pyramid(lyr, level - 1, r, c, window, minmax);
+            }
+        }
+        return;
+    }
+    /// block partially covered by the window, check cells one by one
+    int **positions = NULL;
+    this->_get_stored_positions(&positions);
+    int nCols = this->getCols();
+    for (int k = m_pyramidCellStart[idx]; k < m_pyramidCellStart[idx + 1]; k++) {
+        int i = m_pyramidCells[k];
+        int row = positions == NULL ? i / nCols : positions[i][0];
+        int col = positions == NULL ? i % nCols : positions[i][1];
+        if (row < window[0] || row > window[2] || col < window[1] || col > window[3]) continue;
+        T v = m_is2DRaster ? m_raster2DData[i][lyr - 1] : m_rasterData[i];
+        if (FloatEqual(v, m_noDataValue)) continue;
+        minmax[0] = min(minmax[0], (double) v);
+        minmax[1] = max(minmax[1], (double) v);
+    }
+}
+
+template<typename T, typename MaskT>
+double clsRasterData<T, MaskT>::windowMinimum(int row0, int col0, int row1, int col1, int lyr /* = 1 */) {
+    if (!this->buildMinMaxPyramid(lyr)) return NODATA_VALUE;
+    int window[4] = {min(row0, row1), min(col0, col1), max(row0, row1), max(col0, col1)};
+    double minmax[2] = {DBL_MAX, -DBL_MAX};
+    this->_query_min_max_pyramid(lyr, (int) m_pyramidSizes.size() - 1, 0, 0, window, minmax);
+    return minmax[0] > minmax[1] ? NODATA_VALUE : minmax[0];
+}
+
+template<typename T, typename MaskT>
+double clsRasterData<T, MaskT>::windowMaximum(int row0, int col0, int row1, int col1, int lyr /* = 1 */) {
+    if (!this->buildMinMaxPyramid(lyr)) return NODATA_VALUE;
+    int window[4] = {min(row0, row1), min(col0, col1), max(row0, row1), max(col0, col1)};
+    double minmax[2] = {DBL_MAX, -DBL_MAX};
+    this->_query_min_max_pyramid(lyr, (int) m_pyramidSizes.size() - 1, 0, 0, window, minmax);
+    return minmax[0] > minmax[1] ? NODATA_VALUE : minmax[1];
+}
+
+template<typename T, typename MaskT>
+int clsRasterData<T, MaskT>::extractByThreshold(double threshold, vector<int> &cells, bool above /* = true */,
+                                                int lyr /* = 1 */) {
+    this->_materialize();
+    cells.clear();
+    if (!this->buildMinMaxPyramid(lyr)) return 0;
+    const double *minv = m_pyramidMin[lyr - 1];
+    const double *maxv = m_pyramidMax[lyr - 1];
+    /// 1. traverse the pyramid from the top, and collect the candidate blocks
+    vector<int> nodes(1, 0);
+    for (int level = (int) m_pyramidSizes.size() - 1; level > 0; level--) {
+        vector<int> children;
+        int levelCols = m_pyramidSizes[level].second;
+        int lowerRows = m_pyramidSizes[level - 1].first;
+        int lowerCols = m_pyramidSizes[level - 1].second;
+        for (size_t n = 0; n < nodes.size(); n++) {
+            int brow = nodes[n] / levelCols;
+            int bcol = nodes[n] % levelCols;
+            for (int r = brow * 2; r < min(brow * 2 + 2, lowerRows); r++) {
+                for (int c = bcol * 2; c < min(bcol * 2 + 2, lowerCols); c++) {
+                    int idx = m_pyramidOffsets[level - 1] + r * lowerCols + c;
+                    if (minv[idx] > maxv[idx]) continue;
+                    if (above ? maxv[idx] > threshold : minv[idx] < threshold) {
+                        children.push_back(r * lowerCols + c);
+                    }
+                }
+            }
+        }
+        nodes.swap(children);
+    }
+    /// 2. take all cells of the blocks totally matched, and check cells of others
+    for (size_t n = 0; n < nodes.size(); n++) {
+        int b = nodes[n];
+        bool allMatched = above ? minv[b] > threshold : maxv[b] < threshold;
+        for (int k = m_pyramidCellStart[b]; k < m_pyramidCellStart[b + 1]; k++) {
+            int i = m_pyramidCells[k];
+            T v = m_is2DRaster ? m_raster2DData[i][lyr - 1] : m_rasterData[i];
+            if (FloatEqual(v, m_noDataValue)) continue;
+            if (allMatched || (above ? v > threshold : v < threshold)) cells.push_back(i);
+        }
+    }
+    sort(cells.begin(), cells.end());
+    return (int) cells.size();
+}
+
 /************* Utility functions ***************/
 
 template<typename T, typename MaskT>
@@ -1224,8 +3228,104 @@ void clsRasterData<T, MaskT>::copyHeader(const map<string, double> &maskHeader)
     }
 }
 
+template<typename T, typename MaskT>
+uint64_t clsRasterData<T, MaskT>::_calculate_content_hash(void) {
+    /// the positions depend on the file only if they are calculated without mask
+    if (!clsRasterIndexCache::isEnabled() || m_mask != NULL || !m_calcPositions || m_headers.empty()) return 0;
+    uint64_t identity = clsRasterIndexCache::fileIdentity(m_filePathName);
+    if (identity == 0) return 0;
+    double header[7] = {m_headers.at(HEADER_RS_NROWS), m_headers.at(HEADER_RS_NCOLS), m_headers.at(HEADER_RS_XLL),
+                        m_headers.at(HEADER_RS_YLL), m_headers.at(HEADER_RS_CELLSIZE),
+                        m_headers.at(HEADER_RS_NODATA), double(sizeof(T))};
+    uint64_t h = clsRasterIndexCache::hash(header, sizeof(header), identity);
+    return h == 0 ? 1 : h;  /// 0 means not calculated
+}
+
+template<typename T, typename MaskT>
+void clsRasterData<T, MaskT>::_get_row_runs(int **positions, vector<int32_t> &runs) {
+    runs.clear();
+    const int *order = this->_get_row_major_order(positions);
+    for (int idx = 0; idx < m_nCells; idx++) {
+        int cell = order == NULL ? idx : order[idx];
+        int row = positions[cell][0];
+        int col = positions[cell][1];
+        size_t last = runs.size();
+        if (last > 0 && runs[last - 3] == row && runs[last - 2] + runs[last - 1] == col) {
+            runs[last - 1]++;
+        } else {
+            runs.push_back(row);
+            runs.push_back(col);
+            runs.push_back(1);
+        }
+    }
+}
+
+template<typename T, typename MaskT>
+int clsRasterData<T, MaskT>::_build_positions_by_row_runs(const int32_t *runs, int nRuns) {
+    int nrows = this->getRows();
+    int ncols = this->getCols();
+    int count = 0;
+    for (int k = 0; k < nRuns; k++) {
+        const int32_t *run = runs + 3 * k;
+        if (run[0] < 0 || run[0] >= nrows || run[1] < 0 || run[2] < 1 || run[1] + run[2] > ncols) return -1;
+        count += run[2];
+    }
+    m_positionBlock = new int[2 * count];
+    m_rasterPositionData = new int *[count];
+    int idx = 0;
+    for (int k = 0; k < nRuns; k++) {
+        const int32_t *run = runs + 3 * k;
+        for (int col = run[1]; col < run[1] + run[2]; col++, idx++) {
+            m_positionBlock[2 * idx] = run[0];
+            m_positionBlock[2 * idx + 1] = col;
+            m_rasterPositionData[idx] = m_positionBlock + 2 * idx;
+        }
+    }
+    m_storePositions = true;
+    m_calcPositions = true;
+    return count;
+}
+
+template<typename T, typename MaskT>
+bool clsRasterData<T, MaskT>::_compact_by_row_runs(const vector<int32_t> &runs) {
+    int ncols = this->getCols();
+    int count = this->_build_positions_by_row_runs(runs.data(), int(runs.size() / 3));
+    if (count < 0) return false;
+    if (m_is2DRaster) {
+        T **values = NULL;
+        Initialize2DArray(count, m_nLyrs, values, m_noDataValue);
+#pragma omp parallel for
+        for (int idx = 0; idx < count; idx++) {
+            T *cell = m_raster2DData[m_positionBlock[2 * idx] * ncols + m_positionBlock[2 * idx + 1]];
+            for (int lyr = 0; lyr < m_nLyrs; lyr++) values[idx][lyr] = cell[lyr];
+        }
+        Release2DArray(m_nCells, m_raster2DData);
+        m_raster2DData = values;
+    } else {
+        T *values = NULL;
+        Initialize1DArray(count, values, m_noDataValue);
+#pragma omp parallel for
+        for (int idx = 0; idx < count; idx++) {
+            values[idx] = m_rasterData[m_positionBlock[2 * idx] * ncols + m_positionBlock[2 * idx + 1]];
+        }
+        Release1DArray(m_rasterData);
+        m_rasterData = values;
+    }
+    m_nCells = count;
+    m_headers.at(HEADER_RS_CELLSNUM) = m_nCells;
+    return true;
+}
+
 template<typename T, typename MaskT>
 void clsRasterData<T, MaskT>::_calculate_valid_positions_from_grid_data() {
+    this->releaseNeighborIndex();
+    this->_release_derived_data();
+    /// reuse the cached row runs of the valid cells if the same file has been read before
+    vector<int32_t> runs;
+    if (m_contentHash != 0 && clsRasterIndexCache::load(m_contentHash, "runs", runs) &&
+        this->_compact_by_row_runs(runs)) {
+        return;
+    }
     int oldcellnumber = m_nCells;
     /// initial vectors
     vector<T> values;
@@ -1294,10 +3394,27 @@ void clsRasterData<T, MaskT>::_calculate_valid_positions_from_grid_data() {
         m_rasterPositionData[i][1] = positionCols.at(i);
     }
     m_calcPositions = true;
+    if (m_contentHash != 0) {
+        /// the valid cells are in row-major order
+        runs.clear();
+        for (int i = 0; i < m_nCells; ++i) {
+            size_t last = runs.size();
+            if (last > 0 && runs[last - 3] == positionRows[i] && runs[last - 2] + runs[last - 1] == positionCols[i]) {
+                runs[last - 1]++;
+            } else {
+                runs.push_back(positionRows[i]);
+                runs.push_back(positionCols[i]);
+                runs.push_back(1);
+            }
+        }
+        clsRasterIndexCache::store(m_contentHash, "runs", runs);
+    }
 }
 
 template<typename T, typename MaskT>
 void clsRasterData<T, MaskT>::_mask_and_calculate_valid_positions() {
+    this->releaseNeighborIndex();
+    this->_release_derived_data();
     int oldcellnumber = m_nCells;
     if (m_mask != NULL) {
         /// 1. Get new values and positions according to Mask's position data
@@ -1312,14 +3429,36 @@ void clsRasterData<T, MaskT>::_mask_and_calculate_valid_positions() {
             int nValidMaskNumber;
             int **validPosition = NULL;
             m_mask->getRasterPositionData(nValidMaskNumber, &validPosition);
+            /// The grid index of this raster of each mask cell may be cached, which is keyed by
+            /// the content of mask and the header of this raster.
+            uint64_t cachekey = 0;
+            vector<int32_t> gridIndex;
+            bool cached = false;
+            if (clsRasterIndexCache::isEnabled() && m_mask->getContentHash() != 0 &&
+                m_mask->getCellOrdering() == CELL_ORDER_ROWMAJOR) {
+                double header[5] = {m_headers.at(HEADER_RS_NROWS), m_headers.at(HEADER_RS_NCOLS),
+                                    m_headers.at(HEADER_RS_XLL), m_headers.at(HEADER_RS_YLL),
+                                    m_headers.at(HEADER_RS_CELLSIZE)};
+                cachekey = clsRasterIndexCache::hash(header, sizeof(header), m_mask->getContentHash());
+                cached = clsRasterIndexCache::load(cachekey, "mapping", gridIndex) &&
+                    (int) gridIndex.size() == nValidMaskNumber;
+                if (!cached) gridIndex.assign(nValidMaskNumber, -1);
+            }
             /// Get the valid data according to coordinate
             for (int i = 0; i < nValidMaskNumber; ++i) {
                 int tmpRow = validPosition[i][0];
                 int tmpCol = validPosition[i][1];
-                XYCoor tmpXY = m_mask->getCoordinateByRowCol(tmpRow, tmpCol);
-                /// get current raster value by XY
-                RowCol tmpPosition = this->getPositionByCoordinate(tmpXY.first, tmpXY.second);
-                if (tmpPosition.first == -1 || tmpPosition.second == -1) continue;
+                RowCol tmpPosition;
+                if (cached) {
+                    if (gridIndex[i] < 0) continue;
+                    tmpPosition = RowCol(gridIndex[i] / cols, gridIndex[i] % cols);
+                } else {
+                    XYCoor tmpXY = m_mask->getCoordinateByRowCol(tmpRow, tmpCol);
+                    /// get current raster value by XY
+                    tmpPosition = this->getPositionByCoordinate(tmpXY.first, tmpXY.second);
+                    if (tmpPosition.first == -1 || tmpPosition.second == -1) continue;
+                    if (cachekey != 0) gridIndex[i] = tmpPosition.first * cols + tmpPosition.second;
+                }
 
                 T tmpValue;
                 if (m_is2DRaster) {
@@ -1345,6 +3484,7 @@ void clsRasterData<T, MaskT>::_mask_and_calculate_valid_positions() {
                 positionRows.push_back(tmpRow);
                 positionCols.push_back(tmpCol);
             }
+            if (cachekey != 0 && !cached) clsRasterIndexCache::store(cachekey, "mapping", gridIndex);
         } else {
             int maskRows = m_mask->getRows();
             int maskCols = m_mask->getCols();
@@ -1453,8 +3593,11 @@ void clsRasterData<T, MaskT>::_mask_and_calculate_valid_positions() {
             vector<int>(positionCols).swap(positionCols);
         }
         /// 3. Create new raster data, considering valid data only or not.
+        /// The positions of mask are shared if all valid cells of mask are kept in place, which is
+        /// the usual case of the rasters masked by the same mask, e.g., by BatchReadFromMongoDB().
         m_storePositions = true;
-        if (m_mask != NULL && m_mask->PositionsCalculated() && m_useMaskExtent && sameExtentWithMask) {
+        if (m_mask != NULL && m_mask->PositionsCalculated() && (m_useMaskExtent || sameExtentWithMask) &&
+            (int) positionRows.size() == m_mask->getCellNumber()) {
             m_mask->getRasterPositionData(m_nCells, &m_rasterPositionData);
             m_storePositions = false;
         }
@@ -1488,6 +3631,8 @@ void clsRasterData<T, MaskT>::_mask_and_calculate_valid_positions() {
                     m_rasterData[i] = values.at(i);
                 }
             }
+            /// the owned positions follow the order of mask, which may be reordered
+            this->_build_row_major_order(m_mask->getCellOrdering());
         } else { // reStore all cell values to m_rasterData, and the position data in case of later usage.
             int ncols = (int)m_headers.at(HEADER_RS_NCOLS);
             int nrows = (int)m_headers.at(HEADER_RS_NROWS);
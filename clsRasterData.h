@@ -20,6 +20,13 @@
 #include <fstream>
 #include <iomanip>
 #include <typeinfo>
+#include <algorithm>
+#include <cfloat>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <atomic>
+#include <mutex>
 #include <stdint.h>
 /// include GDAL, required
 #include "gdal.h"
@@ -29,6 +36,7 @@
 /// include MongoDB, optional
 #ifdef USE_MONGODB
 #include "MongoUtil.h"
+#include "clsGridFSStream.h"
 #endif /* USE_MONGODB */
 /// include openmp if supported
 #ifdef SUPPORT_OMP
@@ -36,6 +44,17 @@
 #endif /* SUPPORT_OMP */
 /// include utility functions
 #include "utilities.h"
+/// memory-mapped file for the native binary format
+#include "clsMemoryMap.h"
+/// on-disk cache of the valid cell index
+#include "clsRasterIndexCache.h"
+/// storage backend of raster blobs, e.g., GridFS and local directory
+#include "clsRasterBlobStore.h"
+#include "clsLocalBlobStore.h"
+/// node-local cache of the rasters read from blob store
+#include "clsRasterBlobCache.h"
+/// process-wide registry of rasters with memory budget
+#include "clsRasterManager.h"
 
 using namespace std;
 
@@ -58,6 +77,23 @@ using namespace std;
 #define HEADER_RS_LAYERS        "LAYERS"
 #define HEADER_RS_CELLSNUM      "CELLSNUM"
 #define HEADER_RS_SRS           "SRS"
+#define HEADER_RS_DATATYPE      "DATATYPE"  /// GDAL data type name of stored blob, e.g., "Float32"
+#define HEADER_RS_LAYOUT        "LAYOUT"    /// Layout of stored blob, i.e., "FULL" (by default), "VALID", or "TILED"
+#define HEADER_RS_NRUNS         "NRUNS"     /// Number of row runs of the valid cells stored in blob
+#define HEADER_RS_TILESIZE      "TILESIZE"  /// Tile size of tiled blob
+#define HEADER_RS_NTILEROWS     "NTILEROWS" /// Number of tile rows of tiled blob
+#define HEADER_RS_NTILECOLS     "NTILECOLS" /// Number of tile columns of tiled blob
+#define HEADER_RS_TILEROW       "TILEROW"   /// Tile row of tile blob, from 0
+#define HEADER_RS_TILECOL       "TILECOL"   /// Tile column of tile blob, from 0
+#define HEADER_RS_TILELAYER     "TILELAYER" /// Layer number of tile blob, from 1
+#define HEADER_RS_TILEVERSION   "TILEVERSION" /// Write id of the tiles of tiled blob, \sa GetRasterTileName()
+
+/*!
+ * Define layouts of raster data stored in blob store, e.g., GridFS
+ */
+#define BLOB_LAYOUT_FULL        "FULL"   /// full-sized grid with NODATA, row by row
+#define BLOB_LAYOUT_VALID       "VALID"  /// row runs of the valid cells, followed by the valid values
+#define BLOB_LAYOUT_TILED       "TILED"  /// index of tiles, and one blob per tile and layer
 
 /*!
  * Define constant strings of statistics index
@@ -74,6 +110,230 @@ using namespace std;
  */
 #define ASCIIExtension          "asc"
 #define GTiffExtension          "tif"
+#define NativeExtension         "rsb"
+
+/*!
+ * Magic string and version of the native binary raster format
+ */
+#define NATIVE_RS_MAGIC         "RSBINARY"
+#define NATIVE_RS_VERSION       1
+#define NATIVE_RS_ALIGNMENT     64
+
+/*!
+ * \brief Compile-time mapping from C++ type to \a GDALDataType
+ * Types which have no equivalent GDAL type are mapped to \a GDT_Unknown.
+ */
+template<typename T>
+struct GDALDataTypeOf { static const GDALDataType value = GDT_Unknown; };
+template<>
+struct GDALDataTypeOf<unsigned char> { static const GDALDataType value = GDT_Byte; };
+template<>
+struct GDALDataTypeOf<unsigned short> { static const GDALDataType value = GDT_UInt16; };
+template<>
+struct GDALDataTypeOf<short> { static const GDALDataType value = GDT_Int16; };
+template<>
+struct GDALDataTypeOf<unsigned int> { static const GDALDataType value = GDT_UInt32; };
+template<>
+struct GDALDataTypeOf<int> { static const GDALDataType value = GDT_Int32; };
+template<>
+struct GDALDataTypeOf<float> { static const GDALDataType value = GDT_Float32; };
+template<>
+struct GDALDataTypeOf<double> { static const GDALDataType value = GDT_Float64; };
+
+/*!
+ * \brief Map NODATA value into the range which can be represented by both data types
+ * The value is kept if it is representable, otherwise it is mapped to the maximum of the range
+ * for unsigned types (e.g., -9999 to 255 for \a GDT_Byte) or the minimum for signed types.
+ * \a GDT_Unknown and other types are regarded as \a GDT_Float64.
+ */
+inline double GDALRepresentableNoData(double noData, GDALDataType dataType, GDALDataType bufType = GDT_Unknown) {
+    double lo = -DBL_MAX;
+    double hi = DBL_MAX;
+    bool integral = false;
+    GDALDataType types[2] = {dataType, bufType};
+    for (int i = 0; i < 2; i++) {
+        double tlo = -DBL_MAX;
+        double thi = DBL_MAX;
+        switch (types[i]) {
+            case GDT_Byte: tlo = 0.; thi = 255.; break;
+            case GDT_UInt16: tlo = 0.; thi = 65535.; break;
+            case GDT_Int16: tlo = -32768.; thi = 32767.; break;
+            case GDT_UInt32: tlo = 0.; thi = 4294967295.; break;
+            case GDT_Int32: tlo = -2147483648.; thi = 2147483647.; break;
+            case GDT_Float32: tlo = -FLT_MAX; thi = FLT_MAX; break;
+            default: break;
+        }
+        if (types[i] >= GDT_Byte && types[i] <= GDT_Int32) integral = true;
+        lo = max(lo, tlo);
+        hi = min(hi, thi);
+    }
+    if (noData >= lo && noData <= hi && (!integral || noData == floor(noData))) return noData;
+    return lo >= 0. ? hi : lo;
+}
+
+/*!
+ * \brief Creation options of GeoTIFF output by GDAL
+ * The default options create a striped and uncompressed GeoTIFF file as before.
+ */
+struct GTiffWriteOptions {
+public:
+    ///< Tiled GeoTIFF or striped
+    bool tiled;
+    ///< Tile width, used when tiled is true
+    int blockXSize;
+    ///< Tile height (-1 by default means the same as blockXSize), or rows per strip when tiled is false
+    int blockYSize;
+    ///< Compression method, e.g., "NONE", "DEFLATE", "LZW", "ZSTD" (GDAL 2.3+), and "LERC" (GDAL 2.4+)
+    string compress;
+    ///< Predictor for DEFLATE/LZW/ZSTD, i.e., 1 (none), 2 (horizontal differencing), and 3 (floating point)
+    int predictor;
+    ///< Compression level, e.g., ZLEVEL for DEFLATE and ZSTD_LEVEL for ZSTD, -1 means the default level
+    int level;
+    ///< BIGTIFF option, i.e., "IF_NEEDED", "IF_SAFER", "YES", and "NO"
+    string bigTiff;
+    ///< NUM_THREADS option for multithreaded compression (GDAL 2.1+), e.g., "ALL_CPUS", or "" for none
+    string numThreads;
+    ///< Data type of the output bands, \a GDT_Unknown means the type of raster data, i.e., \a GDALDataTypeOf<T>.
+    ///< NODATA value which is not representable by the type is mapped, \sa GDALRepresentableNoData.
+    GDALDataType dataType;
+    ///< Write all layers of 2D raster as bands of one GeoTIFF file, rather than one file per layer
+    bool multiBand;
+    ///< INTERLEAVE option of multi-band output, i.e., "PIXEL" or "BAND", or "" for the GDAL default
+    string interleave;
+
+    GTiffWriteOptions(void) : tiled(false), blockXSize(256), blockYSize(-1), compress("NONE"), predictor(1),
+                              level(-1), bigTiff("IF_NEEDED"), numThreads(""), dataType(GDT_Unknown),
+                              multiBand(false), interleave("") {}
+
+    /*!
+     * \brief Preset for large outputs to be reread locally soon, i.e., tiled and fast compressed
+     * by multiple threads, which is suitable for mostly NODATA rasters.
+     */
+    static GTiffWriteOptions FastReread(void) {
+        GTiffWriteOptions options;
+        options.tiled = true;
+        options.blockXSize = 256;
+        options.blockYSize = 256;
+        options.compress = "DEFLATE";
+        options.level = 1;
+        options.bigTiff = "IF_SAFER";
+        options.numThreads = "ALL_CPUS";
+        return options;
+    }
+
+    /*!
+     * \brief Convert to GDAL creation options
+     * \return String list which should be released by CSLDestroy()
+     */
+    char **toGDALOptions(void) const {
+        char **papszOptions = NULL;
+        if (tiled) {
+            papszOptions = CSLSetNameValue(papszOptions, "TILED", "YES");
+            papszOptions = CSLSetNameValue(papszOptions, "BLOCKXSIZE", CPLSPrintf("%d", blockXSize));
+            /// square tiles by default, since GDAL rejects the non-positive tile height
+            papszOptions = CSLSetNameValue(papszOptions, "BLOCKYSIZE",
+                                           CPLSPrintf("%d", blockYSize > 0 ? blockYSize : blockXSize));
+        } else if (blockYSize > 0) {
+            papszOptions = CSLSetNameValue(papszOptions, "BLOCKYSIZE", CPLSPrintf("%d", blockYSize));
+        }
+        if (!compress.empty() && compress != "NONE") {
+            papszOptions = CSLSetNameValue(papszOptions, "COMPRESS", compress.c_str());
+            if (predictor > 1 && compress != "LERC") {
+                papszOptions = CSLSetNameValue(papszOptions, "PREDICTOR", CPLSPrintf("%d", predictor));
+            }
+            if (level >= 0 && compress == "DEFLATE") {
+                papszOptions = CSLSetNameValue(papszOptions, "ZLEVEL", CPLSPrintf("%d", level));
+            } else if (level >= 0 && compress == "ZSTD") {
+                papszOptions = CSLSetNameValue(papszOptions, "ZSTD_LEVEL", CPLSPrintf("%d", level));
+            }
+        }
+        if (!bigTiff.empty()) papszOptions = CSLSetNameValue(papszOptions, "BIGTIFF", bigTiff.c_str());
+        if (!numThreads.empty()) papszOptions = CSLSetNameValue(papszOptions, "NUM_THREADS", numThreads.c_str());
+        if (multiBand && !interleave.empty()) {
+            papszOptions = CSLSetNameValue(papszOptions, "INTERLEAVE", interleave.c_str());
+        }
+        return papszOptions;
+    }
+};
+
+/*!
+ * \brief Options of raster data output to blob store, \sa clsRasterData::outputToBlobStore()
+ */
+struct BlobWriteOptions {
+public:
+    ///< Data type of the stored values, \a GDT_Unknown means the type of raster data, i.e., \a GDALDataTypeOf<T>,
+    ///< and Float64 for other types.
+    GDALDataType dataType;
+    ///< Store the valid cells only with their row runs, i.e., \a BLOB_LAYOUT_VALID,
+    ///< rather than the full-sized grid with NODATA. It is much smaller for the rasters masked by a small basin.
+    bool validCellsOnly;
+    ///< Compression method, i.e., "NONE" or "SHUFFLE_ZLIB" (byte-shuffle and zlib by frames of 1 MB)
+    string compress;
+    ///< zlib compression level, from 1 (the fastest) to 9, -1 means 1
+    int level;
+    ///< Tile size in cells of the tiled layout, i.e., \a BLOB_LAYOUT_TILED, which enables partial reads
+    ///< by window or mask. 0 (the default) means untiled, and \a validCellsOnly is ignored if tiled.
+    int tileSize;
+
+    BlobWriteOptions(void) : dataType(GDT_Unknown), validCellsOnly(false), compress("NONE"), level(-1),
+                             tileSize(0) {}
+};
+
+//! Options of raster data output to GridFS, the same as \a BlobWriteOptions
+typedef BlobWriteOptions GridFSWriteOptions;
+
+/*!
+ * \brief Fixed header of the native binary raster format (*.rsb)
+ * The file is laid out as follows, and each section starts at a multiple of \a NATIVE_RS_ALIGNMENT bytes:
+ *     1. this header
+ *     2. SRS string (without the terminating zero)
+ *     3. row runs of the valid cells, int32 [nRuns][3], i.e., row, start col, and cell number
+ *     4. positions of the valid cells in row-major order, int32 [nCells][2], i.e., row and col
+ *     5. statistics of each layer, double [6][nLyrs], i.e., VALID_CELLNUMBER, MEAN, MAX, MIN, STD, and RANGE
+ *     6. raster data, T [nCells][nLyrs], i.e., the same layout as the data of each cell in memory
+ * Sections 3 and 4 are absent if the full grid is stored, and 5 is absent if no statistics calculated.
+ * All values are in the native byte order of the machine which writes the file.
+ */
+struct NativeRasterHeader {
+    char magic[8];            ///< \a NATIVE_RS_MAGIC
+    int32_t version;          ///< \a NATIVE_RS_VERSION
+    int32_t dataType;         ///< \a GDALDataTypeOf<T>, \a GDT_Unknown for other types
+    int32_t typeSize;         ///< sizeof(T)
+    int32_t is2DRaster;       ///< 1 for 2D raster data, otherwise 0
+    int32_t nRows;            ///< Row number
+    int32_t nCols;            ///< Column number
+    int32_t nLyrs;            ///< Layer number
+    int32_t nCells;           ///< Stored cell number
+    int32_t nRuns;            ///< Number of row runs, 0 if the full grid is stored
+    int32_t hasStatistics;    ///< 1 if statistics section exists
+    double xll;               ///< X coordinate of the center of lower left cell
+    double yll;               ///< Y coordinate of the center of lower left cell
+    double cellSize;          ///< Cell size
+    double noData;            ///< NODATA value
+    int64_t srsOffset;        ///< Offset of the SRS string
+    int64_t srsLength;        ///< Length of the SRS string
+    int64_t runsOffset;       ///< Offset of the row runs
+    int64_t positionsOffset;  ///< Offset of the positions
+    int64_t statsOffset;      ///< Offset of the statistics
+    int64_t dataOffset;       ///< Offset of the raster data
+    int64_t fileSize;         ///< Total size of the file, to detect truncated file
+};
+
+/*!
+ * \brief Write the native binary layout into memory, which has the same interface as ofstream
+ */
+struct NativeMemoryWriter {
+public:
+    explicit NativeMemoryWriter(char *base) : m_base(base), m_pos(0) {}
+    void seekp(int64_t pos) { m_pos = pos; }
+    void write(const char *data, size_t length) {
+        memcpy(m_base + m_pos, data, length);
+        m_pos += (int64_t) length;
+    }
+private:
+    char *m_base;  ///< Start address of the layout
+    int64_t m_pos;  ///< Current offset
+};
 
 /*!
  * \brief Coordinate of row and col
@@ -88,16 +348,32 @@ public:
         col = x;
     }
 };
+/*!
+ * \brief Storage order of the valid cells
+ */
+enum CellOrdering {
+    CELL_ORDER_ROWMAJOR = 0, ///< row by row, the default
+    CELL_ORDER_MORTON = 1,   ///< Z-order curve
+    CELL_ORDER_HILBERT = 2,  ///< Hilbert curve
+    CELL_ORDER_TILED = 3     ///< row-major within square tiles, and tiles are row-major too
+};
 typedef pair<int, int> RowCol;
 typedef pair<double, double> XYCoor;
+
+/*!
+ * Offsets of the eight neighbors, clockwise from east, i.e., E, SE, S, SW, W, NW, N, NE
+ */
+const int D8_DELTA_ROW[8] = {0, 1, 1, 1, 0, -1, -1, -1};
+const int D8_DELTA_COL[8] = {1, 1, 0, -1, -1, -1, 0, 1};
 /*!
  * \class clsRasterData
  * \ingroup data
  * \brief Raster data (1D and 2D) I/O class
  * Support I/O between TIFF, ASCII file or/and MongoBD database.
+ * All instances are registered in \a clsRasterManager, which may evict the raster data under memory budget.
  */
 template<typename T, typename MaskT = T>
-class clsRasterData {
+class clsRasterData : public clsManagedRaster {
 public:
     /************* Construct functions ***************/
     /*!
@@ -162,7 +438,7 @@ public:
     *        `clsRasterData newraster;
     *         newraster.Copy(baseraster);`
     */
-    inline clsRasterData(const clsRasterData<T, MaskT> &another) { 
+    inline clsRasterData(const clsRasterData<T, MaskT> &another) : clsManagedRaster() { 
         this->_initialize_raster_class();
         this->Copy(another); 
     }
@@ -200,9 +476,44 @@ public:
     void ReadByGDAL(string filename, bool calcPositions = true, clsRasterData<MaskT> *mask = NULL, 
                     bool useMaskExtent = true, T defalutValue = (T) NODATA_VALUE);
 
+    /*!
+     * \brief Read raster data from blob store, e.g., GridFS or local directory
+     * The blob is read piece by piece, and each piece is converted into the raster data directly.
+     * For the tiled layout (\a BLOB_LAYOUT_TILED), only the tiles containing the valid cells of mask are read.
+     * If the node-local cache is enabled (\sa clsRasterBlobCache::setDirectory()) and the store provides
+     * the identity of the blob, e.g., GridFS, the decoded raster is cached in the native binary format
+     * and mapped by the later reads until the blob is replaced.
+     * If the blob is missing or corrupted, e.g., checksum mismatch or truncated, no data is kept
+     * and the cell number is -1.
+     * \param[in] store \a clsRasterBlobStore
+     * \param[in] filename Blob name of raster
+     * \param[in] calcPositions Calculate positions of valid cells excluding NODATA. The default is true.
+     * \param[in] mask \a clsRasterData<MaskT>
+     * \param[in] useMaskExtent Use mask layer extent, even NoDATA exists.
+     */
+    void ReadFromBlobStore(clsRasterBlobStore* store, string filename, bool calcPositions = true,
+                           clsRasterData<MaskT> *mask = NULL, bool useMaskExtent = true,
+                           T defalutValue = (T) NODATA_VALUE);
+
+    /*!
+     * \brief Read a window of the raster data stored in the tiled layout from blob store
+     * Only the intersecting tiles are read. The extent of the raster is the window clipped by the stored extent.
+     * \param[in] store \a clsRasterBlobStore
+     * \param[in] filename Blob name of raster, i.e., the tile index
+     * \param[in] row Start row of the window, from 0
+     * \param[in] col Start column of the window, from 0
+     * \param[in] nRows Row number of the window
+     * \param[in] nCols Column number of the window
+     * \param[in] calcPositions Calculate positions of valid cells excluding NODATA. The default is true.
+     * \param[in] defalutValue Default value
+     * \return false if the blob is not tiled, or the window is out of extent.
+     */
+    bool ReadWindowFromBlobStore(clsRasterBlobStore* store, string filename, int row, int col, int nRows, int nCols,
+                                 bool calcPositions = true, T defalutValue = (T) NODATA_VALUE);
+
 #ifdef USE_MONGODB
     /*!
-     * \brief Read raster data from MongoDB
+     * \brief Read raster data from MongoDB, \sa ReadFromBlobStore()
      * \param[in] gfs \a mongoc_gridfs_t
      * \param[in] filename \a char*, raster file name
      * \param[in] calcPositions Calculate positions of valid cells excluding NODATA. The default is true.
@@ -210,34 +521,179 @@ public:
      * \param[in] useMaskExtent Use mask layer extent, even NoDATA exists.
      */
     void ReadFromMongoDB(MongoGridFS* gfs, string filename, bool calcPositions = true, clsRasterData<MaskT> *mask = NULL, bool useMaskExtent = true, T defalutValue = (T)NODATA_VALUE);
+
+    /*!
+     * \brief Read a window of the raster data stored in the tiled layout from MongoDB, \sa ReadWindowFromBlobStore()
+     * \param[in] gfs \a mongoc_gridfs_t
+     * \param[in] filename Raster file name, i.e., the tile index
+     * \param[in] row Start row of the window, from 0
+     * \param[in] col Start column of the window, from 0
+     * \param[in] nRows Row number of the window
+     * \param[in] nCols Column number of the window
+     * \param[in] calcPositions Calculate positions of valid cells excluding NODATA. The default is true.
+     * \param[in] defalutValue Default value
+     * \return false if the file is not tiled, or the window is out of extent.
+     */
+    bool ReadWindowFromMongoDB(MongoGridFS* gfs, string filename, int row, int col, int nRows, int nCols,
+                               bool calcPositions = true, T defalutValue = (T) NODATA_VALUE);
+
+    /*!
+     * \brief Read many rasters from the same GridFS concurrently, e.g., the parameters of a model
+     * Each thread pops a client from the pool and reads the rasters one by one, so the latencies
+     * of the rasters are overlapped. The mask is shared by all rasters, including its positions.
+     * The mask and the rasters read are pinned until all rasters are read, \sa clsRasterManager.
+     * \param[in] pool Client pool of MongoDB, \a mongoc_client_pool_t
+     * \param[in] dbName Database name
+     * \param[in] gfsName GridFS name, i.e., the prefix of the collections
+     * \param[in] filenames Raster file names
+     * \param[in] mask \a clsRasterData<MaskT> Mask layer shared by all rasters
+     * \param[in] calcPositions Calculate positions of valid cells excluding NODATA. The default is true.
+     * \param[in] useMaskExtent Use mask layer extent, even NoDATA exists.
+     * \param[in] defalutValue Default value
+     * \param[in] nThreads Number of concurrent reads, i.e., the clients popped from the pool,
+     *                     0 means the maximum threads of OpenMP
+     * \return Rasters keyed by file name, the failed ones (e.g., missing or corrupted) are absent.
+     *         The caller should release the rasters.
+     */
+    static map<string, clsRasterData<T, MaskT> *> BatchReadFromMongoDB(mongoc_client_pool_t *pool,
+                                                                     const string &dbName, const string &gfsName,
+                                                                     const vector<string> &filenames,
+                                                                     clsRasterData<MaskT> *mask = NULL,
+                                                                     bool calcPositions = true,
+                                                                     bool useMaskExtent = true,
+                                                                     T defalutValue = (T) NODATA_VALUE,
+                                                                     int nThreads = 0);
 #endif /* USE_MONGODB */
+
+    /*!
+     * \brief Read raster data from the native binary file (*.rsb) by memory mapping
+     * The raster data and positions are used in place (zero copy), and the mapped pages are
+     * copy-on-write, i.e., modification of the raster never changes the file.
+     * \param[in] filename \a string
+     * \param[in] mask \a clsRasterData<MaskT>, optional. The positions of mask are shared
+     *                 if they are the same as the positions stored in the file.
+     * \param[in] defalutValue Default value
+     * \return false if the file is invalid or the data type is not \a T.
+     */
+    bool ReadNativeFile(string filename, clsRasterData<MaskT> *mask = NULL, T defalutValue = (T) NODATA_VALUE);
+
+    /*!
+     * \brief Attach the raster published into named shared memory, e.g., by another process
+     * The raster data, positions, and header are used in place (zero copy), the same as \a ReadNativeFile(),
+     * and the mapped pages are copy-on-write, i.e., modification of the raster never changes the shared memory.
+     * The attached raster stays valid after the publisher removes the shared memory.
+     * \param[in] name Name of the shared memory, \sa outputToSharedMemory()
+     * \param[in] mask \a clsRasterData<MaskT>, optional. The positions of mask are shared
+     *                 if they are the same as the published positions.
+     * \param[in] defalutValue Default value
+     * \return false if the shared memory does not exist, or the data type is not \a T.
+     */
+    bool ReadFromSharedMemory(string name, clsRasterData<MaskT> *mask = NULL, T defalutValue = (T) NODATA_VALUE);
+
+    /*!
+     * \brief Open raster file lazily, i.e., read the header and SRS only
+     * The raster data and positions are read (as \a ReadFromFile) on the first data access,
+     * e.g., getValue(), getRasterDataPointer(), getCellNumber(), and statistics, which is thread-safe.
+     * If a mask is given with \a useMaskExtent, the header is the same as the mask, otherwise the
+     * header of the file is returned until the data is read.
+     * \param[in] filename \a string, ASC, native, or other GDAL supported raster file
+     * \param[in] calcPositions Calculate positions of valid cells excluding NODATA. The default is true.
+     * \param[in] mask \a clsRasterData<MaskT>
+     * \param[in] useMaskExtent Use mask layer extent, even NoDATA exists.
+     * \param[in] defalutValue Default value
+     * \return false if the file does not exist or the header is invalid.
+     */
+    bool ReadHeaderOnly(string filename, bool calcPositions = true, clsRasterData<MaskT> *mask = NULL,
+                        bool useMaskExtent = true, T defalutValue = (T) NODATA_VALUE);
+
+    //! Has the data been read, i.e., not opened lazily or already accessed?
+    bool isMaterialized(void) const { return !m_lazyPending.load(); }
+
     /************* Write functions ***************/
 
     /*!
      * \brief Write raster to raster file, if 2D raster, output name will be filename_LyrNum
-     * \param filename filename with prefix, e.g. ".asc" and ".tif"
+     * \param filename filename with prefix, e.g. ".asc", ".tif", and ".rsb"
+     * \param options Creation options for GeoTIFF output, which is ignored by ASC output.
+     * \return false if failed.
      */
-    void outputToFile(string filename);
+    bool outputToFile(string filename, const GTiffWriteOptions &options = GTiffWriteOptions());
 
     /*!
      * \brief Write 1D or 2D raster data into ASC file(s)
      * \param[in] filename \a string, output ASC file path, take the CoreName as prefix
+     * \return false if failed.
      */
-    void outputASCFile(string filename);
+    bool outputASCFile(string filename);
 
     /*!
      * \brief Write 1D or 2D raster data into TIFF file by GDAL
+     * The output data type is the type of raster data (e.g., int as Int32) unless \a options.dataType is set.
+     * Types which have no equivalent GDAL type are written as Float32.
+     * 2D raster is written as one file per layer (filename_LyrNum), or as one multi-band file
+     * if \a options.multiBand is true.
      * \param[in] filename \a string, output TIFF file path
+     * \param[in] options Creation options, e.g., tiling, compression, threads, and data type.
+     * \return false if failed.
+     */
+    bool outputFileByGDAL(string filename, const GTiffWriteOptions &options = GTiffWriteOptions());
+
+    /*!
+     * \brief Write 1D or 2D raster data into the native binary file (*.rsb) with the valid cell index
+     * \sa NativeRasterHeader, ReadNativeFile
+     * \param[in] filename \a string, output file path
+     * \return false if failed.
+     */
+    bool outputNativeFile(string filename);
+
+    /*!
+     * \brief Publish 1D or 2D raster data into named shared memory in the native binary layout
+     * Other processes on the machine attach it read-only by \a ReadFromSharedMemory().
+     * The shared memory is a snapshot owned by this raster, which is removed when this raster is released
+     * or published again, while the attached rasters keep the memory until they are released.
+     * \param[in] name Name of the shared memory, unique on the machine, e.g., "dem_1"
+     * \return false if the positions are not available, or the name exists.
      */
-    void outputFileByGDAL(string filename);
+    bool outputToSharedMemory(string name);
+
+    /*!
+     * \brief Write raster data into blob store, e.g., GridFS or local directory, with options
+     * The full-sized data is written by strips of rows, i.e., one piece at a time.
+     * The data type is recorded as \a HEADER_RS_DATATYPE in the metadata.
+     * The layout of valid cells (\a BLOB_LAYOUT_VALID) stores the row runs of the valid cells, i.e.,
+     * int32 [NRUNS][3] of row, start col, and cell number, followed by the values of the valid cells
+     * in row-major order. The full-sized layout is written if the positions of valid cells are not available.
+     * The compressed data is decompressed transparently by \a ReadFromBlobStore(), \sa clsBlobWriter.
+     * The tiled layout stores an index blob with the header and the valid cell number of each tile, and
+     * a full-sized tile blob of each layer for the tiles containing valid cells, \sa GetRasterTileName().
+     * The tiles of each write are named by a new write id, and the tiles of the replaced blob are removed
+     * after the index is replaced, so that the readers of the old index never read the new tiles.
+     * \param[in] filename Blob name of raster
+     * \param[in] store \a clsRasterBlobStore
+     * \param[in] options \a BlobWriteOptions
+     * \return false if failed.
+     */
+    bool outputToBlobStore(string filename, clsRasterBlobStore* store, const BlobWriteOptions &options);
 
 #ifdef USE_MONGODB
     /*!
      * \brief Write raster data (matrix raster data) into MongoDB
      * \param[in] filename \a string, output file name
      * \param[in] gfs \a mongoc_gridfs_t
+     * \param[in] dataType Data type of the stored values, \a GDT_Unknown means the type of raster data,
+     *                     i.e., \a GDALDataTypeOf<T>, and Float64 for other types.
+     * \return false if failed.
+     */
+    bool outputToMongoDB(string filename, MongoGridFS* gfs, GDALDataType dataType = GDT_Unknown);
+
+    /*!
+     * \brief Write raster data into MongoDB with options, \sa outputToBlobStore()
+     * \param[in] filename \a string, output file name
+     * \param[in] gfs \a mongoc_gridfs_t
+     * \param[in] options \a BlobWriteOptions
+     * \return false if failed.
      */
-    void outputToMongoDB(string filename, MongoGridFS* gfs);
+    bool outputToMongoDB(string filename, MongoGridFS* gfs, const BlobWriteOptions &options);
 #endif /* USE_MONGODB */
 
     /************************************************************************/
@@ -245,6 +701,18 @@ public:
     /************************************************************************/
 
     void setCoreName(string name) { m_coreFileName = name; }
+
+    /*!
+     * \brief Set NODATA value, the stored cells of the previous NODATA value are not changed
+     */
+    void setNoDataValue(T noData) {
+        m_noDataValue = noData;
+        m_headers[HEADER_RS_NODATA] = (double) noData;
+    }
+
+    //! Set the spatial reference
+    void setSRS(const string &srs) { m_srs = srs; }
+
     /************************************************************************/
     /*    Get information functions                                         */
     /************************************************************************/
@@ -369,30 +837,54 @@ public:
     }
 
     //! Get stored cell number of raster data
-    int getCellNumber(void) const { return m_nCells; }
+    int getCellNumber(void) const {
+        this->_materialize();
+        return m_nCells;
+    }
 
     //! Get column number of raster data
-    int getCols(void) const { return (int) m_headers.at(HEADER_RS_NCOLS); }
+    int getCols(void) const {
+        unique_lock<recursive_mutex> lock = this->_lock_if_pending();
+        return (int) m_headers.at(HEADER_RS_NCOLS);
+    }
 
     //! Get row number of raster data
-    int getRows(void) const { return (int) m_headers.at(HEADER_RS_NROWS); }
+    int getRows(void) const {
+        unique_lock<recursive_mutex> lock = this->_lock_if_pending();
+        return (int) m_headers.at(HEADER_RS_NROWS);
+    }
 
     //! Get cell size of raster data
-    float getCellWidth(void) const { return (float) m_headers.at(HEADER_RS_CELLSIZE); }
+    float getCellWidth(void) const {
+        unique_lock<recursive_mutex> lock = this->_lock_if_pending();
+        return (float) m_headers.at(HEADER_RS_CELLSIZE);
+    }
 
     //! Get X coordinate of left lower corner of raster data
-    double getXllCenter(void) const { return m_headers.at(HEADER_RS_XLL); }
+    double getXllCenter(void) const {
+        unique_lock<recursive_mutex> lock = this->_lock_if_pending();
+        return m_headers.at(HEADER_RS_XLL);
+    }
 
     //! Get Y coordinate of left lower corner of raster data
-    double getYllCenter(void) const { return m_headers.at(HEADER_RS_YLL); }
+    double getYllCenter(void) const {
+        unique_lock<recursive_mutex> lock = this->_lock_if_pending();
+        return m_headers.at(HEADER_RS_YLL);
+    }
 
     //! Get the first dimension size of raster data
-    int getDataLength(void) const { return m_nCells; }
+    int getDataLength(void) const {
+        this->_materialize();
+        return m_nCells;
+    }
 
     int getLayers(void) const { return m_nLyrs; }
 
     //! Get NoDATA value of raster data
-    T getNoDataValue(void) const { return (T) m_headers.at(HEADER_RS_NODATA); }
+    T getNoDataValue(void) const {
+        unique_lock<recursive_mutex> lock = this->_lock_if_pending();
+        return (T) m_headers.at(HEADER_RS_NODATA);
+    }
 
     //! Get position index in 1D raster data for specific row and column, return -1 is error occurs.
     int getPosition(int row, int col);
@@ -413,17 +905,29 @@ public:
      */
     bool get2DRasterData(int *nRows, int *nCols, T ***data);
 
-    //! Get raster header information
-    const map<string, double> &getRasterHeader(void) const { return m_headers; }
+    //! Get a copy of raster header information, which is consistent even if the raster is being read lazily
+    map<string, double> getRasterHeader(void) const {
+        unique_lock<recursive_mutex> lock = this->_lock_if_pending();
+        return m_headers;
+    }
 
     //! Get raster statistics information
-    const map<string, double> &getStatistics(void) const { return m_statsMap; }
+    const map<string, double> &getStatistics(void) const {
+        this->_materialize();
+        return m_statsMap;
+    }
 
     //! Get full path name
-    string getFilePath(void) const { return m_filePathName; }
+    string getFilePath(void) const {
+        unique_lock<recursive_mutex> lock = this->_lock_if_pending();
+        return m_filePathName;
+    }
 
     //! Get core name
-    string getCoreName(void) const { return m_coreFileName; }
+    string getCoreName(void) const {
+        unique_lock<recursive_mutex> lock = this->_lock_if_pending();
+        return m_coreFileName;
+    }
 
     /*!
      * \brief Get position index data and the data length
@@ -432,20 +936,83 @@ public:
      */
     void getRasterPositionData(int &datalength, int ***positiondata);
 
-    //! Get pointer of raster data
-    T *getRasterDataPointer(void) const { return m_rasterData; }
+    /*!
+     * \brief Get pointer of raster data
+     * The derived data, e.g., statistics and summed-area tables, is not updated after writing through
+     * the pointer, call updateStatistics() then.
+     */
+    T *getRasterDataPointer(void) const {
+        this->_materialize();
+        return m_rasterData;
+    }
 
     //! Get pointer of position data
-    int **getRasterPositionDataPointer(void) const { return m_rasterPositionData; }
+    int **getRasterPositionDataPointer(void) const {
+        this->_materialize();
+        return m_rasterPositionData;
+    }
 
-    //! Get pointer of 2D raster data
-    T **get2DRasterDataPointer(void) const { return m_raster2DData; }
+    //! Get pointer of 2D raster data, \sa getRasterDataPointer()
+    T **get2DRasterDataPointer(void) const {
+        this->_materialize();
+        return m_raster2DData;
+    }
+
+    /*!
+     * \brief Get the 8-neighbor index table of the stored cells, build it if necessary
+     * The table is a 1D array with the length of m_nCells * 8, the neighbors of the i-th cell are
+     * stored in [i * 8, i * 8 + 7] following the order of \a D8_DELTA_ROW and \a D8_DELTA_COL,
+     * and -1 means the neighbor is out of the stored cells.
+     * The table is built only once per mask, i.e., rasters that share the position data of the mask
+     * also share the table of the mask. Concurrent calls are safe, the table is built by the first one.
+     * \return NULL if the positions of the stored cells are not available.
+     */
+    const int *getNeighborIndex(void);
+
+    /*!
+     * \brief Release the 8-neighbor index table if exists
+     */
+    void releaseNeighborIndex(void);
+
+    /*!
+     * \brief Reorder the stored valid cells along a space-filling curve to improve the locality
+     *        of neighborhood access. Writers restore the grid order transparently.
+     * Only the raster which owns its position data (e.g., a mask) and whose positions are not shared
+     * by other rasters can be reordered, \sa getPositionOwner(). Rasters read with the reordered mask
+     * afterward follow the order of the mask.
+     * \param[in] ordering \a CellOrdering
+     * \param[in] tileSize Tile size for \a CELL_ORDER_TILED
+     * \return true if succeed.
+     */
+    bool reorderCells(CellOrdering ordering, int tileSize = 64);
+
+    //! Get the storage order of the valid cells
+    CellOrdering getCellOrdering(void) const { return m_cellOrdering; }
+
+    /*!
+     * \brief Get the raster whose positions define the stored order of this raster, i.e., the mask
+     *        whose positions are shared, NULL if the raster owns its positions or has no mask.
+     */
+    const clsManagedRaster *getPositionOwner(void) const;
+
+    //! Get the map from stored cell index to the row-major index, NULL if stored by row-major
+    const int *getOrderToRowMajor(void) const { return m_toRowMajor; }
+
+    //! Get the map from the row-major index to stored cell index, NULL if stored by row-major
+    const int *getOrderFromRowMajor(void) const { return m_fromRowMajor; }
 
     //! Get the spatial reference
-    const char *getSRS(void) { return m_srs.c_str(); }
+    const char *getSRS(void) {
+        /// the pointer should be stable, so the data of lazily opened raster is read first, \sa getSRSString()
+        this->_materialize();
+        return m_srs.c_str();
+    }
 
     //! Get the spatial reference string
-    string getSRSString(void) { return m_srs; }
+    string getSRSString(void) {
+        unique_lock<recursive_mutex> lock = this->_lock_if_pending();
+        return m_srs;
+    }
 
     /*! 
      * \brief Get raster data at the valid cell index
@@ -469,6 +1036,7 @@ public:
 
     /*!
      * \brief Set value to the given position and layer
+     * The cell not stored by the raster with positions, e.g., NODATA excluded, is ignored.
      */
     void setValue(RowColCoor pos, T value, int lyr = 1);
 
@@ -502,7 +1070,10 @@ public:
     bool is2DRaster(void) const { return m_is2DRaster; }
 
     //! Calculate positions or not
-    bool PositionsCalculated() const { return m_calcPositions; }
+    bool PositionsCalculated() const {
+        this->_materialize();
+        return m_calcPositions;
+    }
 
     //! Use mask extent or not
     bool MaskExtented(void) const { return m_useMaskExtent; }
@@ -515,6 +1086,59 @@ public:
     //! Get mask data pointer
     clsRasterData<MaskT> *getMask(void) const { return m_mask; }
 
+    //! Is the raster data mapped from the native binary file or a scratch file?
+    bool isMemoryMapped(void) const { return m_mappedFile != NULL; }
+
+    /*!
+     * \brief Move the raster data and positions into a memory-mapped scratch file, i.e., out-of-core storage
+     * The pages are loaded and written back by the OS on demand, so the raster may exceed the physical memory.
+     * All functions work unchanged, and the scratch file is removed when the raster is released.
+     * Positions shared with the mask are not moved.
+     * \param[in] directory Directory of the scratch file, the default is the temporary directory
+     * \param[in] sequential Access pattern hint, \sa adviseAccessPattern()
+     * \return false if the raster is already mapped, or the scratch file cannot be created.
+     */
+    bool moveToScratchFile(string directory = "", bool sequential = true);
+
+    /*!
+     * \brief Bytes of the raster data and owned positions allocated in memory, \sa clsRasterManager
+     * The data mapped from files and the positions shared with mask are not counted.
+     * The raster being read by another thread returns the footprint measured last time.
+     */
+    int64_t getFootprint(void) const;
+
+    /*!
+     * \brief Write the raster data into a spill file and release it, which is read back on the next access
+     * The positions are kept, and the pointers of raster data got before are invalid.
+     * \return Bytes released, 0 if pinned, being read, not read yet, or mapped from files.
+     */
+    int64_t evict(void);
+
+    //! Lock the raster if it is not being constructed or read by another thread, \sa clsRasterManager
+    bool tryLockStorage(void) const { return m_materializeMutex.try_lock(); }
+
+    //! Unlock the raster locked by \a tryLockStorage()
+    void unlockStorage(void) const { m_materializeMutex.unlock(); }
+
+    //! Is the raster data evicted into the spill file?
+    bool isEvicted(void) const { return !m_spillFile.empty(); }
+
+    /*!
+     * \brief Advise the OS on the access pattern of the mapped data, e.g., read ahead for sequential access
+     * \param[in] sequential True for iterating cells in the stored order, false for random access
+     */
+    void adviseAccessPattern(bool sequential) const {
+        if (m_mappedFile != NULL) m_mappedFile->advise(sequential);
+    }
+
+    /*!
+     * \brief Get the hash of the identity and header of the file from which the positions are calculated,
+     *        i.e., read from local file without mask, which is calculated only if the index cache is enabled,
+     *        \sa clsRasterIndexCache::setDirectory(), clsRasterIndexCache::fileIdentity()
+     * \return 0 if not calculated.
+     */
+    uint64_t getContentHash(void) const { return m_contentHash; }
+
     /*!
      * \brief Copy clsRasterData object
      */
@@ -529,6 +1153,80 @@ public:
      * \brief classify raster
      */
     void reclassify(map<int, T> reclassMap);
+
+    /************* Window query functions ***************/
+
+    /*!
+     * \brief Build the summed-area table and valid-count table of the given layer, if not built yet.
+     * The tables are cached and released automatically when the data is changed by the mutators,
+     * e.g., setValue(), replaceNoData(), reclassify(), and updateStatistics(). The data written through
+     * the pointers, e.g., getRasterDataPointer(), is not tracked, so call updateStatistics() or
+     * releaseSummedAreaTables() after that. Concurrent calls are safe, the table is built by the first one.
+     * \param[in] lyr optional for 1D and the first layer of 2D raster data.
+     * \return true if succeed.
+     */
+    bool buildSummedAreaTable(int lyr = 1);
+
+    //! Release the summed-area tables of all layers
+    void releaseSummedAreaTables(void);
+
+    /*!
+     * \brief Get the sum of valid values in the rectangular window in constant time.
+     * The window is from (row0, col0) to (row1, col1), both inclusive, and clipped by the raster extent.
+     * \sa buildSummedAreaTable()
+     */
+    double windowSum(int row0, int col0, int row1, int col1, int lyr = 1);
+
+    /*!
+     * \brief Get the number of valid cells in the rectangular window in constant time.
+     * \sa windowSum()
+     */
+    int windowCount(int row0, int col0, int row1, int col1, int lyr = 1);
+
+    /*!
+     * \brief Get the mean of valid values in the rectangular window in constant time.
+     * \return NODATA_VALUE if no valid cell in the window
+     * \sa windowSum()
+     */
+    double windowMean(int row0, int col0, int row1, int col1, int lyr = 1);
+
+    /*!
+     * \brief Build the blockwise min/max quadtree pyramid of the given layer, if not built yet.
+     * The level 0 of the pyramid stores the min/max of each square block of cells, and each upper
+     * level merges 2 * 2 nodes of the lower level. setValue() marks the block as modified and the
+     * pyramid is updated incrementally before the next query, other mutators release the pyramid.
+     * \param[in] lyr optional for 1D and the first layer of 2D raster data.
+     * \param[in] blockSize Block size in cells, which is used by the first built layer.
+     * \return true if succeed.
+     */
+    bool buildMinMaxPyramid(int lyr = 1, int blockSize = 32);
+
+    //! Release the min/max pyramids of all layers
+    void releaseMinMaxPyramids(void);
+
+    /*!
+     * \brief Get the minimum of valid values in the rectangular window, skipping blocks by the pyramid.
+     * The window is from (row0, col0) to (row1, col1), both inclusive, and clipped by the raster extent.
+     * \return NODATA_VALUE if no valid cell in the window
+     * \sa buildMinMaxPyramid()
+     */
+    double windowMinimum(int row0, int col0, int row1, int col1, int lyr = 1);
+
+    /*!
+     * \brief Get the maximum of valid values in the rectangular window
+     * \sa windowMinimum()
+     */
+    double windowMaximum(int row0, int col0, int row1, int col1, int lyr = 1);
+
+    /*!
+     * \brief Extract the stored cells whose values exceed the threshold, skipping blocks by the pyramid.
+     * \param[in] threshold Threshold value
+     * \param[out] cells Indexes of the stored cells, sorted ascending
+     * \param[in] above Extract values greater than threshold if true, otherwise less than threshold.
+     * \param[in] lyr optional for 1D and the first layer of 2D raster data.
+     * \return the number of extracted cells
+     */
+    int extractByThreshold(double threshold, vector<int> &cells, bool above = true, int lyr = 1);
     /************* Utility functions ***************/
 
     /*!
@@ -621,35 +1319,361 @@ private:
      */
     void _calculate_valid_positions_from_grid_data(void);
 
+    /*!
+     * \brief Get the positions of the stored cells
+     * \param[out] positions Position data, NULL if all grid cells are stored row by row.
+     * \return false if the positions are not available.
+     */
+    bool _get_stored_positions(int ***positions);
+
+    /*!
+     * \brief Release all data derived from the raster values, e.g., summed-area tables
+     */
+    void _release_derived_data(void);
+
+    /*!
+     * \brief Release raster data and positions, which may be allocated or mapped from the native file
+     */
+    void _release_storage(void);
+
+    /*!
+     * \brief Read the data of the lazily opened or evicted raster if not read yet, \sa ReadHeaderOnly(), evict()
+     * Only the access clock and an atomic flag are checked once the data is read.
+     */
+    void _materialize(void) const {
+        this->_touch();
+        if (m_lazyPending.load(memory_order_acquire)) {
+            const_cast<clsRasterData<T, MaskT> *>(this)->_materialize_data();
+        }
+    }
+
+    /*!
+     * \brief Read the data of the lazily opened raster, which is serialized by \a m_materializeMutex
+     * The header, SRS, and file name are rewritten while reading, so their getters wait for it,
+     * \sa _lock_if_pending()
+     */
+    void _materialize_data(void);
+
+    /*!
+     * \brief Lock \a m_materializeMutex if the raster is not read yet, so that the header read by
+     *        getters is not being rewritten by \a _materialize_data() in another thread.
+     * No lock is needed once the data is read, since the header is not rewritten by transparent reloads.
+     */
+    unique_lock<recursive_mutex> _lock_if_pending(void) const {
+        unique_lock<recursive_mutex> lock(m_materializeMutex, defer_lock);
+        if (m_lazyPending.load(memory_order_acquire)) lock.lock();
+        return lock;
+    }
+
+    /*!
+     * \brief Read the evicted raster data back from the spill file, which is removed, \sa evict()
+     */
+    void _read_spill_file(void);
+
+    /*!
+     * \brief Set header information from the header of native binary file
+     */
+    void _copy_native_header(const NativeRasterHeader &header);
+
+    /*!
+     * \brief Check the sizes and sections of native binary header against the size of file or memory
+     * \return Error message, empty if all sections are within the size.
+     */
+    static string _check_native_sections(const NativeRasterHeader &header, int64_t size);
+
+    /*!
+     * \brief Get the native binary layout of the raster, \sa NativeRasterHeader
+     * \param[out] header Header with the offsets of all sections
+     * \param[out] runs Row runs of the stored cells
+     * \param[out] positions Positions of the stored cells, \sa _get_stored_positions()
+     * \param[out] order Stored order of each cell in row-major order, NULL if stored in row-major order
+     * \return false if the positions are not available.
+     */
+    bool _get_native_layout(NativeRasterHeader &header, vector<int32_t> &runs, int ***positions, const int **order);
+
+    /*!
+     * \brief Write the sections after the header of the native binary layout
+     * \param[in] out Output with seekp() and write(), e.g., ofstream or \a NativeMemoryWriter
+     */
+    template<typename StreamT>
+    void _write_native_sections(StreamT &out, const NativeRasterHeader &header, const vector<int32_t> &runs,
+                                int **positions, const int *order);
+
+    /*!
+     * \brief Use the raster mapped in the native binary layout, which is owned by the raster if succeed
+     * \param[in] mapped Mapped native file or shared memory, which is deleted if failed
+     * \param[in] source Description of the mapped source in error messages
+     * \param[in] exactSize The mapped size should be the same as the size in header, otherwise not less
+     */
+    bool _attach_native_layout(clsMemoryMap *mapped, const string &source, bool exactSize);
+
+    /*!
+     * \brief Calculate the hash of the identity and header of the file just read, i.e., the key of index cache
+     * \return 0 if the cache is disabled, or the positions are not calculated from the file only.
+     */
+    uint64_t _calculate_content_hash(void);
+
+    /*!
+     * \brief Extract valid cells of the full grid data by row runs, e.g., cached by \a clsRasterIndexCache
+     * \param[in] runs Row runs of the valid cells, i.e., row, start col, and cell number of each run
+     * \return false if the runs are out of the extent, and nothing is changed.
+     */
+    bool _compact_by_row_runs(const vector<int32_t> &runs);
+
+    /*!
+     * \brief Read raster data from the opened blob, \sa ReadFromBlobStore()
+     * \return false if the blob is corrupted or inconsistent with mask.
+     */
+    bool _read_blob(clsRasterBlobStore *store, const string &filename, clsBlobReader &reader);
+
+    /*!
+     * \brief Key of the node-local cache, which is derived from the identity of blob and the read options
+     * \return 0 if the cache is disabled or the raster is not cacheable, \sa clsRasterBlobCache
+     */
+    uint64_t _blob_cache_key(const string &identity);
+
+    /*!
+     * \brief Map the cached native binary file of the raster read from blob store
+     * \return false if not cached, and the read options should be initialized again.
+     */
+    bool _load_blob_cache(uint64_t cachekey);
+
+    /*!
+     * \brief Get the row runs of the stored cells in row-major order
+     * \param[in] positions Positions of the stored cells, \sa _get_stored_positions()
+     * \param[out] runs Row runs, i.e., row, start col, and cell number of each run
+     */
+    void _get_row_runs(int **positions, vector<int32_t> &runs);
+
+    /*!
+     * \brief Build the positions of valid cells from row runs, which are owned by the raster
+     * \param[in] runs Row runs of the valid cells, i.e., int32 [nRuns][3]
+     * \param[in] nRuns Number of row runs
+     * \return Valid cell number, -1 if the runs are out of the extent, and nothing is changed.
+     */
+    int _build_positions_by_row_runs(const int32_t *runs, int nRuns);
+
+    /*!
+     * \brief Are the positions of valid cells the same as the mask, i.e., can they be shared?
+     * \param[in] positions Positions in row-major order, i.e., int32 [m_nCells][2]
+     */
+    bool _is_same_as_mask_positions(const int32_t *positions);
+
+    /*!
+     * \brief Clip the window by raster extent and convert it to the corners of summed-area table
+     * \return false if the window is out of extent or the table is not available.
+     */
+    bool _clip_window(int &row0, int &col0, int &row1, int &col1, int lyr);
+
+    /*!
+     * \brief Recalculate the min/max of modified blocks and their ancestors in the pyramid
+     * The caller should hold \a m_materializeMutex, \sa buildMinMaxPyramid()
+     */
+    void _update_min_max_pyramid(int lyr);
+
+    /*!
+     * \brief Get the min and max of valid values of the pyramid node that intersects the window
+     * \param[in] level Level of the node, 0 is the block level.
+     * \param[in] brow Row of the node in the given level
+     * \param[in] bcol Column of the node in the given level
+     * \param[in] window Window in cells, i.e., row0, col0, row1, col1, inclusive.
+     * \param[in,out] minmax Min and max values
+     */
+    void _query_min_max_pyramid(int lyr, int level, int brow, int bcol, const int *window, double *minmax);
+
+    /*!
+     * \brief Get the map from the row-major index to stored cell index for the given position data
+     * \return NULL if stored by row-major
+     */
+    const int *_get_row_major_order(int **positions);
+
+    /*!
+     * \brief Build the maps between the stored order and the row-major order of the owned positions
+     * The maps are released if the positions are in row-major order already.
+     * \param[in] ordering \a CellOrdering of the positions if not row-major
+     */
+    void _build_row_major_order(CellOrdering ordering);
+
     /*!
      * \brief Write raster header information into ASC file
      * If the file exists, delete it first.
      * \param[in] filename \a string, output ASC file path
      * \param[in] header header information
+     * \return false if failed.
      */
-    void _write_ASC_headers(string filename, map<string, double> &header);
+    bool _write_ASC_headers(string filename, map<string, double> &header);
 
     /*!
-     * \brief Write single geotiff file
-     * If the file exists, delete it first.
-     * \param[in] filename \a string, output ASC file path
-     * \param[in] header header information
-     * \param[in] srs Coordinate system string
-     * \param[in] values float raster data array
+     * \brief Create geotiff file with header information, NODATA value, and coordinate system
+     * \param[in] filename \a string, output TIFF file path
+     * \param[in] nBands Band number
+     * \param[in] outType Data type of the output band
+     * \param[in] options Creation options
+     * \return GDAL dataset which should be closed by GDALClose(), NULL if failed.
      */
-    void _write_single_geotiff(string filename, map<string, double> &header, string srs, float *values);
+    GDALDataset *_create_geotiff(string filename, int nBands, GDALDataType outType,
+                                 const GTiffWriteOptions &options);
 
-#ifdef USE_MONGODB
     /*!
-     * \brief Write full-sized raster data as GridFS file
-     * If the file exists, delete it first.
-     * \param[in] filename \a string, GridFS file name
-     * \param[in] header header information
-     * \param[in] srs Coordinate system string
-     * \param[in] values float raster data array
+     * \brief Write layers of raster data as bands of one geotiff file by row strips
+     * Valid cells are walked in row-major order and scattered into a strip buffer of \a BufT
+     * whose height is the block height of the file, so peak memory is proportional to the block
+     * rather than the full grid. If \a BufT is the same as \a T and no position index is used,
+     * \a m_rasterData is written directly.
+     * \param[in] filename \a string, output TIFF file path
+     * \param[in] position Position index of valid cells, NULL if the full grid is stored
+     * \param[in] order Row-major order of stored cells, \sa _get_row_major_order()
+     * \param[in] firstLyr The first layer (start from 0) of 2D raster to be written
+     * \param[in] nBands Band number, i.e., layers from \a firstLyr
+     * \param[in] outType Data type of the output band
+     * \param[in] options Creation options
+     * \return false if failed.
      */
-    void _write_stream_data_as_gridfs(MongoGridFS* gfs, string filename, map<string, double>& header, string srs, T *values, size_t datalength);
-#endif /* USE_MONGODB */
+    template<typename BufT>
+    bool _write_geotiff_strips(string filename, int **position, const int *order, int firstLyr, int nBands,
+                               GDALDataType outType, const GTiffWriteOptions &options);
+
+    /*!
+     * \brief Write 1D or 2D raster data into TIFF file(s) by a strip buffer of \a BufT
+     * \param[in] filename \a string, output TIFF file path
+     * \param[in] outType Data type of the output band
+     * \param[in] options Creation options
+     * \return false if failed.
+     */
+    template<typename BufT>
+    bool _output_geotiff(string filename, GDALDataType outType, const GTiffWriteOptions &options);
+
+    /*!
+     * \brief Get NODATA value of the output, which is representable by \a outType and the buffer type
+     * \sa GDALRepresentableNoData
+     */
+    double _output_nodata(GDALDataType outType) const;
+
+    /*!
+     * \brief Convert value to the output buffer, NODATA is replaced by \a noDataValue if \a remap is true
+     */
+    template<typename BufT>
+    BufT _output_value(T value, bool remap, BufT noDataValue) const {
+        return remap && FloatEqual(value, m_noDataValue) ? noDataValue : (BufT) value;
+    }
+
+    /*!
+     * \brief Append header information, SRS, and data type to the metadata of blob
+     * The NODATA value is mapped into the range of \a dataType, \sa _output_nodata()
+     * \param[out] meta Metadata
+     * \param[in] dataType Data type of the stored values
+     */
+    void _append_blob_metadata(BlobMetadata &meta, GDALDataType dataType);
+
+    /*!
+     * \brief Write full-sized raster data as blob by strips
+     * \tparam BufT Type of the strip buffer, i.e., T, or double if T is not a GDAL data type
+     * \param[in] outType Data type of the stored values, converted from BufT by \a GDALCopyWords
+     * \param[in] level zlib level of the compressed frames, -1 if not compressed
+     * \return false if failed.
+     */
+    template<typename BufT>
+    bool _output_blob(string filename, clsRasterBlobStore* store, GDALDataType outType, int level);
+
+    /*!
+     * \brief Write the row runs and values of the valid cells as blob, \sa BLOB_LAYOUT_VALID
+     * \tparam BufT Type of the value buffer, i.e., T, or double if T is not a GDAL data type
+     * \param[in] positions Positions of the valid cells, \sa _get_stored_positions()
+     * \param[in] outType Data type of the stored values, converted from BufT by \a GDALCopyWords
+     * \param[in] level zlib level of the compressed frames, -1 if not compressed
+     * \return false if failed.
+     */
+    template<typename BufT>
+    bool _output_blob_valid_cells(string filename, clsRasterBlobStore* store, int **positions,
+                                  GDALDataType outType, int level);
+
+    /*!
+     * \brief Write raster data as tiles and the tile index, \sa BLOB_LAYOUT_TILED
+     * The index is written after all tiles, so that the tiles are complete once the index is found.
+     * \tparam BufT Type of the tile buffer, i.e., T, or double if T is not a GDAL data type
+     * \param[in] positions Positions of the stored cells, NULL if all grid cells are stored row by row
+     * \param[in] outType Data type of the stored values, converted from BufT by \a GDALCopyWords
+     * \param[in] level zlib level of the compressed tiles, -1 if not compressed
+     * \param[in] tileSize Tile size in cells
+     * \return false if failed.
+     */
+    template<typename BufT>
+    bool _output_blob_tiles(string filename, clsRasterBlobStore* store, int **positions, GDALDataType outType,
+                            int level, int tileSize);
+
+    /*!
+     * \brief Get the blob names of the tiles of a tiled blob, \sa BLOB_LAYOUT_TILED
+     * \param[in] store \a clsRasterBlobStore
+     * \param[in] filename Blob name of the tile index
+     * \param[out] names Tile blob names
+     * \return false if the blob does not exist or is not tiled.
+     */
+    static bool _get_tile_names(clsRasterBlobStore* store, const string &filename, vector<string> &names);
+
+    /*!
+     * \brief Read the stored values of blob into the allocated raster data piece by piece
+     * The values are read into the raster data directly if the stored type is T and the raster is 1D,
+     * otherwise converted by \a GDALCopyWords.
+     * \tparam BufT Type of the converted values, i.e., T, or double if T is not a GDAL data type
+     * \param[in] reader Opened blob
+     * \param[in] srcType Data type of the stored values
+     * \param[in] nValues Number of the stored values
+     * \return false if the blob is truncated.
+     */
+    template<typename BufT>
+    bool _read_blob_values(clsBlobReader &reader, GDALDataType srcType, size_t nValues);
+
+    /*!
+     * \brief Read the blob of valid cells only, \sa BLOB_LAYOUT_VALID
+     * The positions are rebuilt from the row runs, or shared with the mask if they are the same.
+     * Otherwise, the valid cells are expanded to the full grid and extracted by mask,
+     * i.e., the same as the full-sized layout.
+     * \param[in] reader Opened blob
+     * \param[in] meta Metadata of the blob
+     * \param[in] srcType Data type of the stored values
+     * \return false if the blob is corrupted.
+     */
+    bool _read_blob_valid_cells(clsBlobReader &reader, const BlobMetadata &meta, GDALDataType srcType);
+
+    /*!
+     * \brief Scatter the valid cells into the full grid filled by NODATA, and release the positions
+     */
+    void _expand_valid_cells_to_grid(void);
+
+    /*!
+     * \brief Read the header, SRS, and data type from the metadata of blob
+     * \param[in] meta Metadata of the blob
+     * \param[in] filename Blob name
+     * \param[out] srcType Data type of the stored values
+     * \return false if the data type is not supported.
+     */
+    bool _read_blob_header(const BlobMetadata &meta, const string &filename, GDALDataType &srcType);
+
+    /*!
+     * \brief Read the intersecting tiles of the window as full-sized raster data of the window
+     * \param[in] store \a clsRasterBlobStore
+     * \param[in] filename Blob name of the tile index
+     * \param[in] index Opened tile index blob
+     * \param[in] srcType Data type of the stored values
+     * \param[in] row, col, nRows, nCols Window, which is shrunk to the valid cells of mask if \a byMask
+     * \param[in] byMask Read the tiles containing the valid cells of mask only
+     * \return false if any tile is missing or corrupted.
+     */
+    bool _read_blob_tiles(clsRasterBlobStore* store, const string &filename, clsBlobReader &index,
+                          GDALDataType srcType, int row, int col, int nRows, int nCols, bool byMask);
+
+    /*!
+     * \brief Fetch the tiles and convert them into the window of raster data, \sa _read_blob_tiles()
+     * The tiles are fetched in parallel by the clones of store, or one by one if it cannot be cloned.
+     * \tparam BufT Type of the converted values, i.e., T, or double if T is not a GDAL data type
+     * \param[in] version Write id of the tiles, \sa HEADER_RS_TILEVERSION
+     * \param[in] tiles Tiles to be read, i.e., tile row * NTILECOLS + tile col
+     * \param[in] storedRows, storedCols Extent of the stored raster
+     */
+    template<typename BufT>
+    bool _fetch_blob_tiles(clsRasterBlobStore* store, const string &filename, const string &version,
+                           GDALDataType srcType, const vector<int> &tiles, int tileSize, int storedRows,
+                           int storedCols, int row, int col, int nRows, int nCols);
 
     /*!
      * \brief Add other layer's rater data to m_raster2DData
@@ -712,6 +1736,52 @@ private:
     map<string, double *> m_statsMap2D;
     //! initial once
     bool m_initialized;
+    //! 8-neighbor index table of the stored cells, \sa getNeighborIndex()
+    int *m_neighborIndex;
+    //! Storage order of the valid cells
+    CellOrdering m_cellOrdering;
+    //! Map from stored cell index to the row-major index
+    int *m_toRowMajor;
+    //! Map from the row-major index to stored cell index
+    int *m_fromRowMajor;
+    //! Summed-area tables of each layer, (nRows + 1) * (nCols + 1), \sa buildSummedAreaTable()
+    double **m_satSum;
+    //! Valid-count tables of each layer, (nRows + 1) * (nCols + 1)
+    int **m_satCount;
+    //! Block size of the min/max pyramid, \sa buildMinMaxPyramid()
+    int m_pyramidBlockSize;
+    //! Offset of each level in the pyramid arrays, the last one is the total node number
+    vector<int> m_pyramidOffsets;
+    //! Row and column number of each level of the pyramid
+    vector<RowCol> m_pyramidSizes;
+    //! Start index of the stored cells of each block in \a m_pyramidCells, i.e., CSR format
+    int *m_pyramidCellStart;
+    //! Indexes of the stored cells grouped by blocks
+    int *m_pyramidCells;
+    //! Min values of the pyramid nodes of each layer
+    double **m_pyramidMin;
+    //! Max values of the pyramid nodes of each layer
+    double **m_pyramidMax;
+    //! Modified blocks of each layer which wait for updating
+    vector<vector<int> > m_pyramidDirty;
+    //! Mapped native or scratch file which holds the raster data and positions,
+    //! \sa ReadNativeFile(), moveToScratchFile()
+    clsMemoryMap *m_mappedFile;
+    //! Shared memory published by this raster, \sa outputToSharedMemory()
+    clsMemoryMap *m_sharedMemory;
+    //! Spill file of the evicted raster data, empty if not evicted, \sa evict()
+    string m_spillFile;
+    //! Contiguous storage of the positions, i.e., [nCells][2], NULL if the positions are allocated by rows
+    int *m_positionBlock;
+    //! Hash of the identity and header of the file read, \sa getContentHash()
+    uint64_t m_contentHash;
+    //! The raster is opened lazily and the data is not read yet, \sa ReadHeaderOnly()
+    mutable atomic<bool> m_lazyPending;
+    //! Serialize the reading, materialization, eviction, and the lazy build of derived data, e.g., neighbor
+    //! index, recursive since reading may access the raster itself
+    mutable recursive_mutex m_materializeMutex;
+    //! The data is being read by the thread which holds \a m_materializeMutex
+    bool m_materializing;
 };
 
 #endif /* CLS_RASTER_DATA */
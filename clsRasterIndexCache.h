@@ -0,0 +1,193 @@
+/*!
+ * \brief Define on-disk cache of the computed valid cell index of raster data
+ *
+ *        The index, e.g., the row runs of the valid cells of a mask and the mapping from a mask
+ *        to a raster, is stored as one file per key in the cache directory, and the key is derived
+ *        from the identity of the mask file, i.e., path, size, and modification time, rather than
+ *        the decoded grid data.
+ *        So a modified mask file leads to a new key, and the stale files are never hit.
+ *        The cache is disabled until the directory is set by clsRasterIndexCache::setDirectory().
+ */
+#ifndef CLS_RASTER_INDEX_CACHE
+#define CLS_RASTER_INDEX_CACHE
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstring>
+#include <atomic>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#ifdef windows
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif /* windows */
+
+using namespace std;
+
+/*!
+ * Magic string and version of the index cache file
+ */
+#define INDEX_CACHE_MAGIC       "RSIDXCHE"
+#define INDEX_CACHE_VERSION     1
+/*!
+ * Parameters of 64-bit FNV-1a hash
+ */
+#define FNV_OFFSET_BASIS        14695981039346656037ULL
+#define FNV_PRIME               1099511628211ULL
+
+/*!
+ * \class clsRasterIndexCache
+ * \ingroup data
+ * \brief Load and store int32 arrays of the valid cell index by key
+ * Each cache file is written to a temporary file first and then renamed,
+ * so that concurrent processes never read a partially written file.
+ */
+class clsRasterIndexCache {
+public:
+    /*!
+     * \brief Set the cache directory, the empty string (the default) disables the cache
+     * The directory should exist and be writable.
+     */
+    static void setDirectory(const string &dir) {
+        string &cachedir = _directory();
+        cachedir = dir;
+        if (!cachedir.empty() && cachedir[cachedir.size() - 1] != '/' && cachedir[cachedir.size() - 1] != '\\') {
+            cachedir += "/";
+        }
+    }
+
+    //! Get the cache directory
+    static string getDirectory(void) { return _directory(); }
+
+    //! Is the cache enabled?
+    static bool isEnabled(void) { return !_directory().empty(); }
+
+    /*!
+     * \brief FNV-1a hash of data, which takes 8 bytes per step for speed
+     * \param[in] data Data to be hashed
+     * \param[in] length Data length in bytes
+     * \param[in] seed Hash of the previous data, which combines several pieces of data
+     */
+    static uint64_t hash(const void *data, size_t length, uint64_t seed = FNV_OFFSET_BASIS) {
+        const unsigned char *bytes = static_cast<const unsigned char *>(data);
+        uint64_t h = seed;
+        size_t i = 0;
+        for (; i + 8 <= length; i += 8) {
+            uint64_t word;
+            memcpy(&word, bytes + i, 8);
+            h = (h ^ word) * FNV_PRIME;
+        }
+        for (; i < length; i++) {
+            h = (h ^ bytes[i]) * FNV_PRIME;
+        }
+        return h;
+    }
+
+    /*!
+     * \brief Identity of file by path, size, and modification time, which is changed once the file is modified
+     * \return 0 if the file does not exist.
+     */
+    static uint64_t fileIdentity(const string &filename) {
+        struct stat st;
+        if (stat(filename.c_str(), &st) != 0) return 0;
+        int64_t stamps[3] = {(int64_t) st.st_size, (int64_t) st.st_mtime, 0};
+#ifdef __linux__
+        stamps[2] = (int64_t) st.st_mtim.tv_nsec;
+#endif /* __linux__ */
+        uint64_t h = hash(filename.data(), filename.size());
+        h = hash(stamps, sizeof(stamps), h);
+        return h == 0 ? 1 : h;
+    }
+
+    /*!
+     * \brief Load cached values
+     * \param[in] key Cache key
+     * \param[in] kind Kind of the values, e.g., "mapping", which is a part of the file name
+     * \param[out] values Cached values
+     * \return false if not cached or the cache file is invalid.
+     */
+    static bool load(uint64_t key, const string &kind, vector<int32_t> &values) {
+        if (!isEnabled()) return false;
+        ifstream cachefile(_filename(key, kind).c_str(), ios::in | ios::binary);
+        if (!cachefile.is_open()) return false;
+        char magic[8];
+        int32_t version = 0;
+        uint64_t storedkey = 0;
+        int64_t count = -1;
+        cachefile.read(magic, sizeof(magic));
+        cachefile.read((char *) &version, sizeof(version));
+        cachefile.read((char *) &storedkey, sizeof(storedkey));
+        cachefile.read((char *) &count, sizeof(count));
+        if (!cachefile.good() || strncmp(magic, INDEX_CACHE_MAGIC, sizeof(magic)) != 0 ||
+            version != INDEX_CACHE_VERSION || storedkey != key || count < 0) {
+            return false;
+        }
+        values.resize((size_t) count);
+        if (count > 0) cachefile.read((char *) &values[0], count * sizeof(int32_t));
+        uint64_t checksum = 0;
+        cachefile.read((char *) &checksum, sizeof(checksum));
+        if (!cachefile.good() || checksum != hash(count > 0 ? &values[0] : NULL, count * sizeof(int32_t))) {
+            values.clear();
+            return false;
+        }
+        return true;
+    }
+
+    /*!
+     * \brief Store values atomically, i.e., write a temporary file and rename it
+     * \return false if failed, which does not affect the caller except the cache is missed next time.
+     */
+    static bool store(uint64_t key, const string &kind, const vector<int32_t> &values) {
+        if (!isEnabled()) return false;
+        string filename = _filename(key, kind);
+        /// the temporary file is unique among the processes and the threads of each process
+        static atomic<unsigned int> counter(0);
+        stringstream oss;
+        oss << filename << "." << getpid() << "." << counter++ << ".tmp";
+        string tmpfilename = oss.str();
+        ofstream cachefile(tmpfilename.c_str(), ios::out | ios::binary | ios::trunc);
+        if (!cachefile.is_open()) return false;
+        int32_t version = INDEX_CACHE_VERSION;
+        int64_t count = (int64_t) values.size();
+        uint64_t checksum = hash(count > 0 ? &values[0] : NULL, count * sizeof(int32_t));
+        cachefile.write(INDEX_CACHE_MAGIC, 8);
+        cachefile.write((const char *) &version, sizeof(version));
+        cachefile.write((const char *) &key, sizeof(key));
+        cachefile.write((const char *) &count, sizeof(count));
+        if (count > 0) cachefile.write((const char *) &values[0], count * sizeof(int32_t));
+        cachefile.write((const char *) &checksum, sizeof(checksum));
+        bool succeed = cachefile.good();
+        cachefile.close();
+#ifdef windows
+        /// rename() does not replace the existing file on Windows
+        if (succeed) remove(filename.c_str());
+#endif /* windows */
+        if (!succeed || rename(tmpfilename.c_str(), filename.c_str()) != 0) {
+            remove(tmpfilename.c_str());
+            return false;
+        }
+        return true;
+    }
+
+private:
+    //! Cache directory shared by all rasters
+    static string &_directory(void) {
+        static string cachedir = "";
+        return cachedir;
+    }
+
+    //! Cache file name, e.g., <dir>/mapping_0123456789abcdef.idx
+    static string _filename(uint64_t key, const string &kind) {
+        char keystr[17];
+        sprintf(keystr, "%016llx", (unsigned long long) key);
+        return _directory() + kind + "_" + keystr + ".idx";
+    }
+};
+
+#endif /* CLS_RASTER_INDEX_CACHE */
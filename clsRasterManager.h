@@ -0,0 +1,308 @@
+/*!
+ * \brief Define process-wide registry of rasters with memory budget
+ *
+ *        All rasters are registered when initialized, and their memory footprint is tracked.
+ *        If a memory budget is set, the least recently used rasters are evicted when the budget
+ *        is exceeded, i.e., the raster data is written to a spill file and released, and it is
+ *        read back transparently on the next access. Hot rasters can be pinned to stay in memory.
+ */
+#ifndef CLS_RASTER_MANAGER
+#define CLS_RASTER_MANAGER
+
+#include <string>
+#include <vector>
+#include <set>
+#include <sstream>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <cstdlib>
+#include <stdint.h>
+
+#ifdef windows
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif /* windows */
+
+using namespace std;
+
+class clsManagedRaster;
+
+/*!
+ * \class clsRasterManager
+ * \ingroup data
+ * \brief Registry of all rasters in the process, which enforces the memory budget by LRU eviction
+ * The budget is enforced when a raster is read or constructed, and by \a enforceBudget(), but not when
+ * the lazily opened or evicted raster is read transparently on access, e.g., the mask read back while
+ * masking another raster, so that the raster in use is never evicted by the access of another raster.
+ * Eviction releases the raster data only, the positions of valid cells are kept since they may be
+ * shared with other rasters, e.g., by mask. The storage mapped from files (native binary file,
+ * scratch file, or shared memory) is paged by the OS, which is neither counted nor evicted.
+ * The raster being constructed or read is locked, which is neither evicted nor measured by other
+ * threads, i.e., its footprint measured last time is used. The spill files are written outside the
+ * registry lock, so that the other threads can register, release, and measure rasters meanwhile.
+ * The pointers of raster data got before eviction are invalid after eviction, so the rasters
+ * accessed by pointers, or accessed by other threads while reading rasters, should be pinned.
+ */
+class clsRasterManager {
+public:
+    //! Set the memory budget in bytes, 0 (the default) means unbounded
+    static void setMemoryBudget(int64_t bytes) { _budget().store(bytes < 0 ? 0 : bytes); }
+
+    //! Get the memory budget in bytes
+    static int64_t getMemoryBudget(void) { return _budget().load(); }
+
+    //! Set the directory of spill files, the empty string (the default) means the temporary directory
+    static void setSpillDirectory(const string &dir) {
+        lock_guard<mutex> lock(_spillMutex());
+        _spillDirectory() = dir;
+    }
+
+    //! Get a unique spill file name, e.g., <dir>/rsspill_<pid>_<sequence>.dat
+    static string getSpillFileName(void);
+
+    //! Total memory footprint of all rasters in bytes
+    static int64_t getMemoryUsage(void);
+
+    //! Memory footprint of the pinned rasters in bytes
+    static int64_t getPinnedUsage(void);
+
+    //! Number of the rasters whose stored cells follow the positions of \a owner, e.g., the mask
+    static int countPositionSharers(const clsManagedRaster *owner);
+
+    //! Number of the registered rasters
+    static int getRasterCount(void) {
+        lock_guard<mutex> lock(_mutex());
+        return (int) _rasters().size();
+    }
+
+    /*!
+     * \brief Evict the least recently used rasters until the memory usage is within the budget
+     * \param[in] keep Raster not to be evicted, e.g., the one just read
+     * \return Bytes released.
+     */
+    static int64_t enforceBudget(clsManagedRaster *keep = NULL);
+
+    //! Register raster, called by the raster only
+    static void registerRaster(clsManagedRaster *raster) {
+        lock_guard<mutex> lock(_mutex());
+        _rasters().insert(raster);
+    }
+
+    //! Unregister raster, called by the raster only
+    static void unregisterRaster(clsManagedRaster *raster) {
+        lock_guard<mutex> lock(_mutex());
+        _rasters().erase(raster);
+    }
+
+    //! Current clock of access, which advances when the budget is enforced
+    static uint64_t getClock(void) { return _clock().load(memory_order_relaxed); }
+
+private:
+    //! Registered rasters
+    static set<clsManagedRaster *> &_rasters(void) {
+        static set<clsManagedRaster *> rasters;
+        return rasters;
+    }
+
+    //! Mutex of the registry
+    static mutex &_mutex(void) {
+        static mutex registryMutex;
+        return registryMutex;
+    }
+
+    //! Mutex of the spill directory, which is separated since spill files are created while evicting
+    static mutex &_spillMutex(void) {
+        static mutex spillMutex;
+        return spillMutex;
+    }
+
+    //! Memory budget in bytes
+    static atomic<int64_t> &_budget(void) {
+        static atomic<int64_t> budget(0);
+        return budget;
+    }
+
+    //! Clock of access, \sa clsManagedRaster::getLastAccess()
+    static atomic<uint64_t> &_clock(void) {
+        static atomic<uint64_t> clock(1);
+        return clock;
+    }
+
+    //! Directory of spill files
+    static string &_spillDirectory(void) {
+        static string spilldir = "";
+        return spilldir;
+    }
+};
+
+/*!
+ * \class clsManagedRaster
+ * \ingroup data
+ * \brief Interface of the raster managed by \a clsRasterManager, which registers itself
+ */
+class clsManagedRaster {
+public:
+    //! Constructor, the derived raster registers itself when initialized
+    clsManagedRaster(void) : m_lastAccess(0), m_pinCount(0), m_lastFootprint(0) {}
+
+    //! Copy constructor, the access and pin state is not copied
+    clsManagedRaster(const clsManagedRaster &) : m_lastAccess(0), m_pinCount(0), m_lastFootprint(0) {}
+
+    //! Assignment, the access and pin state is not copied
+    clsManagedRaster &operator=(const clsManagedRaster &) { return *this; }
+
+    //! Destructor, the derived raster unregisters itself
+    virtual ~clsManagedRaster(void) {}
+
+    /*!
+     * \brief Bytes of the raster data and owned positions allocated in memory
+     * The raster locked by another thread, e.g., being read, returns the footprint measured last time.
+     */
+    virtual int64_t getFootprint(void) const = 0;
+
+    /*!
+     * \brief Lock the raster if it is not being constructed or read by another thread
+     * The locked raster is neither read nor released until unlocked, \sa clsRasterManager::enforceBudget()
+     */
+    virtual bool tryLockStorage(void) const = 0;
+
+    //! Unlock the raster locked by \a tryLockStorage()
+    virtual void unlockStorage(void) const = 0;
+
+    /*!
+     * \brief Release the raster data into spill file, which is read back on the next access
+     * \return Bytes released, 0 if not evictable, e.g., pinned or being read.
+     */
+    virtual int64_t evict(void) = 0;
+
+    //! Pin the raster in memory, i.e., never evicted until unpinned as many times as pinned
+    void pin(void) { m_pinCount++; }
+
+    //! Unpin the raster
+    void unpin(void) {
+        int count = m_pinCount.load();
+        while (count > 0 && !m_pinCount.compare_exchange_weak(count, count - 1)) {}
+    }
+
+    //! Is the raster pinned?
+    bool isPinned(void) const { return m_pinCount.load() > 0; }
+
+    //! Raster whose positions of valid cells are shared by this raster, e.g., the mask
+    virtual const clsManagedRaster *getPositionOwner(void) const { return NULL; }
+
+    //! Clock of the last access, \sa clsRasterManager::getClock()
+    uint64_t getLastAccess(void) const { return m_lastAccess.load(memory_order_relaxed); }
+
+protected:
+    //! Record the access, which is cheap enough to be called on every access
+    void _touch(void) const {
+        uint64_t now = clsRasterManager::getClock();
+        if (m_lastAccess.load(memory_order_relaxed) != now) m_lastAccess.store(now, memory_order_relaxed);
+    }
+
+    //! Record the footprint measured, \sa getFootprint()
+    int64_t _set_last_footprint(int64_t bytes) const {
+        m_lastFootprint.store(bytes, memory_order_relaxed);
+        return bytes;
+    }
+
+    //! Footprint measured last time
+    int64_t _get_last_footprint(void) const { return m_lastFootprint.load(memory_order_relaxed); }
+
+private:
+    ///< Clock of the last access
+    mutable atomic<uint64_t> m_lastAccess;
+    ///< Pin count
+    atomic<int> m_pinCount;
+    ///< Footprint measured last time
+    mutable atomic<int64_t> m_lastFootprint;
+};
+
+/// Since clsRasterManager is not a class template, the following definitions are inline.
+
+inline string clsRasterManager::getSpillFileName(void) {
+    static atomic<uint64_t> sequence(0);
+    string dir;
+    {
+        lock_guard<mutex> lock(_spillMutex());
+        dir = _spillDirectory();
+    }
+    if (dir.empty()) {
+#ifdef windows
+        dir = getenv("TEMP") != NULL ? getenv("TEMP") : ".";
+#else
+        dir = getenv("TMPDIR") != NULL ? getenv("TMPDIR") : "/tmp";
+#endif /* windows */
+    }
+    if (dir[dir.size() - 1] != '/' && dir[dir.size() - 1] != '\\') dir += "/";
+    stringstream oss;
+    oss << dir << "rsspill_" << getpid() << "_" << sequence++ << ".dat";
+    return oss.str();
+}
+
+inline int64_t clsRasterManager::getMemoryUsage(void) {
+    lock_guard<mutex> lock(_mutex());
+    int64_t total = 0;
+    for (set<clsManagedRaster *>::iterator it = _rasters().begin(); it != _rasters().end(); it++) {
+        total += (*it)->getFootprint();
+    }
+    return total;
+}
+
+inline int64_t clsRasterManager::getPinnedUsage(void) {
+    lock_guard<mutex> lock(_mutex());
+    int64_t total = 0;
+    for (set<clsManagedRaster *>::iterator it = _rasters().begin(); it != _rasters().end(); it++) {
+        if ((*it)->isPinned()) total += (*it)->getFootprint();
+    }
+    return total;
+}
+
+inline int clsRasterManager::countPositionSharers(const clsManagedRaster *owner) {
+    lock_guard<mutex> lock(_mutex());
+    int count = 0;
+    for (set<clsManagedRaster *>::iterator it = _rasters().begin(); it != _rasters().end(); it++) {
+        if (*it != owner && (*it)->getPositionOwner() == owner) count++;
+    }
+    return count;
+}
+
+inline int64_t clsRasterManager::enforceBudget(clsManagedRaster *keep /* = NULL */) {
+    int64_t budget = getMemoryBudget();
+    if (budget <= 0) return 0;
+    vector<clsManagedRaster *> victims;
+    {
+        lock_guard<mutex> lock(_mutex());
+        /// the rasters accessed after now are more recent than all the others
+        _clock()++;
+        int64_t total = 0;
+        vector<pair<uint64_t, pair<int64_t, clsManagedRaster *> > > candidates;
+        for (set<clsManagedRaster *>::iterator it = _rasters().begin(); it != _rasters().end(); it++) {
+            int64_t footprint = (*it)->getFootprint();
+            total += footprint;
+            if (footprint > 0 && *it != keep && !(*it)->isPinned()) {
+                candidates.push_back(make_pair((*it)->getLastAccess(), make_pair(footprint, *it)));
+            }
+        }
+        if (total <= budget) return 0;
+        stable_sort(candidates.begin(), candidates.end());
+        /// the locked victims are not released by other threads after the registry is unlocked
+        int64_t selected = 0;
+        for (size_t i = 0; i < candidates.size() && total - selected > budget; i++) {
+            if (!candidates[i].second.second->tryLockStorage()) continue;
+            victims.push_back(candidates[i].second.second);
+            selected += candidates[i].second.first;
+        }
+    }
+    int64_t released = 0;
+    for (size_t i = 0; i < victims.size(); i++) {
+        released += victims[i]->evict();
+        victims[i]->unlockStorage();
+    }
+    return released;
+}
+
+#endif /* CLS_RASTER_MANAGER */
@@ -0,0 +1,224 @@
+/*!
+ * \brief Define asynchronous write-behind output queue of clsRasterData
+ *
+ *        Rasters are enqueued as snapshots (deep copied, or moved by taking the ownership)
+ *        with the target path and options, and written by a pool of background I/O threads,
+ *        so that the computation of the next timestep overlaps with compressing and writing.
+ *        1. Bounded queue depth, i.e., enqueue blocks when the queue is full (backpressure)
+ *        2. Completion future of each output, which reports whether the output succeeded
+ *        3. Flush on destruction
+ */
+#ifndef CLS_RASTER_OUTPUT_QUEUE
+#define CLS_RASTER_OUTPUT_QUEUE
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <functional>
+#include <memory>
+#include <deque>
+
+#include "clsRasterData.h"
+
+/*!
+ * \class clsRasterOutputQueue
+ * \ingroup data
+ * \brief Write-behind output queue with a pool of I/O threads
+ * Usage:
+ *     clsRasterOutputQueue outqueue(2, 16);
+ *     shared_future<bool> done = outqueue.enqueue(&raster, "out.tif", GTiffWriteOptions::FastReread());
+ *     ... // go on computing, \a raster can be modified since a snapshot is enqueued
+ *     if (!done.get()) ... // or outqueue.flush() without checking the result
+ * The mask of the enqueued raster is shared by the snapshot, and should not be released
+ * before the output is completed.
+ */
+class clsRasterOutputQueue {
+public:
+    /*!
+     * \brief Constructor
+     * \param[in] nThreads Number of background I/O threads
+     * \param[in] maxQueued Maximum number of outputs waiting in the queue, enqueue blocks if reached
+     */
+    explicit clsRasterOutputQueue(int nThreads = 2, int maxQueued = 16);
+
+    //! Destructor, flush all queued outputs and stop the I/O threads
+    ~clsRasterOutputQueue(void);
+
+    /*!
+     * \brief Enqueue raster to be written to file by \a clsRasterData::outputToFile
+     * \param[in] raster Raster data
+     * \param[in] filename Output file path, e.g., ".asc" and ".tif"
+     * \param[in] options Creation options for GeoTIFF output
+     * \param[in] takeOwnership If true, \a raster is moved into the queue and released after written,
+     *                          otherwise a snapshot is copied and \a raster can be reused by the caller.
+     * \return Future which is ready when the output is completed, and holds false if the output failed
+     */
+    template<typename T, typename MaskT>
+    shared_future<bool> enqueue(clsRasterData<T, MaskT> *raster, string filename,
+                                const GTiffWriteOptions &options = GTiffWriteOptions(),
+                                bool takeOwnership = false);
+
+#ifdef USE_MONGODB
+    /*!
+     * \brief Enqueue raster to be written to MongoDB by \a clsRasterData::outputToMongoDB
+     * Outputs to MongoDB are serialized since the GridFS handle is not thread-safe.
+     * \param[in] options Options of the stored blob, e.g., data type, compression, and tile size
+     * \sa enqueue
+     */
+    template<typename T, typename MaskT>
+    shared_future<bool> enqueueToMongoDB(clsRasterData<T, MaskT> *raster, string filename, MongoGridFS *gfs,
+                                         const BlobWriteOptions &options = BlobWriteOptions(),
+                                         bool takeOwnership = false);
+#endif /* USE_MONGODB */
+
+    //! Block until all queued and running outputs are completed
+    void flush(void);
+
+    //! Number of outputs waiting in the queue or running
+    int pending(void);
+
+private:
+    //! Add job into the queue, block if the queue is full
+    shared_future<bool> _submit(function<bool()> job);
+
+    //! Loop of I/O thread
+    void _worker(void);
+
+    /*!
+     * \brief Take a snapshot of raster, which is pinned until written, \sa clsRasterManager
+     * \return Shared pointer which releases the snapshot after written
+     */
+    template<typename T, typename MaskT>
+    shared_ptr<clsRasterData<T, MaskT> > _snapshot(clsRasterData<T, MaskT> *raster, bool takeOwnership);
+
+private:
+    ///< I/O threads
+    vector<thread> m_workers;
+    ///< Queued output jobs
+    deque<packaged_task<bool()> > m_jobs;
+    ///< Maximum number of queued jobs
+    size_t m_maxQueued;
+    ///< Number of running jobs
+    int m_running;
+    ///< Stop flag of I/O threads
+    bool m_stop;
+    ///< Mutex of the queue
+    mutex m_mutex;
+    ///< Notify I/O threads when a job is queued or stopped
+    condition_variable m_notEmpty;
+    ///< Notify producers when a job is dequeued
+    condition_variable m_notFull;
+    ///< Notify flush() when all jobs are completed
+    condition_variable m_idle;
+#ifdef USE_MONGODB
+    ///< Serialize outputs to MongoDB
+    mutex m_mongoMutex;
+#endif /* USE_MONGODB */
+};
+
+/// Since clsRasterOutputQueue is not a class template, the following definitions are inline.
+
+inline clsRasterOutputQueue::clsRasterOutputQueue(int nThreads /* = 2 */, int maxQueued /* = 16 */) :
+    m_maxQueued(maxQueued < 1 ? 1 : maxQueued), m_running(0), m_stop(false) {
+    if (nThreads < 1) nThreads = 1;
+    for (int i = 0; i < nThreads; i++) {
+        m_workers.push_back(thread(&clsRasterOutputQueue::_worker, this));
+    }
+}
+
+inline clsRasterOutputQueue::~clsRasterOutputQueue(void) {
+    {
+        unique_lock<mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_notEmpty.notify_all();
+    /// the I/O threads exit after the queue is drained
+    for (vector<thread>::iterator it = m_workers.begin(); it != m_workers.end(); it++) {
+        if (it->joinable()) it->join();
+    }
+}
+
+inline void clsRasterOutputQueue::flush(void) {
+    unique_lock<mutex> lock(m_mutex);
+    m_idle.wait(lock, [this] { return m_jobs.empty() && m_running == 0; });
+}
+
+inline int clsRasterOutputQueue::pending(void) {
+    unique_lock<mutex> lock(m_mutex);
+    return int(m_jobs.size()) + m_running;
+}
+
+inline shared_future<bool> clsRasterOutputQueue::_submit(function<bool()> job) {
+    packaged_task<bool()> task(job);
+    shared_future<bool> result = task.get_future().share();
+    {
+        unique_lock<mutex> lock(m_mutex);
+        m_notFull.wait(lock, [this] { return m_jobs.size() < m_maxQueued; });
+        m_jobs.push_back(move(task));
+    }
+    m_notEmpty.notify_one();
+    return result;
+}
+
+inline void clsRasterOutputQueue::_worker(void) {
+    while (true) {
+        packaged_task<bool()> task;
+        {
+            unique_lock<mutex> lock(m_mutex);
+            m_notEmpty.wait(lock, [this] { return m_stop || !m_jobs.empty(); });
+            if (m_jobs.empty()) return;  /// stopped and drained
+            task = move(m_jobs.front());
+            m_jobs.pop_front();
+            m_running++;
+        }
+        m_notFull.notify_one();
+        /// the result or exception, if any, is stored in the future
+        task();
+        {
+            unique_lock<mutex> lock(m_mutex);
+            m_running--;
+            if (m_jobs.empty() && m_running == 0) m_idle.notify_all();
+        }
+    }
+}
+
+template<typename T, typename MaskT>
+shared_ptr<clsRasterData<T, MaskT> > clsRasterOutputQueue::_snapshot(clsRasterData<T, MaskT> *raster,
+                                                                      bool takeOwnership) {
+    clsRasterData<T, MaskT> *snapshot = takeOwnership ? raster : new clsRasterData<T, MaskT>(*raster);
+    /// the snapshot being written by an I/O thread should not be evicted by the budget of other threads
+    snapshot->pin();
+    return shared_ptr<clsRasterData<T, MaskT> >(snapshot);
+}
+
+template<typename T, typename MaskT>
+shared_future<bool> clsRasterOutputQueue::enqueue(clsRasterData<T, MaskT> *raster, string filename,
+                                                  const GTiffWriteOptions &options /* = GTiffWriteOptions() */,
+                                                  bool takeOwnership /* = false */) {
+    shared_ptr<clsRasterData<T, MaskT> > snapshot = this->_snapshot(raster, takeOwnership);
+    return this->_submit([snapshot, filename, options] {
+        bool succeed = snapshot->outputToFile(filename, options);
+        snapshot->unpin();
+        return succeed;
+    });
+}
+
+#ifdef USE_MONGODB
+template<typename T, typename MaskT>
+shared_future<bool> clsRasterOutputQueue::enqueueToMongoDB(clsRasterData<T, MaskT> *raster, string filename,
+                                                           MongoGridFS *gfs,
+                                                           const BlobWriteOptions &options /* = BlobWriteOptions() */,
+                                                           bool takeOwnership /* = false */) {
+    shared_ptr<clsRasterData<T, MaskT> > snapshot = this->_snapshot(raster, takeOwnership);
+    mutex *mongoMutex = &m_mongoMutex;
+    return this->_submit([snapshot, filename, gfs, options, mongoMutex] {
+        lock_guard<mutex> lock(*mongoMutex);
+        bool succeed = snapshot->outputToMongoDB(filename, gfs, options);
+        snapshot->unpin();
+        return succeed;
+    });
+}
+#endif /* USE_MONGODB */
+
+#endif /* CLS_RASTER_OUTPUT_QUEUE */
@@ -0,0 +1,103 @@
+/*!
+ * \brief Define byte-shuffle and zlib codec of binary data
+ *
+ *        The k-th bytes of all values are made contiguous before compressed by zlib
+ *        (CPLZLibDeflate of GDAL), which compresses typed arrays, e.g., float rasters, much better.
+ *        Used by the block-compressed raster in memory and the compressed frames of raster blobs.
+ */
+#ifndef CLS_SHUFFLE_CODEC
+#define CLS_SHUFFLE_CODEC
+
+#include <vector>
+#include <cstring>
+
+#include "cpl_conv.h"
+
+using namespace std;
+
+/*!
+ * \class clsShuffleCodec
+ * \ingroup data
+ * \brief Shuffle and compress binary data of fixed-size values
+ * The data which is not compressible should be stored as is, and it is not shuffled.
+ */
+class clsShuffleCodec {
+public:
+    /*!
+     * \brief Byte-shuffle, the trailing bytes less than a value are kept in place
+     * \param[in] data Values
+     * \param[in] nBytes Data length in bytes
+     * \param[in] elemSize Size of each value in bytes
+     * \param[out] shuffled Buffer of at least \a nBytes
+     */
+    static void shuffle(const void *data, size_t nBytes, size_t elemSize, unsigned char *shuffled) {
+        const unsigned char *src = (const unsigned char *) data;
+        size_t count = nBytes / elemSize;
+        for (size_t i = 0; i < count; i++) {
+            for (size_t k = 0; k < elemSize; k++) {
+                shuffled[k * count + i] = src[i * elemSize + k];
+            }
+        }
+        if (count * elemSize < nBytes) memcpy(shuffled + count * elemSize, src + count * elemSize, nBytes % elemSize);
+    }
+
+    //! Reverse of shuffle()
+    static void unshuffle(const unsigned char *shuffled, size_t nBytes, size_t elemSize, void *data) {
+        unsigned char *dst = (unsigned char *) data;
+        size_t count = nBytes / elemSize;
+        for (size_t i = 0; i < count; i++) {
+            for (size_t k = 0; k < elemSize; k++) {
+                dst[i * elemSize + k] = shuffled[k * count + i];
+            }
+        }
+        if (count * elemSize < nBytes) memcpy(dst + count * elemSize, shuffled + count * elemSize, nBytes % elemSize);
+    }
+
+    /*!
+     * \brief Shuffle and deflate
+     * \param[in] data Values
+     * \param[in] nBytes Data length in bytes
+     * \param[in] elemSize Size of each value in bytes
+     * \param[in] level zlib compression level
+     * \param[out] encoded Compressed data
+     * \return false if the data is not compressible, which should be stored as is.
+     */
+    static bool compress(const void *data, size_t nBytes, size_t elemSize, int level,
+                         vector<unsigned char> &encoded) {
+        encoded.clear();
+        if (nBytes == 0) return false;
+        vector<unsigned char> shuffled(nBytes);
+        shuffle(data, nBytes, elemSize, &shuffled[0]);
+        encoded.resize(nBytes + nBytes / 8 + 64);
+        size_t outBytes = 0;
+        if (CPLZLibDeflate(&shuffled[0], nBytes, level, &encoded[0], encoded.size(), &outBytes) == NULL ||
+            outBytes >= nBytes) {
+            encoded.clear();
+            return false;
+        }
+        encoded.resize(outBytes);
+        return true;
+    }
+
+    /*!
+     * \brief Inflate and unshuffle the data compressed by compress()
+     * \param[in] encoded Compressed data
+     * \param[in] encodedBytes Length of the compressed data in bytes
+     * \param[in] elemSize Size of each value in bytes
+     * \param[out] data Buffer of the values
+     * \param[in] nBytes Length of the values in bytes
+     * \return false if the compressed data is corrupted.
+     */
+    static bool decompress(const void *encoded, size_t encodedBytes, size_t elemSize, void *data, size_t nBytes) {
+        if (nBytes == 0) return true;
+        vector<unsigned char> shuffled(nBytes);
+        size_t outBytes = 0;
+        if (CPLZLibInflate(encoded, encodedBytes, &shuffled[0], nBytes, &outBytes) == NULL || outBytes != nBytes) {
+            return false;
+        }
+        unshuffle(&shuffled[0], nBytes, elemSize, data);
+        return true;
+    }
+};
+
+#endif /* CLS_SHUFFLE_CODEC */
@@ -2,17 +2,102 @@
 #include "vld.h"
 #endif /* Run Visual Leak Detector during Debug */
 #include "clsRasterData.cpp"
+#include "clsFlowRouting.cpp"
+#include "clsCompressedRaster.cpp"
+#include "clsRasterOutputQueue.h"
 #include "utilities.h"
 #include "MongoUtil.h"
+#include <chrono>
 
 using namespace std;
 
+/*!
+ * \brief Check depression filling, D8 and D-infinity flow routing on a synthetic DEM, i.e., a plane
+ *        at about 1000 m tilted to the south with a flat-bottomed pit, where the default increment
+ *        of filling (1.e-5) is below the resolution of float. The corners are out of the mask,
+ *        and one valid cell of mask is NODATA of DEM.
+ * \return true if all cells drain out of the valid region, and the flow is conserved.
+ */
+bool CheckFlowRouting(const string &dir) {
+    const int rows = 9;
+    const int cols = 9;
+    string maskfile = dir + "synthetic_mask.asc";
+    string demfile = dir + "synthetic_dem.asc";
+    ofstream maskout(maskfile.c_str());
+    ofstream demout(demfile.c_str());
+    maskout << "NCOLS " << cols << "\nNROWS " << rows << "\nXLLCENTER 0\nYLLCENTER 0\nCELLSIZE 10\nNODATA_VALUE -9999\n";
+    demout << "NCOLS " << cols << "\nNROWS " << rows << "\nXLLCENTER 0\nYLLCENTER 0\nCELLSIZE 10\nNODATA_VALUE -9999\n";
+    int nValid = 0;
+    for (int i = 0; i < rows; i++) {
+        for (int j = 0; j < cols; j++) {
+            bool corner = (i == 0 || i == rows - 1) && (j == 0 || j == cols - 1);
+            maskout << (corner ? -9999 : 1) << " ";
+            if (i == 1 && j == 7) {
+                demout << "-9999 ";
+            } else if (i >= 3 && i <= 5 && j >= 3 && j <= 5) {
+                demout << "990 ";
+            } else {
+                demout << setprecision(8) << 1000. + (rows - i) * 0.5 + (j % 2) * 0.01 << " ";
+            }
+            if (!corner && !(i == 1 && j == 7)) nValid++;
+        }
+        maskout << endl;
+        demout << endl;
+    }
+    maskout.close();
+    demout.close();
+
+    clsRasterData<int> mask(maskfile, true);
+    clsRasterData<float, int> dem(demfile, true, &mask, true);
+    clsFlowRouting<float, int> routing(&dem);
+    clsRasterData<float, int> *filled = routing.FillDepressions();
+    clsRasterData<int, int> *d8 = routing.FlowDirectionD8(filled);
+    clsRasterData<float, int> *d8acc = routing.FlowAccumulation(d8);
+    clsRasterData<float, int> *dinf = routing.FlowDirectionDinf(filled);
+    clsRasterData<float, int> *dinfacc = routing.FlowAccumulationDinf(dinf, NULL, filled);
+    bool passed = filled != NULL && d8acc != NULL && dinfacc != NULL;
+    if (passed) {
+        const int *neighbors = mask.getNeighborIndex();
+        float *z = filled->getRasterDataPointer();
+        int *dir = d8->getRasterDataPointer();
+        float *acc = d8acc->getRasterDataPointer();
+        float *angle = dinf->getRasterDataPointer();
+        float *accinf = dinfacc->getRasterDataPointer();
+        double outflow = 0.;
+        for (int i = 0; i < mask.getCellNumber(); i++) {
+            if (FloatEqual(z[i], -9999.f)) {
+                passed = passed && FloatEqual(acc[i], -9999.f) && FloatEqual(accinf[i], -9999.f);
+                continue;
+            }
+            /// no flats or pits are left in the filled DEM, and every cell receives itself at least
+            passed = passed && dir[i] > FLOWDIR_UNDEFINED && acc[i] >= 1.f && accinf[i] >= 1.f;
+            for (int k = 0; k < 8 && dir[i] > FLOWDIR_UNDEFINED; k++) {
+                if (dir[i] != 1 << k) continue;
+                int n = neighbors[i * 8 + k];
+                if (n < 0 || FloatEqual(z[n], -9999.f)) outflow += acc[i];
+            }
+            /// the interior cell of the flat pit drains by the increments of filling
+            if (i == mask.getCellNumber() / 2) passed = passed && angle[i] >= 0.f && z[i] > 990.f;
+        }
+        passed = passed && FloatEqual(outflow, (double) nValid) && dinfacc->getMaximum() <= nValid + 1.e-3;
+    }
+    cout << "Flow routing check on synthetic DEM: " << (passed ? "passed" : "FAILED") << endl;
+    delete filled;
+    delete d8;
+    delete d8acc;
+    delete dinf;
+    delete dinfacc;
+    return passed;
+}
+
 int main(int argc, const char *argv[]) {
     GDALAllRegister();/// Register GDAL drivers, REQUIRED!
     SetDefaultOpenMPThread();
     std::cout << "*** Raster IO Class Demo ***\n";
     string apppath = GetAppPath();
     cout << apppath << endl;
+    /// Optional, cache the valid cell index of masks on disk, which is reused by the next run.
+    clsRasterIndexCache::setDirectory(apppath + "../data");
     string ascdemfile = apppath + "../data/dem_1.asc";
     string ascdemfile2 = apppath + "../data/dem_2.asc";
     string ascdemfile3 = apppath + "../data/dem_3.asc";
@@ -70,6 +155,42 @@ int main(int argc, const char *argv[]) {
     MongoClient client = MongoClient("127.0.0.1", 27017);
     MongoGridFS gfs = MongoGridFS(client.getGridFS(string("test"), string("spatial")));
     readr.outputToMongoDB(string("testImport"), &gfs);
+    /// 4.1 Store the valid cells only with their row runs, which is much smaller for masked raster
+    GridFSWriteOptions validOnly;
+    validOnly.validCellsOnly = true;
+    readr.outputToMongoDB(string("testImportValid"), &gfs, validOnly);
+    /// 4.2 Compress by frames of byte-shuffle and zlib, which is decompressed transparently on read
+    validOnly.compress = "SHUFFLE_ZLIB";
+    readr.outputToMongoDB(string("testImportCompressed"), &gfs, validOnly);
+    clsRasterData<float, int> decompressed(&gfs, "testImportCompressed", false, &maskr, false);
+    cout << "compressed round trip, mean: " << decompressed.getAverage() << " of " << readr.getAverage() << endl;
+    /// 4.3 Tiled layout, from which a window or the tiles covering a mask can be read only
+    GridFSWriteOptions tiled;
+    tiled.tileSize = 256;
+    readr.outputToMongoDB(string("testImportTiled"), &gfs, tiled);
+    clsRasterData<float, int> window;
+    window.ReadWindowFromMongoDB(&gfs, string("testImportTiled"), 0, 0, 100, 100);
+    /// 4.4 The same layouts in a local directory, which has the same semantics as GridFS
+    clsLocalBlobStore localStore(string("./"));
+    readr.outputToBlobStore(string("testImportLocal"), &localStore, tiled);
+    clsRasterData<float, int> local;
+    local.ReadFromBlobStore(&localStore, string("testImportLocal"));
+    /// 4.5 Cache the rasters read from GridFS on the local disk, the second read maps the cached file
+    clsRasterBlobCache::setDirectory(apppath + "../data");
+    clsRasterBlobCache::setCapacity(1024 * 1024 * 1024);
+    clsRasterData<float, int> remote(&gfs, "testImportCompressed", true, &maskr);
+    clsRasterData<float, int> cached(&gfs, "testImportCompressed", true, &maskr);
+    /// 5. Publish raster into shared memory, which is attached by other processes with zero copy
+    readr.outputToSharedMemory(string("raster1D"));
+    clsRasterData<float, int> attached;
+    attached.ReadFromSharedMemory(string("raster1D"), &maskr);
+    /// 6. Bound the memory of all rasters, the least recently used ones are spilled to disk and read back on access
+    clsRasterManager::setMemoryBudget(512 * 1024 * 1024);
+    readr.pin();
+    clsRasterData<float, int> spilled(ascdemfile, true, &maskr);
+    cout << "Memory usage: " << clsRasterManager::getMemoryUsage() << ", pinned: "
+         << clsRasterManager::getPinnedUsage() << ", evicted: " << spilled.isEvicted() << endl;
+    readr.unpin();
 
     /******* ASCII 2D Raster Demo *********/
     cout << "--  ASCII 2D Raster Demo" << endl;
@@ -133,6 +254,104 @@ int main(int argc, const char *argv[]) {
     cout << endl << endl;
     /// 3. Output raster to file
     gdalreadr.outputToFile(demout);
+    /// 3.1 Compare file size and write time of GeoTIFF creation options
+    vector<pair<string, GTiffWriteOptions> > tiffoptions;
+    tiffoptions.push_back(make_pair(string("default"), GTiffWriteOptions()));
+    tiffoptions.push_back(make_pair(string("fastreread"), GTiffWriteOptions::FastReread()));
+    GTiffWriteOptions lzwoptions = GTiffWriteOptions::FastReread();
+    lzwoptions.compress = "LZW";
+    lzwoptions.predictor = 3;
+    tiffoptions.push_back(make_pair(string("lzw_predictor3"), lzwoptions));
+    for (size_t i = 0; i < tiffoptions.size(); i++) {
+        string optout = apppath + "../data/raster1D_out_" + tiffoptions[i].first + ".tif";
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        gdalreadr.outputFileByGDAL(optout, tiffoptions[i].second);
+        double elapsed = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        ifstream outfile(optout.c_str(), ios::binary | ios::ate);
+        cout << tiffoptions[i].first << ": " << outfile.tellg() << " bytes, " << elapsed << " ms" << endl;
+    }
+    /// 3.2 Native binary format with the valid cell index, which is loaded by memory mapping
+    string nativeout = apppath + "../data/raster1D_out.rsb";
+    gdalreadr.calculateStatistics();
+    gdalreadr.outputToFile(nativeout);
+    chrono::steady_clock::time_point loadstart = chrono::steady_clock::now();
+    clsRasterData<float, int> nativereadr(nativeout, true, &gdalmaskr);
+    double loadtime = chrono::duration<double, milli>(chrono::steady_clock::now() - loadstart).count();
+    cout << "native format: mapped " << nativereadr.isMemoryMapped() << ", mean " << nativereadr.getAverage()
+         << ", loaded in " << loadtime << " ms" << endl;
+    /// 3.3 Open lazily, e.g., to plan a run by the headers of many inputs, the data is read on first access
+    vector<string> plannedfiles;
+    plannedfiles.push_back(demfile);
+    plannedfiles.push_back(demfile2);
+    plannedfiles.push_back(demfile3);
+    chrono::steady_clock::time_point planstart = chrono::steady_clock::now();
+    vector<clsRasterData<float, int> *> plannedrasters;
+    for (vector<string>::iterator it = plannedfiles.begin(); it != plannedfiles.end(); it++) {
+        clsRasterData<float, int> *plannedraster = new clsRasterData<float, int>();
+        if (plannedraster->ReadHeaderOnly(*it, true, &gdalmaskr)) plannedrasters.push_back(plannedraster);
+        else delete plannedraster;
+    }
+    double plantime = chrono::duration<double, milli>(chrono::steady_clock::now() - planstart).count();
+    cout << "headers of " << plannedrasters.size() << " rasters opened lazily in " << plantime << " ms" << endl;
+    for (size_t i = 0; i < plannedrasters.size(); i++) {
+        cout << "  " << plannedrasters[i]->getCoreName() << ": " << plannedrasters[i]->getRows() << " x "
+             << plannedrasters[i]->getCols() << ", materialized " << plannedrasters[i]->isMaterialized() << endl;
+    }
+    if (!plannedrasters.empty()) {
+        /// only the accessed raster is read
+        cout << "  mean of " << plannedrasters[0]->getCoreName() << ": " << plannedrasters[0]->getAverage()
+             << ", materialized " << plannedrasters[0]->isMaterialized() << endl;
+    }
+    for (size_t i = 0; i < plannedrasters.size(); i++) delete plannedrasters[i];
+    /// 3.4 Compare the throughput of in-RAM and out-of-core (memory-mapped scratch file) storage
+    clsRasterData<float, int> inramr(demfile, true, &gdalmaskr, true);
+    clsRasterData<float, int> scratchr(demfile, true, &gdalmaskr, true);
+    if (scratchr.moveToScratchFile("", true)) {
+        clsRasterData<float, int> *storages[2] = {&inramr, &scratchr};
+        const char *storagenames[2] = {"in-RAM", "scratch mmap"};
+        for (int s = 0; s < 2; s++) {
+            chrono::steady_clock::time_point sweepstart = chrono::steady_clock::now();
+            double sweepsum = 0.;
+            for (int sweep = 0; sweep < 100; sweep++) {
+                int sweepcells = storages[s]->getCellNumber();
+                for (int i = 0; i < sweepcells; i++) sweepsum += storages[s]->getValue(i);
+            }
+            double sweeptime = chrono::duration<double, milli>(chrono::steady_clock::now() - sweepstart).count();
+            cout << storagenames[s] << ": 100 sweeps in " << sweeptime << " ms, sum " << sweepsum << endl;
+        }
+    }
+    /// 4. Flow routing on the valid cells of DEM
+    CheckFlowRouting(apppath + "../data/");
+    clsRasterData<float, int> gdalmaskeddem(demfile, true, &gdalmaskr, true);
+    clsFlowRouting<float, int> flowrouting(&gdalmaskeddem);
+    clsRasterData<float, int> *filleddem = flowrouting.FillDepressions();
+    clsRasterData<int, int> *flowdir = flowrouting.FlowDirectionD8(filleddem);
+    clsRasterData<float, int> *flowacc = flowrouting.FlowAccumulation(flowdir);
+    if (flowacc != NULL) {
+        cout << "max flow accumulation: " << flowacc->getMaximum() << endl;
+        flowacc->outputToFile(apppath + "../data/flowacc_out.tif");
+    }
+    if (flowdir != NULL) {
+        /// D8 codes (-9999 ~ 128) fit in Int16, i.e., half size of the native Int32 output
+        GTiffWriteOptions int16options;
+        int16options.dataType = GDT_Int16;
+        flowdir->outputToFile(apppath + "../data/flowdir_out.tif", int16options);
+    }
+    /// 5. Write outputs asynchronously while going on computing
+    clsRasterOutputQueue outqueue(2, 8);
+    if (filleddem != NULL) {
+        /// moved into the queue, which releases it after written
+        shared_future<bool> filledout = outqueue.enqueue(filleddem, apppath + "../data/filled_out.tif",
+                                                         GTiffWriteOptions::FastReread(), true);
+        if (!filledout.get()) cout << "Write filled DEM failed." << endl;
+    }
+    if (flowacc != NULL) {
+        /// a snapshot is copied, so the raster can be modified or released immediately
+        outqueue.enqueue(flowacc, apppath + "../data/flowacc_async_out.asc");
+        delete flowacc;
+    }
+    outqueue.flush();
+    delete flowdir;
 
     cout << "--  2D Raster Demo by GDAL" << endl;
     /// 1. Constructor, same as the 1D raster demo, but with the vector as filenames input.
@@ -150,10 +369,29 @@ int main(int argc, const char *argv[]) {
         cout << "  min: " << gdalreadr2D.getMinimum(i) << ", std: " << gdalreadr2D.getSTD(i) << endl;
     }
     gdalreadr2D.outputToFile(demout2);
+    /// Or write all layers as bands of one GeoTIFF file
+    GTiffWriteOptions multibandoptions;
+    multibandoptions.multiBand = true;
+    multibandoptions.interleave = "BAND";
+    gdalreadr2D.outputToFile(apppath + "../data/raster2D_multiband_out.tif", multibandoptions);
     /// Copy 2D raster
     clsRasterData<float> copied2DRaster;
     copied2DRaster.Copy(gdalreadr2D);
     copied2DRaster.setCoreName("copiedRaster");
+    /// Block-compressed multi-layer raster with the mask index, decompressed on demand
+    clsRasterData<float, int> *maskedstack = new clsRasterData<float, int>(demfilenames, true, &gdalmaskr, true);
+    clsCompressedRaster<float, int> compressedstack(maskedstack, 1024, 8);
+    delete maskedstack;
+    if (compressedstack.isInitialized()) {
+        cout << "compressed stack: " << compressedstack.getCompressedSize() << " of "
+             << compressedstack.getUncompressedSize() << " bytes, value of cell 0 on layer 2: "
+             << compressedstack.getValue(0, 2) << endl;
+        clsRasterData<float, int> *restoredstack = compressedstack.toRasterData();
+        if (restoredstack != NULL) {
+            restoredstack->outputToFile(apppath + "../data/raster2D_restored.tif");
+            delete restoredstack;
+        }
+    }
 
     return 0;
 }